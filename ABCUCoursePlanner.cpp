@@ -14,42 +14,774 @@
 #include <algorithm>
 #include <string>
 #include <limits>
+#include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <deque>
+#include <list>
+#include <string_view>
+#include <memory>
+#include <memory_resource>
+#include <thread>
+#include <atomic>
+#include <array>
+#include <csignal>
+#include <cstdlib>
+#include <mutex>
+#include <future>
+#include <condition_variable>
+#include <functional>
+#include <queue>
+#include <tuple>
+#include <iomanip>
+#include <chrono>
+#include <cstring>
+#include <bit>
+#include <charconv>
+#include <ctime>
+#include <filesystem>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
+//============================================================================
+// Binary Encoding
+//============================================================================
+
+/**
+ * Append an unsigned LEB128 varint
+ *
+ * @param out Buffer to append to
+ * @param value Value to encode
+ */
+void appendVarint(string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+/**
+ * Read an unsigned LEB128 varint from the front of a buffer
+ *
+ * @param in Buffer, advanced past the varint
+ * @param value Receives the value
+ * @return false if the buffer ends first
+ */
+bool readVarint(string_view& in, uint64_t* value) {
+    *value = 0;
+    for (unsigned shift = 0; !in.empty() && shift < 64; shift += 7) {
+        const auto byte = static_cast<uint8_t>(in.front());
+        in.remove_prefix(1);
+        *value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (byte < 0x80) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Append a length-prefixed string
+ *
+ * @param out Buffer to append to
+ * @param text Text to encode
+ */
+void appendField(string& out, const string_view text) {
+    appendVarint(out, text.size());
+    out += text;
+}
+
+/**
+ * Read a length-prefixed string from the front of a buffer
+ *
+ * @param in Buffer, advanced past the string
+ * @param text Receives a view into the buffer
+ * @return false if the buffer ends first
+ */
+bool readField(string_view& in, string_view* text) {
+    uint64_t length;
+    if (!readVarint(in, &length) || length > in.size()) {
+        return false;
+    }
+    *text = in.substr(0, length);
+    in.remove_prefix(length);
+    return true;
+}
+
+//============================================================================
+// Title Compression
+//============================================================================
+
+/**
+ * Words of every course title, each stored once and numbered
+ * Shared by all catalogs in the process and never shrinks; title words
+ * form a small vocabulary, and numbers are kept out of it. Adding words
+ * takes a lock, but reading one does not: an id only reaches a reader
+ * inside a title encoded after the word was added, and titles are handed
+ * between threads through the same locks and atomics as their catalogs.
+ */
+class TitleDictionary final {
+    static constexpr unsigned chunkBits = 16;
+    static constexpr size_t chunkCount = 4096;
+
+    mutex lock;
+    deque<string> words;
+    unordered_map<string_view, uint32_t> ids;
+    array<atomic<string_view*>, chunkCount> chunks{};
+    size_t wordBytes = 0;
+
+public:
+    static constexpr uint32_t none = numeric_limits<uint32_t>::max();
+
+    TitleDictionary() = default;
+    TitleDictionary(const TitleDictionary&) = delete;
+    TitleDictionary& operator=(const TitleDictionary&) = delete;
+    ~TitleDictionary();
+    uint32_t Intern(string_view word);
+    [[nodiscard]] string_view Word(uint32_t id) const;
+    [[nodiscard]] size_t Size();
+    [[nodiscard]] size_t Bytes();
+};
+
+/**
+ * Destructor
+ */
+TitleDictionary::~TitleDictionary() {
+    for (auto& chunk : chunks) {
+        delete[] chunk.load(memory_order_relaxed);
+    }
+}
+
+/**
+ * Get the id of a word, adding it if it is new
+ *
+ * @param word The word
+ * @return Its id, or none once the dictionary is full
+ */
+uint32_t TitleDictionary::Intern(const string_view word) {
+    lock_guard guard(lock);
+    if (const auto found = ids.find(word); found != ids.end()) {
+        return found->second;
+    }
+    const size_t id = words.size();
+    if (id >= chunkCount << chunkBits) {
+        return none;
+    }
+    if (id % (size_t{1} << chunkBits) == 0) {
+        chunks[id >> chunkBits].store(new string_view[size_t{1} << chunkBits], memory_order_release);
+    }
+    const string_view stored = words.emplace_back(word);
+    chunks[id >> chunkBits].load(memory_order_relaxed)[id & ((size_t{1} << chunkBits) - 1)] = stored;
+    ids.emplace(stored, static_cast<uint32_t>(id));
+    wordBytes += word.size();
+    return static_cast<uint32_t>(id);
+}
+
+/**
+ * Get a word by id
+ *
+ * @param id An id from Intern
+ * @return The word
+ */
+string_view TitleDictionary::Word(const uint32_t id) const {
+    return chunks[id >> chunkBits].load(memory_order_acquire)[id & ((size_t{1} << chunkBits) - 1)];
+}
+
+/**
+ * Number of distinct words
+ */
+size_t TitleDictionary::Size() {
+    lock_guard guard(lock);
+    return words.size();
+}
+
+/**
+ * Approximate memory held by the words and their index
+ */
+size_t TitleDictionary::Bytes() {
+    lock_guard guard(lock);
+    return wordBytes + words.size() * (sizeof(string) + sizeof(string_view)) +
+           ids.size() * (sizeof(pair<string_view, uint32_t>) + 2 * sizeof(void*));
+}
+
+/**
+ * The process-wide title dictionary
+ */
+TitleDictionary titleWords;
+
+/**
+ * A course title stored as word ids
+ * The title is split at single spaces and each piece is written as a
+ * varint: a titleWords id, the value of a run of digits (without leading
+ * zeros), or literal text once the dictionary is full. The low two bits
+ * of each varint say which. Encodings of up to 15 bytes, which is most
+ * titles, are kept inside the object's 16 bytes of storage; longer ones
+ * take one block from the title's memory resource, so titles in a
+ * catalog share its arena. Decoding appends each word in turn and
+ * allocates nothing else.
+ */
+class CompressedTitle final {
+    static constexpr size_t capacity = 16;
+    static constexpr uint8_t onHeap = 0x80;
+    enum Tag : uint64_t { WordToken = 0, NumberToken = 1, LiteralToken = 2 };
+
+    // Up to 15 encoded bytes with their count in the last byte, or a block
+    // pointer and size with onHeap in the last byte
+    alignas(8) char storage[capacity];
+    pmr::memory_resource* resource;
+
+    [[nodiscard]] bool heap() const {
+        return static_cast<uint8_t>(storage[capacity - 1]) == onHeap;
+    }
+    void assign(string_view encoded);
+    void release();
+
+public:
+    using allocator_type = pmr::polymorphic_allocator<>;
+
+    CompressedTitle();
+    explicit CompressedTitle(const allocator_type& allocator);
+    CompressedTitle(string_view text, const allocator_type& allocator = {});
+    CompressedTitle(const string& text);
+    CompressedTitle(const char* text);
+    CompressedTitle(const CompressedTitle& other, const allocator_type& allocator = {});
+    CompressedTitle(CompressedTitle&& other) noexcept;
+    CompressedTitle(CompressedTitle&& other, const allocator_type& allocator);
+    CompressedTitle& operator=(const CompressedTitle& other);
+    CompressedTitle& operator=(CompressedTitle&& other);
+    ~CompressedTitle();
+
+    static CompressedTitle FromEncoded(string_view encoded, const allocator_type& allocator = {});
+    [[nodiscard]] string_view Encoded() const;
+    [[nodiscard]] bool Empty() const;
+    [[nodiscard]] string Text() const;
+    void AppendTo(string& out) const;
+    [[nodiscard]] size_t HeapBytes() const;
+
+    bool operator==(const CompressedTitle& other) const {
+        return Encoded() == other.Encoded();
+    }
+};
+
+/**
+ * Default constructor
+ * Creates an empty title using the default memory resource
+ */
+CompressedTitle::CompressedTitle() : storage{}, resource(pmr::get_default_resource()) {
+}
+
+/**
+ * Constructor
+ * Creates an empty title whose encoding will come from a memory resource
+ *
+ * @param allocator Supplies the block of a long encoding
+ */
+CompressedTitle::CompressedTitle(const allocator_type& allocator)
+    : storage{}, resource(allocator.resource()) {
+}
+
+/**
+ * Encode a title
+ * Implicit, so a title can be assigned from text like a string.
+ *
+ * @param text The title
+ * @param allocator Supplies the block of a long encoding
+ */
+CompressedTitle::CompressedTitle(const string_view text, const allocator_type& allocator)
+    : storage{}, resource(allocator.resource()) {
+    if (text.empty()) {
+        return;
+    }
+    // Reused by every title the thread encodes
+    thread_local string encoded;
+    encoded.clear();
+    size_t start = 0;
+    while (true) {
+        const size_t end = min(text.find(' ', start), text.size());
+        const string_view word = text.substr(start, end - start);
+        const bool number = !word.empty() && word.size() <= 18 && (word[0] != '0' || word.size() == 1) &&
+                            ranges::all_of(word, [](const char c) { return c >= '0' && c <= '9'; });
+        if (number) {
+            uint64_t value = 0;
+            from_chars(word.data(), word.data() + word.size(), value);
+            appendVarint(encoded, value << 2 | NumberToken);
+        } else if (const uint32_t id = titleWords.Intern(word); id != TitleDictionary::none) {
+            appendVarint(encoded, static_cast<uint64_t>(id) << 2 | WordToken);
+        } else {
+            appendVarint(encoded, static_cast<uint64_t>(word.size()) << 2 | LiteralToken);
+            encoded += word;
+        }
+        if (end == text.size()) {
+            break;
+        }
+        start = end + 1;
+    }
+    assign(encoded);
+}
+
+CompressedTitle::CompressedTitle(const string& text) : CompressedTitle(string_view(text)) {
+}
+
+CompressedTitle::CompressedTitle(const char* text) : CompressedTitle(string_view(text)) {
+}
+
+CompressedTitle::CompressedTitle(const CompressedTitle& other, const allocator_type& allocator)
+    : storage{}, resource(allocator.resource()) {
+    assign(other.Encoded());
+}
+
+CompressedTitle::CompressedTitle(CompressedTitle&& other) noexcept : storage{}, resource(other.resource) {
+    memcpy(storage, other.storage, capacity);
+    memset(other.storage, 0, capacity);
+}
+
+// Takes over the other title's block only if it came from the same resource
+CompressedTitle::CompressedTitle(CompressedTitle&& other, const allocator_type& allocator)
+    : storage{}, resource(allocator.resource()) {
+    *this = std::move(other);
+}
+
+// Assignment keeps this title's memory resource, like a pmr container
+CompressedTitle& CompressedTitle::operator=(const CompressedTitle& other) {
+    if (this != &other) {
+        release();
+        assign(other.Encoded());
+    }
+    return *this;
+}
+
+CompressedTitle& CompressedTitle::operator=(CompressedTitle&& other) {
+    if (this == &other) {
+        return *this;
+    }
+    release();
+    if (other.heap() && !resource->is_equal(*other.resource)) {
+        assign(other.Encoded());
+        other.release();
+        return *this;
+    }
+    memcpy(storage, other.storage, capacity);
+    memset(other.storage, 0, capacity);
+    return *this;
+}
+
+/**
+ * Destructor
+ */
+CompressedTitle::~CompressedTitle() {
+    release();
+}
+
+// Store encoded bytes inside the object, or in a block from the title's
+// resource if they do not fit
+void CompressedTitle::assign(const string_view encoded) {
+    memset(storage, 0, capacity);
+    if (encoded.size() < capacity) {
+        memcpy(storage, encoded.data(), encoded.size());
+        storage[capacity - 1] = static_cast<char>(encoded.size());
+        return;
+    }
+    auto* data = static_cast<char*>(resource->allocate(encoded.size(), 1));
+    memcpy(data, encoded.data(), encoded.size());
+    const auto size = static_cast<uint32_t>(encoded.size());
+    memcpy(storage, &data, sizeof(data));
+    memcpy(storage + sizeof(data), &size, sizeof(size));
+    storage[capacity - 1] = static_cast<char>(onHeap);
+}
+
+// Return a block encoding to its resource and leave the title empty
+void CompressedTitle::release() {
+    if (heap()) {
+        const string_view encoded = Encoded();
+        resource->deallocate(const_cast<char*>(encoded.data()), encoded.size(), 1);
+    }
+    memset(storage, 0, capacity);
+}
+
+/**
+ * Rebuild a title from the bytes Encoded returned in this process
+ *
+ * @param encoded Encoded bytes
+ * @param allocator Supplies the block of a long encoding
+ * @return The title
+ */
+CompressedTitle CompressedTitle::FromEncoded(const string_view encoded, const allocator_type& allocator) {
+    CompressedTitle title(allocator);
+    title.assign(encoded);
+    return title;
+}
+
+/**
+ * Get the encoded bytes
+ * Word ids are only meaningful in this process, so write Text() to files.
+ */
+string_view CompressedTitle::Encoded() const {
+    if (!heap()) {
+        return {storage, static_cast<size_t>(storage[capacity - 1])};
+    }
+    const char* data;
+    uint32_t size;
+    memcpy(&data, storage, sizeof(data));
+    memcpy(&size, storage + sizeof(data), sizeof(size));
+    return {data, size};
+}
+
+/**
+ * Check whether the title is empty
+ */
+bool CompressedTitle::Empty() const {
+    return Encoded().empty();
+}
+
+/**
+ * Decode the title
+ *
+ * @return The title text
+ */
+string CompressedTitle::Text() const {
+    string text;
+    AppendTo(text);
+    return text;
+}
+
+/**
+ * Decode the title onto the end of a buffer
+ *
+ * @param out Buffer to append to
+ */
+void CompressedTitle::AppendTo(string& out) const {
+    string_view encoded = Encoded();
+    bool first = true;
+    uint64_t token;
+    while (readVarint(encoded, &token)) {
+        if (!first) {
+            out += ' ';
+        }
+        first = false;
+        switch (token & 3) {
+            case WordToken:
+                out += titleWords.Word(static_cast<uint32_t>(token >> 2));
+                break;
+            case NumberToken: {
+                char digits[20];
+                const auto end = to_chars(digits, digits + sizeof(digits), token >> 2).ptr;
+                out.append(digits, end);
+                break;
+            }
+            default:
+                out += encoded.substr(0, token >> 2);
+                encoded.remove_prefix(min<size_t>(token >> 2, encoded.size()));
+                break;
+        }
+    }
+}
+
+/**
+ * Bytes allocated outside the object, from the title's resource
+ */
+size_t CompressedTitle::HeapBytes() const {
+    return heap() ? Encoded().size() : 0;
+}
+
+/**
+ * Print a title
+ *
+ * @param out Stream to print to
+ * @param title Title to print
+ * @return The stream
+ */
+ostream& operator<<(ostream& out, const CompressedTitle& title) {
+    string text;
+    title.AppendTo(text);
+    return out << text;
+}
+
+//============================================================================
+// Memory Resources
+//============================================================================
+
+/**
+ * Memory resource that counts the bytes drawn through it
+ * Wraps another resource, usually the upstream of an arena, and keeps
+ * totals for named phases: Mark closes the current phase. Counting is
+ * thread-safe; marking phases is meant for the one thread doing a load.
+ */
+class TrackingResource final : public pmr::memory_resource {
+    pmr::memory_resource* upstream;
+    atomic<size_t> allocated{0};
+    atomic<size_t> released{0};
+    size_t marked = 0;
+    vector<pair<string, size_t>> phases;
+
+    void* do_allocate(const size_t bytes, const size_t alignment) override {
+        void* memory = upstream->allocate(bytes, alignment);
+        allocated.fetch_add(bytes, memory_order_relaxed);
+        return memory;
+    }
+
+    void do_deallocate(void* memory, const size_t bytes, const size_t alignment) override {
+        upstream->deallocate(memory, bytes, alignment);
+        released.fetch_add(bytes, memory_order_relaxed);
+    }
+
+    [[nodiscard]] bool do_is_equal(const pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+public:
+    /**
+     * Constructor
+     *
+     * @param upstream Resource that supplies the memory
+     */
+    explicit TrackingResource(pmr::memory_resource* upstream = pmr::new_delete_resource())
+        : upstream(upstream) {
+    }
+
+    /**
+     * Bytes allocated so far, including any since released
+     */
+    [[nodiscard]] size_t Allocated() const {
+        return allocated.load(memory_order_relaxed);
+    }
+
+    /**
+     * Bytes allocated and not yet released
+     */
+    [[nodiscard]] size_t InUse() const {
+        return Allocated() - released.load(memory_order_relaxed);
+    }
+
+    /**
+     * End the current phase, recording the bytes allocated during it
+     *
+     * @param phase Name of the phase that just finished
+     */
+    void Mark(string phase) {
+        const size_t now = Allocated();
+        phases.emplace_back(std::move(phase), now - marked);
+        marked = now;
+    }
+
+    /**
+     * Print the bytes of each marked phase on one line
+     *
+     * @param out Stream to print to
+     * @param label What the resource supplies, printed first
+     */
+    void Report(ostream& out, const string& label) const {
+        out << label << ':';
+        for (size_t i = 0; i < phases.size(); i++) {
+            out << (i == 0 ? " " : ", ") << phases[i].first << ' '
+                << fixed << setprecision(1) << static_cast<double>(phases[i].second) / 1e6 << " MB";
+        }
+        out.unsetf(ios::floatfield);
+        out << endl;
+    }
+};
+
 //============================================================================
 // Course Structure Definition
 //============================================================================
 
 /**
  * Structure to hold course information
- * Contains course number, title, and list of prerequisites
+ * Contains course number, title, and list of prerequisites. Every member
+ * takes a memory resource, so a catalog's courses, with all the memory
+ * they own, can share one arena. Copies made without an allocator use the
+ * default resource.
  */
 struct Course {
-    string courseNumber;
-    string courseTitle;
-    vector<string> prerequisites;
+    using allocator_type = pmr::polymorphic_allocator<>;
+
+    pmr::string courseNumber;
+    CompressedTitle courseTitle;
+    pmr::vector<pmr::string> prerequisites;
+    int credits = -1;
+
+    // Equivalence classes resolved at load time, so prerequisite checks
+    // compare integers instead of looking up course numbers
+    int equivalenceClass = -1;
+    pmr::vector<int> prerequisiteClasses;
 
     // Default constructor
     Course() = default;
+    Course(const Course&) = default;
+    Course(Course&&) = default;
+    Course& operator=(const Course&) = default;
+    Course& operator=(Course&&) = default;
+
+    // Constructor drawing every member from a memory resource
+    explicit Course(const allocator_type& allocator)
+        : courseNumber(allocator), courseTitle(allocator), prerequisites(allocator),
+          prerequisiteClasses(allocator) {
+    }
+
+    // Copy and move constructors drawing every member from a memory resource
+    Course(const Course& other, const allocator_type& allocator)
+        : courseNumber(other.courseNumber, allocator), courseTitle(other.courseTitle, allocator),
+          prerequisites(other.prerequisites, allocator), credits(other.credits),
+          equivalenceClass(other.equivalenceClass),
+          prerequisiteClasses(other.prerequisiteClasses, allocator) {
+    }
+    Course(Course&& other, const allocator_type& allocator)
+        : courseNumber(std::move(other.courseNumber), allocator),
+          courseTitle(std::move(other.courseTitle), allocator),
+          prerequisites(std::move(other.prerequisites), allocator), credits(other.credits),
+          equivalenceClass(other.equivalenceClass),
+          prerequisiteClasses(std::move(other.prerequisiteClasses), allocator) {
+    }
 
     // Parameterized constructor
-    Course(const string &number, string title) {
+    Course(const string_view number, const string_view title, const allocator_type& allocator = {})
+        : Course(allocator) {
         courseNumber = number;
-        courseTitle = std::move(title);
+        courseTitle = CompressedTitle(title, allocator);
+    }
+};
+
+/**
+ * Print a course as "number, title", the format of the course list
+ *
+ * @param out Stream to print to
+ * @param course Course to print
+ * @return The stream
+ */
+ostream& operator<<(ostream& out, const Course& course) {
+    return out << course.courseNumber << ", " << course.courseTitle;
+}
+
+/**
+ * Read every string of a course so its memory is resident
+ *
+ * @param course Course to touch
+ * @return Number of bytes read beyond the course object itself
+ */
+size_t touchMemory(const Course& course) {
+    const string_view title = course.courseTitle.Encoded();
+    size_t bytes = course.courseNumber.size() + title.size();
+    volatile char sink = course.courseNumber.empty() ? 0 : course.courseNumber[0];
+    sink = title.empty() ? 0 : title[0];
+    for (const auto& prereq : course.prerequisites) {
+        sink = prereq.empty() ? 0 : prereq[0];
+        bytes += prereq.size();
+    }
+    for (const int classId : course.prerequisiteClasses) {
+        sink = static_cast<char>(classId);
+    }
+    (void)sink;
+    return bytes;
+}
+
+/**
+ * Key extractor ordering courses by course number
+ */
+struct CourseNumberOf {
+    const pmr::string& operator()(const Course& course) const {
+        return course.courseNumber;
     }
 };
 
 //============================================================================
-// Binary Search Tree Node Structure
+// Ordered Index Engine
 //============================================================================
 
+/**
+ * A string key's first 16 bytes, zero-padded, with its full length
+ * Blocks compare in the same order as the strings they came from, so most
+ * comparisons are one 16-byte vector compare with no pointer to follow.
+ * Only keys that agree on all 16 bytes while one is longer need the
+ * strings themselves.
+ */
+struct PaddedKey {
+    static constexpr size_t width = 16;
+
+    // Result of Compare when the blocks cannot order the keys
+    static constexpr int undecided = numeric_limits<int>::min();
+
+    char bytes[width];
+    uint32_t length;
+
+    /**
+     * Build the padded block of a key
+     *
+     * @param key The key
+     * @return The block
+     */
+    static PaddedKey Of(const string_view key) {
+        PaddedKey padded{};
+        memcpy(padded.bytes, key.data(), min(key.size(), width));
+        padded.length = static_cast<uint32_t>(min<size_t>(key.size(), numeric_limits<uint32_t>::max()));
+        return padded;
+    }
+
+    /**
+     * Order two keys by their blocks
+     *
+     * @param a First key's block
+     * @param b Second key's block
+     * @return Negative, zero or positive as a is less than, equal to or
+     *         greater than b, or undecided if the full keys are needed
+     */
+    static int Compare(const PaddedKey& a, const PaddedKey& b) {
+#if defined(__AVX2__) || defined(__SSE2__)
+        const __m128i left = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a.bytes));
+        const __m128i right = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b.bytes));
+        const auto differ = static_cast<uint32_t>(~_mm_movemask_epi8(_mm_cmpeq_epi8(left, right))) & 0xFFFFu;
+        if (differ != 0) {
+            const int at = countr_zero(differ);
+            return static_cast<uint8_t>(a.bytes[at]) - static_cast<uint8_t>(b.bytes[at]);
+        }
+#else
+        if (const int order = memcmp(a.bytes, b.bytes, width); order != 0) {
+            return order;
+        }
+#endif
+        // Equal blocks: a key of at most 16 bytes is a prefix of the other
+        if (a.length > width && b.length > width) {
+            return undecided;
+        }
+        return a.length < b.length ? -1 : a.length > b.length ? 1 : 0;
+    }
+};
+
+/**
+ * Empty stand-in for PaddedKey in nodes whose keys are not strings
+ */
+struct NoInlineKey {};
+
 /**
  * Internal structure for tree node
- * Each node contains a course and pointers to left and right children
+ * Each node contains a value and pointers to left and right children,
+ * and an inline copy of the key's first bytes when the tree uses one
  */
+template <typename Value, typename InlineKey = NoInlineKey>
 struct Node {
-    Course course;
+    using allocator_type = pmr::polymorphic_allocator<>;
+
+    [[no_unique_address]] InlineKey key;
+    Value value;
     Node* left;
     Node* right;
 
@@ -59,354 +791,9895 @@ struct Node {
         right = nullptr;
     }
 
-    // Constructor with course
-    explicit Node(Course aCourse) : Node() {
-        course = std::move(aCourse);
+    // Constructor with value
+    explicit Node(Value aValue) : Node() {
+        value = std::move(aValue);
     }
-};
 
-//============================================================================
-// Binary Search Tree Class Definition
-//============================================================================
+    // Constructor with value, which takes the node's memory resource if
+    // it is allocator-aware
+    Node(const Value& aValue, const allocator_type& allocator)
+        : value(make_obj_using_allocator<Value>(allocator, aValue)) {
+        left = nullptr;
+        right = nullptr;
+    }
+};
 
 /**
- * Binary Search Tree class for managing courses
- * Provides efficient insertion, search, and in-order traversal
+ * Node layout: an unbalanced binary search tree, the original course tree
+ * Nodes never move, so pointers to stored values stay valid, and the tree
+ * can be reshaped around lookup frequencies with RebuildWeighted. String
+ * keys ordered by less<> are also kept in each node as a PaddedKey, so a
+ * search compares blocks beside the child pointers instead of strings.
  */
-class BinarySearchTree final {
-    Node* root;
+template <typename Value, typename KeyOf, typename Compare>
+class NodeLayout {
+    static constexpr bool paddedKeys =
+        is_same_v<Compare, less<>> &&
+        is_convertible_v<invoke_result_t<KeyOf, const Value&>, string_view>;
+    using TreeNode = Node<Value, conditional_t<paddedKeys, PaddedKey, NoInlineKey>>;
 
-    static void addNode(Node* node, const Course& course);
+    TreeNode* root;
+    size_t size;
+    pmr::polymorphic_allocator<TreeNode> allocator;
+    [[no_unique_address]] KeyOf keyOf;
+    [[no_unique_address]] Compare compare;
 
-    static void inOrder(const Node* node);
+    // Delete every node of a subtree
+    // An explicit stack replaces recursion, so a deep tree cannot
+    // overflow the call stack
+    void deleteTree(TreeNode* node) {
+        if (releasedWithResource()) {
+            return;
+        }
+        vector<TreeNode*> stack;
+        if (node != nullptr) {
+            stack.push_back(node);
+        }
+        while (!stack.empty()) {
+            TreeNode* current = stack.back();
+            stack.pop_back();
+            if (current->left != nullptr) stack.push_back(current->left);
+            if (current->right != nullptr) stack.push_back(current->right);
+            allocator.delete_object(current);
+        }
+    }
 
-    static void deleteRecursive(const Node* node);
+    // Copy a subtree, parents before their children, with an explicit
+    // stack of each source node and the copy waiting for its children
+    TreeNode* copyTree(const TreeNode* node) {
+        if (node == nullptr) {
+            return nullptr;
+        }
+        auto copyNode = [this](const TreeNode* source) {
+            TreeNode* copy = allocator.template new_object<TreeNode>(source->value);
+            copy->key = source->key;
+            return copy;
+        };
+
+        TreeNode* top = copyNode(node);
+        vector<pair<const TreeNode*, TreeNode*>> stack{{node, top}};
+        while (!stack.empty()) {
+            const auto [source, copy] = stack.back();
+            stack.pop_back();
+            if (source->left != nullptr) {
+                copy->left = copyNode(source->left);
+                stack.emplace_back(source->left, copy->left);
+            }
+            if (source->right != nullptr) {
+                copy->right = copyNode(source->right);
+                stack.emplace_back(source->right, copy->right);
+            }
+        }
+        return top;
+    }
+
+    // Whether dropping the memory resource frees the tree by itself: a
+    // value that takes the node's allocator draws everything it owns from
+    // it, and a monotonic arena ignores deallocation, so no node needs its
+    // destructor run
+    [[nodiscard]] bool releasedWithResource() const {
+        return uses_allocator_v<Value, pmr::polymorphic_allocator<>> &&
+               dynamic_cast<pmr::monotonic_buffer_resource*>(allocator.resource()) != nullptr;
+    }
+
+    // Allocate a node, filling in its inline key
+    TreeNode* makeNode(const Value& value) {
+        TreeNode* node = allocator.template new_object<TreeNode>(value);
+        if constexpr (paddedKeys) {
+            node->key = PaddedKey::Of(keyOf(node->value));
+        }
+        return node;
+    }
+
+    // Order a lookup key against a node's key: negative, zero or positive
+    template <typename Lookup>
+    int order(const Lookup& key, const PaddedKey& padded, const TreeNode* node) const {
+        if constexpr (paddedKeys && is_convertible_v<const Lookup&, string_view>) {
+            if (const int result = PaddedKey::Compare(padded, node->key); result != PaddedKey::undecided) {
+                return result;
+            }
+            return string_view(key).compare(keyOf(node->value));
+        } else {
+            return compare(key, keyOf(node->value)) ? -1 : compare(keyOf(node->value), key) ? 1 : 0;
+        }
+    }
+
+    // Block of a lookup key, when the tree compares blocks
+    template <typename Lookup>
+    static PaddedKey paddedOf(const Lookup& key) {
+        if constexpr (paddedKeys && is_convertible_v<const Lookup&, string_view>) {
+            return PaddedKey::Of(key);
+        } else {
+            return PaddedKey{};
+        }
+    }
+
+    // Descend from a node to the empty child slot where a value belongs
+    void addNode(TreeNode* node, TreeNode* added) {
+        while (true) {
+            // Compare keys to determine placement
+            TreeNode*& child = order(keyOf(added->value), added->key, node) < 0 ? node->left : node->right;
+            if (child == nullptr) {
+                child = added;
+                return;
+            }
+            node = child;
+        }
+    }
+
+    // Recursive helper linking nodes[low, high) into a weight-balanced subtree
+    static TreeNode* buildWeighted(const vector<TreeNode*>& nodes, const vector<uint64_t>& prefix,
+                                   const size_t low, const size_t high) {
+        if (low >= high) {
+            return nullptr;
+        }
+
+        // First node whose running weight passes the midpoint
+        const uint64_t half = prefix[low] + (prefix[high] - prefix[low]) / 2;
+        const auto split = upper_bound(prefix.begin() + static_cast<ptrdiff_t>(low) + 1,
+                                       prefix.begin() + static_cast<ptrdiff_t>(high) + 1, half);
+        const auto middle = static_cast<size_t>(split - prefix.begin()) - 1;
+
+        TreeNode* node = nodes[middle];
+        node->left = buildWeighted(nodes, prefix, low, middle);
+        node->right = buildWeighted(nodes, prefix, middle + 1, high);
+        return node;
+    }
+
+public:
+    /**
+     * Default constructor
+     * Initializes root to nullptr creating an empty tree
+     *
+     * @param resource Supplies the nodes and the memory their values own
+     */
+    explicit NodeLayout(pmr::memory_resource* resource = pmr::get_default_resource()) : allocator(resource) {
+        root = nullptr;
+        size = 0;
+    }
+
+    NodeLayout(const NodeLayout&) = delete;
+    NodeLayout& operator=(const NodeLayout&) = delete;
+
+    /**
+     * Destructor
+     * Deletes all nodes to prevent memory leaks, unless the tree lives in
+     * a monotonic arena that frees it when the arena is dropped
+     */
+    ~NodeLayout() {
+        deleteTree(root);
+    }
+
+    /**
+     * Insert a value into the tree
+     *
+     * @param value The value to insert
+     */
+    void Insert(const Value& value) {
+        size++;
+        if (root == nullptr) {
+            root = makeNode(value);
+        } else {
+            addNode(root, makeNode(value));
+        }
+    }
+
+    /**
+     * Find a value by key without copying it
+     * Iteratively traverses tree based on comparisons
+     *
+     * @param key The key to search for, or anything the comparator can
+     *            compare with it
+     * @return Pointer to the stored value, or nullptr if not found
+     */
+    template <typename Lookup>
+    [[nodiscard]] const Value* Find(const Lookup& key) const {
+        const TreeNode* current = root;
+        const PaddedKey padded = paddedOf(key);
+
+        // Traverse tree until found or reach end
+        while (current != nullptr) {
+            const int result = order(key, padded, current);
+            // Search left subtree if target is smaller
+            if (result < 0) {
+                current = current->left;
+            }
+            // Search right subtree if target is larger
+            else if (result > 0) {
+                current = current->right;
+            }
+            // Found matching value
+            else {
+                return &current->value;
+            }
+        }
+
+        return nullptr;
+    }
+
+    /**
+     * Number of values stored in the tree
+     */
+    [[nodiscard]] size_t Size() const {
+        return size;
+    }
+
+    /**
+     * Bytes allocated per node, not counting memory the value owns
+     */
+    static constexpr size_t nodeBytes = sizeof(TreeNode);
+
+    /**
+     * Visit every value in sorted order
+     *
+     * @param visit Callable invoked with each value
+     */
+    template <typename Visitor>
+    void ForEach(Visitor visit) const {
+        vector<const TreeNode*> stack;
+        const TreeNode* current = root;
+        while (current != nullptr || !stack.empty()) {
+            while (current != nullptr) {
+                stack.push_back(current);
+                current = current->left;
+            }
+            current = stack.back();
+            stack.pop_back();
+            visit(current->value);
+            current = current->right;
+        }
+    }
+
+    /**
+     * Replace this tree with a copy of another, preserving its shape
+     * Every node is allocated by the calling thread.
+     *
+     * @param other The tree to copy
+     */
+    void CopyFrom(const NodeLayout& other) {
+        deleteTree(root);
+        root = copyTree(other.root);
+        size = other.size;
+    }
+
+    /**
+     * Touch every node and the memory it owns so their pages are resident
+     * Subtrees below the top levels are walked in parallel. The top levels
+     * are walked last so they are the most recently used lines in the cache.
+     * Values are touched with touchMemory(const Value&).
+     *
+     * @param threadCount Number of threads to walk with
+     * @param threadSetup Run at the start of each walking thread
+     * @return Number of bytes read
+     */
+    size_t Prefault(const unsigned threadCount, const function<void()>& threadSetup) const {
+        // Split off enough subtrees to keep every thread busy
+        vector<const TreeNode*> top;
+        vector<const TreeNode*> level;
+        if (root != nullptr) {
+            level.push_back(root);
+        }
+        while (!level.empty() && level.size() < threadCount * 4) {
+            vector<const TreeNode*> next;
+            for (const TreeNode* node : level) {
+                top.push_back(node);
+                if (node->left != nullptr) next.push_back(node->left);
+                if (node->right != nullptr) next.push_back(node->right);
+            }
+            level = std::move(next);
+        }
+
+        auto touch = [](const TreeNode* node) {
+            return sizeof(TreeNode) + touchMemory(node->value);
+        };
+
+        atomic<size_t> next{0};
+        atomic<size_t> total{0};
+        auto worker = [&] {
+            threadSetup();
+            size_t bytes = 0;
+            vector<const TreeNode*> stack;
+            for (size_t i = next++; i < level.size(); i = next++) {
+                stack.push_back(level[i]);
+                while (!stack.empty()) {
+                    const TreeNode* node = stack.back();
+                    stack.pop_back();
+                    bytes += touch(node);
+                    if (node->left != nullptr) stack.push_back(node->left);
+                    if (node->right != nullptr) stack.push_back(node->right);
+                }
+            }
+            total += bytes;
+        };
+
+        vector<thread> workers;
+        for (unsigned t = 0; t < max(1u, threadCount); t++) {
+            workers.emplace_back(worker);
+        }
+        for (auto& thread : workers) {
+            thread.join();
+        }
+
+        size_t bytes = total;
+        for (const TreeNode* node : top) {
+            bytes += touch(node);
+        }
+        return bytes;
+    }
+
+    /**
+     * Rebuild the tree so frequently used values sit near the root
+     * Each subtree's root is the value where the accumulated weight first
+     * reaches half of the subtree's total (Mehlhorn's rule), which keeps the
+     * expected search depth within a small constant of the optimal tree.
+     * Every weight is increased by one so unused values stay balanced. Nodes
+     * are relinked in place, so pointers to stored values remain valid.
+     *
+     * @param weights Lookup counts in sorted order
+     */
+    void RebuildWeighted(const vector<uint64_t>& weights) {
+        vector<TreeNode*> nodes;
+        nodes.reserve(size);
+        vector<TreeNode*> stack;
+        TreeNode* current = root;
+        while (current != nullptr || !stack.empty()) {
+            while (current != nullptr) {
+                stack.push_back(current);
+                current = current->left;
+            }
+            current = stack.back();
+            stack.pop_back();
+            nodes.push_back(current);
+            current = current->right;
+        }
+
+        vector<uint64_t> prefix(nodes.size() + 1, 0);
+        for (size_t i = 0; i < nodes.size(); i++) {
+            prefix[i + 1] = prefix[i] + (i < weights.size() ? weights[i] : 0) + 1;
+        }
+        root = buildWeighted(nodes, prefix, 0, nodes.size());
+    }
+
+    /**
+     * Visit every value level by level, left to right, with the shape of
+     * its node
+     *
+     * @param visit Callable invoked with each value and whether its node
+     *              has a left and a right child
+     */
+    template <typename Visitor>
+    void ForEachLevelOrder(Visitor visit) const {
+        deque<const TreeNode*> queue;
+        if (root != nullptr) {
+            queue.push_back(root);
+        }
+        while (!queue.empty()) {
+            const TreeNode* node = queue.front();
+            queue.pop_front();
+            visit(node->value, node->left != nullptr, node->right != nullptr);
+            if (node->left != nullptr) queue.push_back(node->left);
+            if (node->right != nullptr) queue.push_back(node->right);
+        }
+    }
+
+    /**
+     * Number of levels in the tree, 0 when empty
+     */
+    [[nodiscard]] size_t Height() const {
+        size_t height = 0;
+        vector<pair<const TreeNode*, size_t>> stack;
+        if (root != nullptr) {
+            stack.emplace_back(root, 1);
+        }
+        while (!stack.empty()) {
+            const auto [node, depth] = stack.back();
+            stack.pop_back();
+            height = max(height, depth);
+            if (node->left != nullptr) stack.emplace_back(node->left, depth + 1);
+            if (node->right != nullptr) stack.emplace_back(node->right, depth + 1);
+        }
+        return height;
+    }
+
+    /**
+     * Average number of nodes visited per lookup under a lookup distribution
+     *
+     * @param weights Lookup counts in sorted order; all zero means uniform
+     * @return Weighted mean search depth, counting the root as 1
+     */
+    [[nodiscard]] double AverageDepth(const vector<uint64_t>& weights) const {
+        const bool uniform = ranges::all_of(weights, [](const uint64_t w) { return w == 0; });
+        double visits = 0;
+        double total = 0;
+        size_t index = 0;
+
+        vector<pair<const TreeNode*, size_t>> stack;
+        const TreeNode* current = root;
+        size_t depth = 1;
+        while (current != nullptr || !stack.empty()) {
+            while (current != nullptr) {
+                stack.emplace_back(current, depth);
+                current = current->left;
+                depth++;
+            }
+            const auto [node, nodeDepth] = stack.back();
+            stack.pop_back();
+
+            const double weight = uniform || index >= weights.size()
+                                      ? 1.0 : static_cast<double>(weights[index]);
+            visits += weight * static_cast<double>(nodeDepth);
+            total += weight;
+            index++;
+
+            current = node->right;
+            depth = nodeDepth + 1;
+        }
+        return total == 0 ? 0 : visits / total;
+    }
+};
+
+/**
+ * Flat layout: values in one sorted array
+ * Lookups are a binary search over contiguous memory, the best choice for
+ * data that is loaded once and then only read. Appending in key order is
+ * O(1); any other insert shifts the values after it.
+ */
+template <typename Value, typename KeyOf, typename Compare>
+class FlatLayout {
+    vector<Value> values;
+    [[no_unique_address]] KeyOf keyOf;
+    [[no_unique_address]] Compare compare;
+
+public:
+    /**
+     * Insert a value after any with an equal key
+     *
+     * @param value The value to insert
+     */
+    void Insert(const Value& value) {
+        if (values.empty() || !compare(keyOf(value), keyOf(values.back()))) {
+            values.push_back(value);
+            return;
+        }
+        const auto position = ranges::upper_bound(values, keyOf(value), compare, keyOf);
+        values.insert(position, value);
+    }
+
+    /**
+     * Find a value by key without copying it
+     *
+     * @param key The key to search for, or anything the comparator can
+     *            compare with it
+     * @return Pointer to the stored value, or nullptr if not found
+     */
+    template <typename Lookup>
+    [[nodiscard]] const Value* Find(const Lookup& key) const {
+        const auto found = ranges::lower_bound(values, key, compare, keyOf);
+        if (found == values.end() || compare(key, keyOf(*found))) {
+            return nullptr;
+        }
+        return &*found;
+    }
+
+    /**
+     * Number of values stored
+     */
+    [[nodiscard]] size_t Size() const {
+        return values.size();
+    }
+
+    /**
+     * Visit every value in sorted order
+     *
+     * @param visit Callable invoked with each value
+     */
+    template <typename Visitor>
+    void ForEach(Visitor visit) const {
+        for (const Value& value : values) {
+            visit(value);
+        }
+    }
+};
+
+/**
+ * Balanced layout: an AVL tree
+ * Every insert rebalances on the way back up, so the depth stays below
+ * 1.44 log2(n) even when values arrive in sorted order.
+ */
+template <typename Value, typename KeyOf, typename Compare>
+class BalancedLayout {
+    struct AvlNode {
+        Value value;
+        AvlNode* left = nullptr;
+        AvlNode* right = nullptr;
+        int height = 1;
+
+        explicit AvlNode(Value aValue) : value(std::move(aValue)) {}
+    };
+
+    AvlNode* root = nullptr;
+    size_t size = 0;
+    [[no_unique_address]] KeyOf keyOf;
+    [[no_unique_address]] Compare compare;
+
+    static int heightOf(const AvlNode* node) {
+        return node == nullptr ? 0 : node->height;
+    }
+
+    static void update(AvlNode* node) {
+        node->height = 1 + max(heightOf(node->left), heightOf(node->right));
+    }
+
+    static AvlNode* rotateRight(AvlNode* node) {
+        AvlNode* pivot = node->left;
+        node->left = pivot->right;
+        pivot->right = node;
+        update(node);
+        update(pivot);
+        return pivot;
+    }
+
+    static AvlNode* rotateLeft(AvlNode* node) {
+        AvlNode* pivot = node->right;
+        node->right = pivot->left;
+        pivot->left = node;
+        update(node);
+        update(pivot);
+        return pivot;
+    }
+
+    // Restore the AVL property at a node whose subtrees differ by at most two
+    static AvlNode* rebalance(AvlNode* node) {
+        update(node);
+        const int balance = heightOf(node->left) - heightOf(node->right);
+        if (balance > 1) {
+            if (heightOf(node->left->left) < heightOf(node->left->right)) {
+                node->left = rotateLeft(node->left);
+            }
+            return rotateRight(node);
+        }
+        if (balance < -1) {
+            if (heightOf(node->right->right) < heightOf(node->right->left)) {
+                node->right = rotateRight(node->right);
+            }
+            return rotateLeft(node);
+        }
+        return node;
+    }
+
+    // Recursive insert returning the new subtree root; depth is O(log n)
+    AvlNode* insert(AvlNode* node, const Value& value) {
+        if (node == nullptr) {
+            return new AvlNode(value);
+        }
+        if (compare(keyOf(value), keyOf(node->value))) {
+            node->left = insert(node->left, value);
+        } else {
+            node->right = insert(node->right, value);
+        }
+        return rebalance(node);
+    }
+
+    static void deleteRecursive(const AvlNode* node) {
+        if (node != nullptr) {
+            deleteRecursive(node->left);
+            deleteRecursive(node->right);
+            delete node;
+        }
+    }
+
+public:
+    BalancedLayout() = default;
+    BalancedLayout(const BalancedLayout&) = delete;
+    BalancedLayout& operator=(const BalancedLayout&) = delete;
+
+    ~BalancedLayout() {
+        deleteRecursive(root);
+    }
+
+    /**
+     * Insert a value after any with an equal key
+     *
+     * @param value The value to insert
+     */
+    void Insert(const Value& value) {
+        root = insert(root, value);
+        size++;
+    }
+
+    /**
+     * Find a value by key without copying it
+     *
+     * @param key The key to search for, or anything the comparator can
+     *            compare with it
+     * @return Pointer to the stored value, or nullptr if not found
+     */
+    template <typename Lookup>
+    [[nodiscard]] const Value* Find(const Lookup& key) const {
+        const AvlNode* current = root;
+        while (current != nullptr) {
+            if (compare(key, keyOf(current->value))) {
+                current = current->left;
+            } else if (compare(keyOf(current->value), key)) {
+                current = current->right;
+            } else {
+                return &current->value;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * Number of values stored
+     */
+    [[nodiscard]] size_t Size() const {
+        return size;
+    }
+
+    /**
+     * Visit every value in sorted order
+     *
+     * @param visit Callable invoked with each value
+     */
+    template <typename Visitor>
+    void ForEach(Visitor visit) const {
+        vector<const AvlNode*> stack;
+        const AvlNode* current = root;
+        while (current != nullptr || !stack.empty()) {
+            while (current != nullptr) {
+                stack.push_back(current);
+                current = current->left;
+            }
+            current = stack.back();
+            stack.pop_back();
+            visit(current->value);
+            current = current->right;
+        }
+    }
+};
+
+/**
+ * Ordered index over values of any type
+ * KeyOf extracts each value's key, and Compare orders keys; a transparent
+ * comparator such as less<> also allows lookups by string_view or any
+ * other type it can compare with Key. The storage layout is chosen at
+ * compile time (NodeLayout, FlatLayout or BalancedLayout) and every call
+ * resolves statically, with no virtual dispatch. Layout-specific
+ * operations, such as RebuildWeighted on NodeLayout, are inherited from
+ * the layout.
+ */
+template <typename Value, typename Key, typename KeyOf, typename Compare = less<>,
+          template <typename, typename, typename> class Layout = NodeLayout>
+class OrderedIndex final : public Layout<Value, KeyOf, Compare> {
+    static_assert(is_same_v<remove_cvref_t<invoke_result_t<KeyOf, const Value&>>, Key>,
+                  "KeyOf must return the Key of a value");
+
+public:
+    using Layout<Value, KeyOf, Compare>::Layout;
+
+    /**
+     * Search for a value by key
+     *
+     * @param key The key to search for
+     * @return A copy of the value if found, a default value otherwise
+     */
+    template <typename Lookup = Key>
+    [[nodiscard]] Value Search(const Lookup& key) const {
+        if (const Value* value = this->Find(key)) {
+            return *value;
+        }
+
+        // Not found, return a default value
+        return Value();
+    }
+
+    /**
+     * Print every value in sorted order, one per line
+     */
+    void InOrder() const {
+        this->ForEach([](const Value& value) { cout << value << endl; });
+    }
+};
+
+/**
+ * Binary search tree of courses keyed by course number
+ * The catalog's course store, and the first instantiation of the engine.
+ */
+using BinarySearchTree = OrderedIndex<Course, pmr::string, CourseNumberOf>;
+
+/**
+ * Course indexes over the other layouts
+ * FlatCourseIndex suits courses loaded once and then only read;
+ * BalancedCourseIndex stays shallow whatever order courses arrive in.
+ */
+using FlatCourseIndex = OrderedIndex<Course, pmr::string, CourseNumberOf, less<>, FlatLayout>;
+using BalancedCourseIndex = OrderedIndex<Course, pmr::string, CourseNumberOf, less<>, BalancedLayout>;
+
+/**
+ * Operations every course index offers, whatever its layout
+ */
+template <typename Index>
+concept CourseIndex = requires(Index index, const Index& view, const Course& course, string_view key) {
+    index.Insert(course);
+    { view.Find(key) } -> same_as<const Course*>;
+    { view.Search(key) } -> same_as<Course>;
+    { view.Size() } -> same_as<size_t>;
+    view.InOrder();
+};
+static_assert(CourseIndex<BinarySearchTree> && CourseIndex<FlatCourseIndex> &&
+              CourseIndex<BalancedCourseIndex>);
+
+// Compile every member of the other course indexes, so each layout is
+// checked by every build even before a mode stores courses in it
+template class OrderedIndex<Course, pmr::string, CourseNumberOf, less<>, FlatLayout>;
+template class OrderedIndex<Course, pmr::string, CourseNumberOf, less<>, BalancedLayout>;
+template Course FlatCourseIndex::Search(const string_view&) const;
+template Course BalancedCourseIndex::Search(const string_view&) const;
+
+/**
+ * Visit the positions of a sorted range in midpoint order
+ * Each span's middle comes before either half, so inserting sorted values
+ * in this order gives an unbalanced tree the shape of a balanced one.
+ *
+ * @param count Number of positions
+ * @param visit Callable invoked with each position in [0, count)
+ */
+template <typename Visitor>
+void forEachMidpoint(const size_t count, Visitor visit) {
+    vector<pair<size_t, size_t>> spans{{0, count}};
+    while (!spans.empty()) {
+        const auto [low, high] = spans.back();
+        spans.pop_back();
+        if (low < high) {
+            const size_t middle = low + (high - low) / 2;
+            visit(middle);
+            spans.emplace_back(low, middle);
+            spans.emplace_back(middle + 1, high);
+        }
+    }
+}
+
+//============================================================================
+// Disk-Resident B+Tree Index
+//============================================================================
+
+/**
+ * Fixed-size page cache over one file, with CLOCK eviction
+ * Pages are pinned while in use; an unpinned page stays cached until the
+ * clock hand finds it unreferenced, and is written back then if dirty.
+ * Memory use is capacity pages no matter how large the file grows. Not
+ * safe for concurrent use.
+ */
+class BufferPool final {
+public:
+    static constexpr size_t pageSize = 4096;
+
+private:
+    struct Frame {
+        uint32_t page = 0;
+        bool used = false;
+        bool dirty = false;
+        bool referenced = false;
+        unsigned pins = 0;
+    };
+
+    fstream file;
+    vector<Frame> frames;
+    unique_ptr<char[]> memory;
+    unordered_map<uint32_t, size_t> table;
+    size_t hand = 0;
+    uint32_t pageCount = 0;
+    bool failed = false;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t writes = 0;
+
+    size_t victim();
+    void writeBack(const Frame& frame, const char* data);
+
+public:
+    BufferPool() = default;
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    bool Open(const string& filename, size_t capacity);
+    char* Pin(uint32_t page);
+    uint32_t Allocate(char** data);
+    void Unpin(uint32_t page, bool dirty);
+    bool Flush();
+    [[nodiscard]] uint32_t PageCount() const;
+    void PrintStats(ostream& out) const;
+};
+
+/**
+ * Open or create the backing file
+ *
+ * @param filename Path of the page file
+ * @param capacity Number of pages to cache
+ * @return true if the file could be opened
+ */
+bool BufferPool::Open(const string& filename, const size_t capacity) {
+    // Create the file first so it can be opened for update
+    if (!ifstream(filename)) {
+        ofstream(filename, ios::binary);
+    }
+    file.open(filename, ios::in | ios::out | ios::binary);
+    if (!file.is_open()) {
+        cout << "Error: Could not open index file " << filename << endl;
+        return false;
+    }
+
+    file.seekg(0, ios::end);
+    const auto bytes = static_cast<uint64_t>(file.tellg());
+    if (bytes % pageSize != 0) {
+        cout << "Error: " << filename << " is not a page file" << endl;
+        return false;
+    }
+    pageCount = static_cast<uint32_t>(bytes / pageSize);
+
+    frames.assign(capacity, Frame());
+    memory = make_unique<char[]>(capacity * pageSize);
+    table.clear();
+    return true;
+}
+
+// Write a dirty frame's page to the file
+void BufferPool::writeBack(const Frame& frame, const char* data) {
+    file.seekp(static_cast<streamoff>(frame.page) * pageSize);
+    if (!file.write(data, pageSize)) {
+        failed = true;
+        file.clear();
+    }
+    writes++;
+}
+
+// Pick an unpinned frame for a new page, writing out its old page
+size_t BufferPool::victim() {
+    // Two full sweeps clear every reference bit, so a third finds a frame
+    // unless all of them are pinned
+    for (size_t step = 0; step < 3 * frames.size(); step++) {
+        const size_t slot = hand;
+        hand = (hand + 1) % frames.size();
+        Frame& frame = frames[slot];
+        if (!frame.used) {
+            return slot;
+        }
+        if (frame.pins > 0) {
+            continue;
+        }
+        if (frame.referenced) {
+            frame.referenced = false;
+            continue;
+        }
+
+        if (frame.dirty) {
+            writeBack(frame, memory.get() + slot * pageSize);
+        }
+        table.erase(frame.page);
+        frame = Frame();
+        evictions++;
+        return slot;
+    }
+
+    cout << "Error: Every buffer pool page is pinned" << endl;
+    abort();
+}
+
+/**
+ * Pin a page in memory, reading it if it is not cached
+ *
+ * @param page Page number
+ * @return The page's bytes, valid until it is unpinned
+ */
+char* BufferPool::Pin(const uint32_t page) {
+    if (const auto found = table.find(page); found != table.end()) {
+        Frame& frame = frames[found->second];
+        frame.pins++;
+        frame.referenced = true;
+        hits++;
+        return memory.get() + found->second * pageSize;
+    }
+
+    misses++;
+    const size_t slot = victim();
+    char* data = memory.get() + slot * pageSize;
+    file.seekg(static_cast<streamoff>(page) * pageSize);
+    file.read(data, pageSize);
+    if (file.gcount() < static_cast<streamsize>(pageSize)) {
+        // Allocated but never written back: still all zeroes
+        memset(data + file.gcount(), 0, pageSize - file.gcount());
+    }
+    file.clear();
+
+    frames[slot] = {page, true, false, true, 1};
+    table[page] = slot;
+    return data;
+}
+
+/**
+ * Add a zeroed page to the end of the file and pin it
+ *
+ * @param data Receives the page's bytes
+ * @return The new page number
+ */
+uint32_t BufferPool::Allocate(char** data) {
+    const uint32_t page = pageCount++;
+    const size_t slot = victim();
+    *data = memory.get() + slot * pageSize;
+    memset(*data, 0, pageSize);
+
+    frames[slot] = {page, true, true, true, 1};
+    table[page] = slot;
+    return page;
+}
+
+/**
+ * Release a pinned page
+ *
+ * @param page Page number
+ * @param dirty Whether the page was modified
+ */
+void BufferPool::Unpin(const uint32_t page, const bool dirty) {
+    Frame& frame = frames[table.at(page)];
+    frame.pins--;
+    frame.dirty = frame.dirty || dirty;
+}
+
+/**
+ * Write every dirty page to the file
+ *
+ * @return true if every write since opening succeeded
+ */
+bool BufferPool::Flush() {
+    for (size_t slot = 0; slot < frames.size(); slot++) {
+        if (frames[slot].used && frames[slot].dirty) {
+            writeBack(frames[slot], memory.get() + slot * pageSize);
+            frames[slot].dirty = false;
+        }
+    }
+    file.flush();
+    return !failed && file.good();
+}
+
+/**
+ * Number of pages in the file, including ones not yet written back
+ */
+uint32_t BufferPool::PageCount() const {
+    return pageCount;
+}
+
+/**
+ * Print cache statistics
+ *
+ * @param out Stream to print to
+ */
+void BufferPool::PrintStats(ostream& out) const {
+    out << "Buffer pool: " << hits << " hits, " << misses << " misses, " << evictions
+        << " evictions, " << writes << " page writes, " << frames.size() << " frames of "
+        << pageSize / 1024 << " KiB" << endl;
+}
+
+/**
+ * B+tree of courses stored in fixed-size pages of one file
+ * Offers the same Insert, Search and InOrder operations as the in-memory
+ * tree, but only the buffer pool's pages are ever held in memory, so an
+ * archive of any size can be indexed. Leaves are linked left to right,
+ * so ordered listing is one sequential pass over the leaf level.
+ *
+ * Page 0 is a header. Every other page is slotted: a 16-byte header, an
+ * array of 2-byte cell offsets in key order growing up, and cells growing
+ * down from the end of the page. Leaf cells hold a key and an encoded
+ * course; internal cells hold a key and the child for keys at or above
+ * it, with the child for smaller keys in the page header.
+ */
+class DiskBPlusTree final {
+    static constexpr char magic[8] = {'A', 'B', 'C', 'U', 'B', 'P', 'T', '1'};
+    static constexpr size_t headerSize = 16;
+    static constexpr size_t pageSize = BufferPool::pageSize;
+    // Largest cell, so a split always leaves both halves valid
+    static constexpr size_t maximumCell = (pageSize - headerSize) / 4 - 2;
+    static constexpr uint8_t leafKind = 1;
+    static constexpr uint8_t internalKind = 2;
+
+    // A decoded page: cells in key order, with the values of a leaf or
+    // the child numbers of an internal page
+    struct PageContents {
+        bool leaf = true;
+        uint32_t link = 0;
+        vector<pair<string, string>> cells;
+    };
+
+    mutable BufferPool pool;
+    uint32_t root = 0;
+    uint64_t size = 0;
+
+    static uint16_t load16(const char* at);
+    static uint32_t load32(const char* at);
+    static void store16(char* at, uint16_t value);
+    static void store32(char* at, uint32_t value);
+    static string encodeCourse(const Course& course);
+    static Course decodeCourse(string_view key, string_view value);
+    static string_view keyAt(const char* page, size_t slot);
+    static string_view valueAt(const char* page, size_t slot);
+    static size_t lowerBound(const char* page, string_view key);
+    static uint32_t childFor(const char* page, string_view key);
+    static PageContents decode(const char* page);
+    static bool encode(const PageContents& contents, char* page);
+    static size_t encodedSize(const PageContents& contents, size_t first, size_t last);
+
+    uint32_t findLeaf(string_view key, vector<uint32_t>* path) const;
+    void writeHeader() const;
+
+public:
+    DiskBPlusTree() = default;
+    DiskBPlusTree(const DiskBPlusTree&) = delete;
+    DiskBPlusTree& operator=(const DiskBPlusTree&) = delete;
+    ~DiskBPlusTree();
+
+    bool Open(const string& filename, size_t poolPages);
+    bool Insert(const Course& course);
+    [[nodiscard]] Course Search(const string& courseNumber) const;
+    void InOrder() const;
+    void Scan(const string& from, const function<bool(const Course&)>& visit) const;
+    [[nodiscard]] size_t Size() const;
+    bool Flush();
+    [[nodiscard]] const BufferPool& Pool() const;
+};
+
+uint16_t DiskBPlusTree::load16(const char* at) {
+    uint16_t value;
+    memcpy(&value, at, sizeof value);
+    return value;
+}
+
+uint32_t DiskBPlusTree::load32(const char* at) {
+    uint32_t value;
+    memcpy(&value, at, sizeof value);
+    return value;
+}
+
+void DiskBPlusTree::store16(char* at, const uint16_t value) {
+    memcpy(at, &value, sizeof value);
+}
+
+void DiskBPlusTree::store32(char* at, const uint32_t value) {
+    memcpy(at, &value, sizeof value);
+}
+
+// Encode everything but the course number: title, credits, prerequisites
+string DiskBPlusTree::encodeCourse(const Course& course) {
+    string value;
+    const auto appendString = [&](const string_view text) {
+        char length[2];
+        store16(length, static_cast<uint16_t>(text.size()));
+        value.append(length, 2);
+        value += text;
+    };
+
+    appendString(course.courseTitle.Text());
+    char fields[4];
+    store16(fields, static_cast<uint16_t>(course.credits));
+    store16(fields + 2, static_cast<uint16_t>(course.prerequisites.size()));
+    value.append(fields, 4);
+    for (const auto& prerequisite : course.prerequisites) {
+        appendString(prerequisite);
+    }
+    return value;
+}
+
+// Rebuild a course from its key and encoded value
+Course DiskBPlusTree::decodeCourse(const string_view key, const string_view value) {
+    size_t position = 0;
+    const auto readString = [&] {
+        const uint16_t length = load16(value.data() + position);
+        const string_view text = value.substr(position + 2, length);
+        position += 2 + length;
+        return text;
+    };
+
+    Course course(key, readString());
+    course.credits = static_cast<int16_t>(load16(value.data() + position));
+    const uint16_t prerequisites = load16(value.data() + position + 2);
+    position += 4;
+    for (uint16_t i = 0; i < prerequisites; i++) {
+        course.prerequisites.emplace_back(readString());
+    }
+    return course;
+}
+
+// Key of the cell in one slot
+string_view DiskBPlusTree::keyAt(const char* page, const size_t slot) {
+    const char* cell = page + load16(page + headerSize + 2 * slot);
+    return {cell + 2, load16(cell)};
+}
+
+// Value of the leaf cell in one slot
+string_view DiskBPlusTree::valueAt(const char* page, const size_t slot) {
+    const char* cell = page + load16(page + headerSize + 2 * slot);
+    const char* value = cell + 2 + load16(cell);
+    return {value + 2, load16(value)};
+}
+
+// First slot whose key is not less than a key
+size_t DiskBPlusTree::lowerBound(const char* page, const string_view key) {
+    size_t low = 0;
+    size_t high = load16(page + 2);
+    while (low < high) {
+        const size_t middle = (low + high) / 2;
+        if (keyAt(page, middle) < key) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Child of an internal page whose range holds a key
+uint32_t DiskBPlusTree::childFor(const char* page, const string_view key) {
+    const size_t count = load16(page + 2);
+    size_t slot = lowerBound(page, key);
+    if (slot < count && keyAt(page, slot) == key) {
+        slot++;
+    }
+    if (slot == 0) {
+        return load32(page + 4);
+    }
+    const char* cell = page + load16(page + headerSize + 2 * (slot - 1));
+    return load32(cell + 2 + load16(cell));
+}
+
+// Unpack a page into a list of cells
+DiskBPlusTree::PageContents DiskBPlusTree::decode(const char* page) {
+    PageContents contents;
+    contents.leaf = static_cast<uint8_t>(page[0]) == leafKind;
+    contents.link = load32(page + 4);
+    const size_t count = load16(page + 2);
+    contents.cells.reserve(count + 1);
+    for (size_t slot = 0; slot < count; slot++) {
+        if (contents.leaf) {
+            contents.cells.emplace_back(keyAt(page, slot), valueAt(page, slot));
+        } else {
+            const char* cell = page + load16(page + headerSize + 2 * slot);
+            contents.cells.emplace_back(keyAt(page, slot), string(cell + 2 + load16(cell), 4));
+        }
+    }
+    return contents;
+}
+
+// Bytes needed by cells [first, last) of a page, with their slots
+size_t DiskBPlusTree::encodedSize(const PageContents& contents, const size_t first, const size_t last) {
+    size_t bytes = headerSize;
+    for (size_t i = first; i < last; i++) {
+        bytes += 2 + 2 + contents.cells[i].first.size() + (contents.leaf ? 2 : 0) +
+                 contents.cells[i].second.size();
+    }
+    return bytes;
+}
+
+// Pack cells into a page; false if they do not fit
+bool DiskBPlusTree::encode(const PageContents& contents, char* page) {
+    if (encodedSize(contents, 0, contents.cells.size()) > pageSize) {
+        return false;
+    }
+
+    memset(page, 0, pageSize);
+    page[0] = static_cast<char>(contents.leaf ? leafKind : internalKind);
+    store16(page + 2, static_cast<uint16_t>(contents.cells.size()));
+    store32(page + 4, contents.link);
+
+    size_t end = pageSize;
+    for (size_t slot = 0; slot < contents.cells.size(); slot++) {
+        const auto& [key, value] = contents.cells[slot];
+        const size_t cellSize = 2 + key.size() + (contents.leaf ? 2 : 0) + value.size();
+        end -= cellSize;
+        char* cell = page + end;
+        store16(cell, static_cast<uint16_t>(key.size()));
+        memcpy(cell + 2, key.data(), key.size());
+        if (contents.leaf) {
+            store16(cell + 2 + key.size(), static_cast<uint16_t>(value.size()));
+            memcpy(cell + 4 + key.size(), value.data(), value.size());
+        } else {
+            memcpy(cell + 2 + key.size(), value.data(), value.size());
+        }
+        store16(page + headerSize + 2 * slot, static_cast<uint16_t>(end));
+    }
+    return true;
+}
+
+/**
+ * Destructor
+ * Writes back any pages still dirty.
+ */
+DiskBPlusTree::~DiskBPlusTree() {
+    if (root != 0) {
+        Flush();
+    }
+}
+
+/**
+ * Open an index file, creating an empty index if the file is new
+ *
+ * @param filename Path of the index file
+ * @param poolPages Pages of memory to cache, at least 8
+ * @return true if the file holds a valid index
+ */
+bool DiskBPlusTree::Open(const string& filename, const size_t poolPages) {
+    if (!pool.Open(filename, max<size_t>(poolPages, 8))) {
+        return false;
+    }
+
+    if (pool.PageCount() == 0) {
+        // New file: header page, then an empty root leaf
+        char* header;
+        pool.Allocate(&header);
+        memcpy(header, magic, sizeof magic);
+        pool.Unpin(0, true);
+
+        char* leaf;
+        root = pool.Allocate(&leaf);
+        encode(PageContents(), leaf);
+        pool.Unpin(root, true);
+        size = 0;
+        writeHeader();
+        return true;
+    }
+
+    const char* header = pool.Pin(0);
+    const bool valid = memcmp(header, magic, sizeof magic) == 0;
+    root = load32(header + 8);
+    memcpy(&size, header + 12, sizeof size);
+    pool.Unpin(0, false);
+    if (!valid || root == 0 || root >= pool.PageCount()) {
+        cout << "Error: " << filename << " is not a course index" << endl;
+        root = 0;
+        return false;
+    }
+    return true;
+}
+
+// Record the root page and course count in the header page
+void DiskBPlusTree::writeHeader() const {
+    char* header = pool.Pin(0);
+    store32(header + 8, root);
+    memcpy(header + 12, &size, sizeof size);
+    pool.Unpin(0, true);
+}
+
+// Walk from the root to the leaf whose range holds a key, optionally
+// recording the internal pages passed through
+uint32_t DiskBPlusTree::findLeaf(const string_view key, vector<uint32_t>* path) const {
+    uint32_t page = root;
+    while (true) {
+        const char* data = pool.Pin(page);
+        if (static_cast<uint8_t>(data[0]) == leafKind) {
+            pool.Unpin(page, false);
+            return page;
+        }
+        const uint32_t child = childFor(data, key);
+        pool.Unpin(page, false);
+        if (path != nullptr) {
+            path->push_back(page);
+        }
+        page = child;
+    }
+}
+
+/**
+ * Insert a course, replacing any stored course with the same number
+ * Full pages split in half, except that a leaf split by appending past its
+ * last key keeps every old course, so loading in sorted order fills pages.
+ *
+ * @param course The course to insert
+ * @return false if the course is too large to fit in a page
+ */
+bool DiskBPlusTree::Insert(const Course& course) {
+    string key(course.courseNumber);
+    string value = encodeCourse(course);
+    if (2 + 2 + key.size() + 2 + value.size() > maximumCell) {
+        cout << "Error: Course " << key << " is too large for an index page" << endl;
+        return false;
+    }
+
+    vector<uint32_t> path;
+    uint32_t page = findLeaf(key, &path);
+    bool appending = true;
+
+    // Insert into the leaf, then carry splits up the path
+    while (true) {
+        char* data = pool.Pin(page);
+        PageContents contents = decode(data);
+
+        const auto position = ranges::lower_bound(contents.cells, key, {},
+                                                  [](const auto& cell) -> const string& { return cell.first; });
+        if (contents.leaf && position != contents.cells.end() && position->first == key) {
+            position->second = std::move(value);
+            appending = false;
+        } else {
+            if (contents.leaf) {
+                appending = position == contents.cells.end() && contents.link == 0;
+                size++;
+            }
+            contents.cells.emplace(position, std::move(key), std::move(value));
+        }
+
+        if (encode(contents, data)) {
+            pool.Unpin(page, true);
+            break;
+        }
+
+        // Split: choose how many cells stay on the left
+        size_t split = contents.cells.size() - 1;
+        if (!contents.leaf || !appending) {
+            const size_t total = encodedSize(contents, 0, contents.cells.size());
+            split = 1;
+            while (split + 1 < contents.cells.size() && encodedSize(contents, 0, split + 1) <= total / 2) {
+                split++;
+            }
+        }
+
+        PageContents right;
+        right.leaf = contents.leaf;
+        string separator = contents.cells[split].first;
+        if (contents.leaf) {
+            right.link = contents.link;
+            right.cells.assign(make_move_iterator(contents.cells.begin() + static_cast<ptrdiff_t>(split)),
+                               make_move_iterator(contents.cells.end()));
+        } else {
+            // The middle key moves up; its child leads the right page
+            right.link = load32(contents.cells[split].second.data());
+            right.cells.assign(make_move_iterator(contents.cells.begin() + static_cast<ptrdiff_t>(split) + 1),
+                               make_move_iterator(contents.cells.end()));
+        }
+        contents.cells.resize(split);
+
+        char* rightData;
+        const uint32_t rightPage = pool.Allocate(&rightData);
+        encode(right, rightData);
+        if (contents.leaf) {
+            contents.link = rightPage;
+        }
+        encode(contents, data);
+        pool.Unpin(rightPage, true);
+        pool.Unpin(page, true);
+
+        key = std::move(separator);
+        value.assign(4, '\0');
+        store32(value.data(), rightPage);
+
+        if (path.empty()) {
+            // The root split: grow the tree by one level
+            PageContents newRoot;
+            newRoot.leaf = false;
+            newRoot.link = page;
+            newRoot.cells.emplace_back(std::move(key), std::move(value));
+            char* rootData;
+            root = pool.Allocate(&rootData);
+            encode(newRoot, rootData);
+            pool.Unpin(root, true);
+            break;
+        }
+        page = path.back();
+        path.pop_back();
+    }
+
+    writeHeader();
+    return true;
+}
+
+/**
+ * Search for a course by course number
+ *
+ * @param courseNumber The course number to search for
+ * @return The course if found, empty course otherwise
+ */
+Course DiskBPlusTree::Search(const string& courseNumber) const {
+    const uint32_t page = findLeaf(courseNumber, nullptr);
+    const char* data = pool.Pin(page);
+    const size_t slot = lowerBound(data, courseNumber);
+
+    Course course;
+    if (slot < load16(data + 2) && keyAt(data, slot) == courseNumber) {
+        course = decodeCourse(courseNumber, valueAt(data, slot));
+    }
+    pool.Unpin(page, false);
+    return course;
+}
+
+/**
+ * Visit courses in order, starting from the first at or after a key
+ * Only one leaf is pinned at a time.
+ *
+ * @param from Course number to start at; empty starts at the beginning
+ * @param visit Called with each course; returning false stops the scan
+ */
+void DiskBPlusTree::Scan(const string& from, const function<bool(const Course&)>& visit) const {
+    uint32_t page = findLeaf(from, nullptr);
+    size_t slot = 0;
+    {
+        const char* data = pool.Pin(page);
+        slot = lowerBound(data, from);
+        pool.Unpin(page, false);
+    }
+
+    while (page != 0) {
+        const char* data = pool.Pin(page);
+        const size_t count = load16(data + 2);
+        for (; slot < count; slot++) {
+            if (!visit(decodeCourse(keyAt(data, slot), valueAt(data, slot)))) {
+                pool.Unpin(page, false);
+                return;
+            }
+        }
+        const uint32_t next = load32(data + 4);
+        pool.Unpin(page, false);
+        page = next;
+        slot = 0;
+    }
+}
+
+/**
+ * Print every course in order, like BinarySearchTree::InOrder
+ */
+void DiskBPlusTree::InOrder() const {
+    Scan("", [](const Course& course) {
+        cout << course.courseNumber << ", " << course.courseTitle << endl;
+        return true;
+    });
+}
+
+/**
+ * Number of courses stored in the index
+ */
+size_t DiskBPlusTree::Size() const {
+    return size;
+}
+
+/**
+ * Write every modified page to disk
+ *
+ * @return true if all writes succeeded
+ */
+bool DiskBPlusTree::Flush() {
+    if (!pool.Flush()) {
+        cout << "Error: Could not write the course index" << endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Get the buffer pool, for reporting
+ */
+const BufferPool& DiskBPlusTree::Pool() const {
+    return pool;
+}
+
+//============================================================================
+// Succinct Course Index
+//============================================================================
+
+/**
+ * Bit vector with constant-time rank and logarithmic-time select
+ * A running count of set bits is kept every 512 bits (8 words), about
+ * 6% on top of the bits themselves.
+ */
+class RankSelectBits final {
+    static constexpr size_t wordsPerBlock = 8;
+
+    vector<uint64_t> words;
+    vector<uint32_t> blockRanks;
+    size_t size = 0;
+
+public:
+    void Append(bool bit);
+    void Seal();
+    [[nodiscard]] bool Get(size_t position) const;
+    [[nodiscard]] size_t Rank1(size_t position) const;
+    [[nodiscard]] size_t Select1(size_t rank) const;
+    [[nodiscard]] size_t Bytes() const;
+};
+
+/**
+ * Append one bit
+ *
+ * @param bit The bit to append
+ */
+void RankSelectBits::Append(const bool bit) {
+    if (size % 64 == 0) {
+        words.push_back(0);
+    }
+    if (bit) {
+        words.back() |= uint64_t{1} << (size % 64);
+    }
+    size++;
+}
+
+/**
+ * Build the rank directory; call once after the last Append
+ */
+void RankSelectBits::Seal() {
+    words.shrink_to_fit();
+    blockRanks.clear();
+    uint32_t ones = 0;
+    for (size_t word = 0; word < words.size(); word++) {
+        if (word % wordsPerBlock == 0) {
+            blockRanks.push_back(ones);
+        }
+        ones += static_cast<uint32_t>(popcount(words[word]));
+    }
+    blockRanks.push_back(ones);
+    blockRanks.shrink_to_fit();
+}
+
+/**
+ * Read one bit
+ *
+ * @param position Bit position
+ * @return The bit
+ */
+bool RankSelectBits::Get(const size_t position) const {
+    return (words[position / 64] >> (position % 64)) & 1;
+}
+
+/**
+ * Count the set bits before a position
+ *
+ * @param position Bit position, at most the number of bits
+ * @return Number of set bits in [0, position)
+ */
+size_t RankSelectBits::Rank1(const size_t position) const {
+    const size_t word = position / 64;
+    size_t rank = blockRanks[word / wordsPerBlock];
+    for (size_t i = word - word % wordsPerBlock; i < word; i++) {
+        rank += popcount(words[i]);
+    }
+    if (position % 64 != 0) {
+        rank += popcount(words[word] & ((uint64_t{1} << (position % 64)) - 1));
+    }
+    return rank;
+}
+
+/**
+ * Find a set bit by its rank
+ *
+ * @param rank Zero-based rank, less than the number of set bits
+ * @return Position of the set bit with that many set bits before it
+ */
+size_t RankSelectBits::Select1(size_t rank) const {
+    // Last block starting at or below the rank, then scan its words
+    const auto block = ranges::upper_bound(blockRanks, static_cast<uint32_t>(rank)) - blockRanks.begin() - 1;
+    rank -= blockRanks[block];
+    size_t word = static_cast<size_t>(block) * wordsPerBlock;
+    while (static_cast<size_t>(popcount(words[word])) <= rank) {
+        rank -= popcount(words[word]);
+        word++;
+    }
+
+    uint64_t bits = words[word];
+    for (; rank > 0; rank--) {
+        bits &= bits - 1;
+    }
+    return word * 64 + static_cast<size_t>(countr_zero(bits));
+}
+
+/**
+ * Memory held by the bits and the rank directory
+ */
+size_t RankSelectBits::Bytes() const {
+    return words.capacity() * sizeof(uint64_t) + blockRanks.capacity() * sizeof(uint32_t);
+}
+
+/**
+ * Array of unsigned integers stored in the fewest bits that fit the largest
+ */
+class PackedInts final {
+    vector<uint64_t> words;
+    unsigned width = 1;
+
+public:
+    void Build(const vector<uint64_t>& values);
+    [[nodiscard]] uint64_t Get(size_t index) const;
+    [[nodiscard]] size_t Bytes() const;
+};
+
+/**
+ * Pack a list of values
+ *
+ * @param values Values to store
+ */
+void PackedInts::Build(const vector<uint64_t>& values) {
+    const uint64_t largest = values.empty() ? 0 : ranges::max(values);
+    width = max(1u, static_cast<unsigned>(bit_width(largest)));
+
+    // One spare word so Get can always read two
+    words.assign((values.size() * width + 63) / 64 + 1, 0);
+    for (size_t i = 0; i < values.size(); i++) {
+        const size_t bit = i * width;
+        words[bit / 64] |= values[i] << (bit % 64);
+        if (bit % 64 + width > 64) {
+            words[bit / 64 + 1] |= values[i] >> (64 - bit % 64);
+        }
+    }
+}
+
+/**
+ * Read one value
+ *
+ * @param index Position of the value
+ * @return The value
+ */
+uint64_t PackedInts::Get(const size_t index) const {
+    const size_t bit = index * width;
+    uint64_t value = words[bit / 64] >> (bit % 64);
+    if (bit % 64 + width > 64) {
+        value |= words[bit / 64 + 1] << (64 - bit % 64);
+    }
+    return width == 64 ? value : value & ((uint64_t{1} << width) - 1);
+}
+
+/**
+ * Memory held by the packed values
+ */
+size_t PackedInts::Bytes() const {
+    return words.capacity() * sizeof(uint64_t);
+}
+
+/**
+ * Read-only succinct encoding of a frozen course tree
+ * The tree keeps its exact shape, so a tree rebuilt around lookup
+ * frequencies stays fast for popular courses. Nodes are numbered in level
+ * order and the shape is two bits per node (has left, has right child):
+ * the child behind the set bit at position p is node Rank1(p) + 1, and
+ * the parent of node j sits at Select1(j - 1) / 2. Each node's record in
+ * one packed blob holds its course number as the length shared with its
+ * parent's number plus the rest, then credits, title and prerequisites,
+ * with prerequisites in the catalog stored as node numbers. Searches
+ * rebuild each number from its parent's on the way down, so no pointer
+ * or string is ever materialized until a course is returned.
+ */
+class SuccinctCourseIndex final {
+    RankSelectBits shape;
+    PackedInts offsets;
+    string records;
+    size_t size = 0;
+
+    [[nodiscard]] bool child(size_t node, bool right, size_t* next) const;
+    [[nodiscard]] string keyOf(size_t node) const;
+    void extendKey(size_t node, string& key, string_view* rest) const;
+    void decode(string_view at, string key, Course* course) const;
+
+public:
+    void Build(const BinarySearchTree& tree);
+    bool Find(string_view courseNumber, Course* course) const;
+    void ForEach(const function<void(const Course&)>& visit) const;
+    [[nodiscard]] size_t Size() const;
+    [[nodiscard]] size_t Bytes() const;
+};
+
+/**
+ * Encode a course tree
+ *
+ * @param tree The tree to encode; its shape is kept
+ */
+void SuccinctCourseIndex::Build(const BinarySearchTree& tree) {
+    // Level order numbers every node; children are numbered as they are met
+    vector<const Course*> nodes;
+    vector<uint32_t> parents;
+    unordered_map<string_view, uint32_t> numbers;
+    shape = RankSelectBits();
+    tree.ForEachLevelOrder([&](const Course& course, const bool hasLeft, const bool hasRight) {
+        const auto node = static_cast<uint32_t>(nodes.size());
+        if (node == 0) {
+            parents.push_back(0);
+        }
+        nodes.push_back(&course);
+        numbers.emplace(course.courseNumber, node);
+        shape.Append(hasLeft);
+        shape.Append(hasRight);
+        if (hasLeft) parents.push_back(node);
+        if (hasRight) parents.push_back(node);
+    });
+    shape.Seal();
+    size = nodes.size();
+
+    records.clear();
+    vector<uint64_t> starts;
+    for (size_t node = 0; node < nodes.size(); node++) {
+        const Course& course = *nodes[node];
+        starts.push_back(records.size());
+
+        const pmr::string& parentNumber = nodes[parents[node]]->courseNumber;
+        const size_t shared = node == 0 ? 0 : ranges::mismatch(course.courseNumber, parentNumber).in1 -
+                                                   course.courseNumber.begin();
+        appendVarint(records, shared);
+        appendField(records, string_view(course.courseNumber).substr(shared));
+
+        appendVarint(records, static_cast<uint64_t>(course.credits + 1));
+        appendField(records, course.courseTitle.Encoded());
+
+        // Catalog courses as 2 * node + 1, anything else as 2 * length and text
+        appendVarint(records, course.prerequisites.size());
+        for (const auto& prereq : course.prerequisites) {
+            if (const auto found = numbers.find(prereq); found != numbers.end()) {
+                appendVarint(records, uint64_t{found->second} * 2 + 1);
+            } else {
+                appendVarint(records, prereq.size() * 2);
+                records += prereq;
+            }
+        }
+    }
+    records.shrink_to_fit();
+    offsets.Build(starts);
+}
+
+// Find a node's left or right child, false if it has none
+bool SuccinctCourseIndex::child(const size_t node, const bool right, size_t* next) const {
+    const size_t position = node * 2 + (right ? 1 : 0);
+    if (!shape.Get(position)) {
+        return false;
+    }
+    *next = shape.Rank1(position) + 1;
+    return true;
+}
+
+// Turn the parent's course number into this node's, leaving rest at the
+// node's remaining fields
+void SuccinctCourseIndex::extendKey(const size_t node, string& key, string_view* rest) const {
+    string_view at = string_view(records).substr(offsets.Get(node));
+    uint64_t shared;
+    string_view suffix;
+    readVarint(at, &shared);
+    readField(at, &suffix);
+    key.resize(shared);
+    key += suffix;
+    *rest = at;
+}
+
+// Rebuild a node's course number from the root down
+string SuccinctCourseIndex::keyOf(size_t node) const {
+    vector<size_t> path{node};
+    while (node != 0) {
+        node = shape.Select1(node - 1) / 2;
+        path.push_back(node);
+    }
+
+    string key;
+    string_view rest;
+    for (auto step = path.rbegin(); step != path.rend(); ++step) {
+        extendKey(*step, key, &rest);
+    }
+    return key;
+}
+
+// Decode the fields after a node's course number
+void SuccinctCourseIndex::decode(string_view at, string key, Course* course) const {
+    uint64_t credits;
+    string_view title;
+    readVarint(at, &credits);
+    readField(at, &title);
+    *course = Course(key, string());
+    course->credits = static_cast<int>(credits) - 1;
+    course->courseTitle = CompressedTitle::FromEncoded(title);
+
+    uint64_t prereqCount;
+    readVarint(at, &prereqCount);
+    for (size_t i = 0; i < prereqCount; i++) {
+        uint64_t reference;
+        readVarint(at, &reference);
+        if (reference % 2 == 1) {
+            course->prerequisites.emplace_back(keyOf(reference / 2));
+        } else {
+            course->prerequisites.emplace_back(at.substr(0, reference / 2));
+            at.remove_prefix(reference / 2);
+        }
+    }
+}
+
+/**
+ * Search for a course by number
+ *
+ * @param courseNumber Course number to find
+ * @param course Receives the decoded course if found
+ * @return true if the course was found
+ */
+bool SuccinctCourseIndex::Find(const string_view courseNumber, Course* course) const {
+    string key;
+    string_view rest;
+    size_t node = 0;
+    if (size == 0) {
+        return false;
+    }
+    while (true) {
+        extendKey(node, key, &rest);
+        const int compared = courseNumber.compare(key);
+        if (compared == 0) {
+            decode(rest, std::move(key), course);
+            return true;
+        }
+        if (!child(node, compared > 0, &node)) {
+            return false;
+        }
+    }
+}
+
+/**
+ * Visit every course in course number order
+ * Each step down the tree extends the number on top of the stack, so
+ * numbers are never rebuilt from the root.
+ *
+ * @param visit Callable invoked with each decoded course
+ */
+void SuccinctCourseIndex::ForEach(const function<void(const Course&)>& visit) const {
+    struct Frame {
+        size_t node;
+        string key;
+        string_view rest;
+    };
+    vector<Frame> stack;
+    Course course;
+    string key;
+
+    auto descendLeft = [&](size_t node) {
+        while (true) {
+            Frame frame{node, key, {}};
+            extendKey(node, frame.key, &frame.rest);
+            key = frame.key;
+            stack.push_back(std::move(frame));
+            if (!child(node, false, &node)) {
+                return;
+            }
+        }
+    };
+
+    if (size > 0) {
+        descendLeft(0);
+    }
+    while (!stack.empty()) {
+        Frame frame = std::move(stack.back());
+        stack.pop_back();
+        decode(frame.rest, frame.key, &course);
+        visit(course);
+
+        size_t right;
+        if (child(frame.node, true, &right)) {
+            key = std::move(frame.key);
+            descendLeft(right);
+        }
+    }
+}
+
+/**
+ * Number of courses stored
+ */
+size_t SuccinctCourseIndex::Size() const {
+    return size;
+}
+
+/**
+ * Memory held by the encoding
+ */
+size_t SuccinctCourseIndex::Bytes() const {
+    return shape.Bytes() + offsets.Bytes() + records.capacity() + sizeof(*this);
+}
+
+//============================================================================
+// Course Equivalency Table
+//============================================================================
+
+/**
+ * Hash for string-keyed maps that also accepts string_view lookups
+ * With equal_to<>, a course number stored in any string type finds its
+ * entry without being copied into a std::string.
+ */
+struct StringHash {
+    using is_transparent = void;
+
+    size_t operator()(const string_view text) const {
+        return hash<string_view>{}(text);
+    }
+};
+
+/**
+ * Union-find over course numbers from ABCU and partner institutions
+ * Courses listed as equivalent are merged into one class. Once the catalog
+ * is loaded the table is frozen, flattening every id onto its class root so
+ * later lookups never walk parent chains.
+ */
+class EquivalencyTable final {
+    unordered_map<string, int, StringHash, equal_to<>> ids;
+    vector<int> parent;
+    vector<int> rank;
+    vector<string> catalogCourse;
+
+    int find(int id);
+
+public:
+    void Clear();
+    int Intern(string_view courseNumber);
+    void Merge(string_view first, string_view second);
+    void MarkCatalogCourse(string_view courseNumber);
+    void ClearCatalogCourse(string_view courseNumber);
+    void Freeze();
+    [[nodiscard]] int ClassOf(string_view courseNumber) const;
+    [[nodiscard]] string_view CatalogCourseFor(int classId) const;
+    [[nodiscard]] size_t Size() const;
+    [[nodiscard]] size_t Prefault() const;
+    [[nodiscard]] vector<vector<string>> Groups() const;
+    void Save(string& out) const;
+    bool Restore(string_view& in);
+};
+
+/**
+ * Remove all courses and equivalencies
+ */
+void EquivalencyTable::Clear() {
+    ids.clear();
+    parent.clear();
+    rank.clear();
+    catalogCourse.clear();
+}
+
+/**
+ * Look up the id of a course number, adding it as its own class if new
+ *
+ * @param courseNumber Course number from any institution
+ * @return The course's id
+ */
+int EquivalencyTable::Intern(const string_view courseNumber) {
+    if (const auto found = ids.find(courseNumber); found != ids.end()) {
+        return found->second;
+    }
+    const auto id = static_cast<int>(parent.size());
+    ids.emplace(courseNumber, id);
+    parent.push_back(id);
+    rank.push_back(0);
+    catalogCourse.emplace_back();
+    return id;
+}
+
+// Find the root of an id, halving the path on the way up
+int EquivalencyTable::find(int id) {
+    while (parent[id] != id) {
+        parent[id] = parent[parent[id]];
+        id = parent[id];
+    }
+    return id;
+}
+
+/**
+ * Record that two courses are interchangeable
+ *
+ * @param first Course number of one course
+ * @param second Course number of the equivalent course
+ */
+void EquivalencyTable::Merge(const string_view first, const string_view second) {
+    int a = find(Intern(first));
+    int b = find(Intern(second));
+    if (a == b) {
+        return;
+    }
+
+    // Union by rank keeps the trees shallow
+    if (rank[a] < rank[b]) {
+        swap(a, b);
+    }
+    parent[b] = a;
+    if (rank[a] == rank[b]) {
+        rank[a]++;
+    }
+    if (catalogCourse[a].empty()) {
+        catalogCourse[a] = std::move(catalogCourse[b]);
+    }
+}
+
+/**
+ * Note that a course number belongs to the ABCU catalog
+ * The first catalog course seen in a class represents it in transfer reports.
+ *
+ * @param courseNumber ABCU course number
+ */
+void EquivalencyTable::MarkCatalogCourse(const string_view courseNumber) {
+    const int root = find(Intern(courseNumber));
+    if (catalogCourse[root].empty()) {
+        catalogCourse[root] = courseNumber;
+    }
+}
+
+/**
+ * Forget which catalog course represents the class of a course number,
+ * so the next MarkCatalogCourse in that class chooses again
+ *
+ * @param courseNumber Any course number in the class
+ */
+void EquivalencyTable::ClearCatalogCourse(const string_view courseNumber) {
+    catalogCourse[find(Intern(courseNumber))].clear();
+}
+
+/**
+ * Point every id directly at its class root
+ * Must be called after the last Merge and before ClassOf.
+ */
+void EquivalencyTable::Freeze() {
+    for (size_t i = 0; i < parent.size(); i++) {
+        parent[i] = find(static_cast<int>(i));
+    }
+}
+
+/**
+ * Get the equivalence class of a course number
+ *
+ * @param courseNumber Course number from any institution
+ * @return The class id, or -1 if the course is unknown
+ */
+int EquivalencyTable::ClassOf(const string_view courseNumber) const {
+    const auto it = ids.find(courseNumber);
+    return it == ids.end() ? -1 : parent[it->second];
+}
+
+/**
+ * Get the ABCU course representing a class
+ *
+ * @param classId Class id returned by ClassOf
+ * @return The catalog course number, empty if the class has none
+ */
+string_view EquivalencyTable::CatalogCourseFor(int classId) const {
+    return catalogCourse[classId];
+}
+
+/**
+ * Number of distinct course numbers known to the table
+ */
+size_t EquivalencyTable::Size() const {
+    return parent.size();
+}
+
+/**
+ * Read every entry so the table's pages are resident
+ *
+ * @return Number of bytes read
+ */
+size_t EquivalencyTable::Prefault() const {
+    size_t bytes = parent.size() * sizeof(int) + rank.size() * sizeof(int);
+    volatile int sink = 0;
+    for (const auto& [number, id] : ids) {
+        sink = parent[id] + (number.empty() ? 0 : number[0]);
+        bytes += number.size() + sizeof(id);
+    }
+    for (const auto& course : catalogCourse) {
+        sink = course.empty() ? 0 : course[0];
+        bytes += course.size();
+    }
+    (void)sink;
+    return bytes;
+}
+
+/**
+ * List every class with more than one member
+ * Must be called after Freeze.
+ *
+ * @return Each group's course numbers, sorted, with the groups sorted too
+ */
+vector<vector<string>> EquivalencyTable::Groups() const {
+    unordered_map<int, vector<string>> members;
+    for (const auto& [number, id] : ids) {
+        members[parent[id]].push_back(number);
+    }
+
+    vector<vector<string>> groups;
+    for (auto& [root, numbers] : members) {
+        if (numbers.size() > 1) {
+            ranges::sort(numbers);
+            groups.push_back(std::move(numbers));
+        }
+    }
+    ranges::sort(groups);
+    return groups;
+}
+
+/**
+ * Append the frozen table in binary form
+ * Ids are kept, so class ids saved alongside stay valid after Restore.
+ *
+ * @param out Buffer to append to
+ */
+void EquivalencyTable::Save(string& out) const {
+    vector<const string*> numbers(parent.size());
+    for (const auto& [number, id] : ids) {
+        numbers[id] = &number;
+    }
+    appendVarint(out, parent.size());
+    for (size_t id = 0; id < parent.size(); id++) {
+        appendField(out, *numbers[id]);
+        appendVarint(out, static_cast<uint64_t>(parent[id]));
+        appendVarint(out, static_cast<uint64_t>(rank[id]));
+        appendField(out, catalogCourse[id]);
+    }
+}
+
+/**
+ * Replace the table with one written by Save
+ *
+ * @param in Buffer, advanced past the table
+ * @return false if the buffer is truncated or inconsistent
+ */
+bool EquivalencyTable::Restore(string_view& in) {
+    Clear();
+    uint64_t count;
+    if (!readVarint(in, &count) || count > in.size()) {
+        return false;
+    }
+    parent.resize(count);
+    rank.resize(count);
+    catalogCourse.resize(count);
+    ids.reserve(count);
+    for (size_t id = 0; id < count; id++) {
+        string_view number;
+        string_view course;
+        uint64_t root;
+        uint64_t height;
+        if (!readField(in, &number) || !readVarint(in, &root) || root >= count ||
+            !readVarint(in, &height) || !readField(in, &course)) {
+            return false;
+        }
+        ids.emplace(number, static_cast<int>(id));
+        parent[id] = static_cast<int>(root);
+        rank[id] = static_cast<int>(height);
+        catalogCourse[id] = course;
+    }
+    return true;
+}
+
+//============================================================================
+// String Helpers
+//============================================================================
+
+/**
+ * Convert a course number to upper case for case-insensitive lookup
+ *
+ * @param courseNumber Course number as entered
+ * @return The upper-case course number
+ */
+string toUpperCase(const string_view courseNumber) {
+    string upper(courseNumber);
+    ranges::transform(upper, upper.begin(), ::toupper);
+    return upper;
+}
+
+/**
+ * Split a course number such as CSCI300 into department and level
+ *
+ * @param courseNumber The course number
+ * @param level Receives the digits after the department, or -1 if there are none
+ * @return The leading letters
+ */
+string_view splitCourseNumber(const string_view courseNumber, int* level) {
+    size_t position = 0;
+    while (position < courseNumber.size() && isalpha(static_cast<unsigned char>(courseNumber[position]))) {
+        position++;
+    }
+
+    *level = -1;
+    for (size_t i = position; i < courseNumber.size() && isdigit(static_cast<unsigned char>(courseNumber[i])) &&
+                              *level < 100000000; i++) {
+        *level = max(*level, 0) * 10 + (courseNumber[i] - '0');
+    }
+    return courseNumber.substr(0, position);
+}
+
+//============================================================================
+// Autocomplete Index
+//============================================================================
+
+/**
+ * Completion trie over course numbers and titles, ranked by popularity
+ * Edges are labelled with slices of one shared string (a radix trie), and
+ * every node records the highest popularity found below it, so a top-k
+ * search can stop as soon as k results beat every unexplored subtree.
+ * Popularity counters are atomic so query threads can record lookups
+ * while others complete.
+ */
+class CompletionIndex final {
+    static constexpr uint32_t none = numeric_limits<uint32_t>::max();
+
+    struct TrieNode {
+        uint32_t labelOffset = 0;
+        uint32_t labelLength = 0;
+        uint32_t parent = none;
+        uint32_t firstChild = none;
+        uint32_t nextSibling = none;
+        uint32_t firstTerminal = none;
+    };
+
+    struct Terminal {
+        uint32_t course;
+        uint32_t next;
+    };
+
+    string labels;
+    vector<TrieNode> nodes;
+    vector<Terminal> terminals;
+    vector<const Course*> courses;
+    vector<array<uint32_t, 2>> courseNodes;
+    unique_ptr<atomic<uint32_t>[]> scores;
+    unique_ptr<atomic<uint32_t>[]> maxScores;
+
+    uint32_t insert(const string& text);
+    [[nodiscard]] uint32_t findCourse(string_view courseNumber) const;
+    void raise(uint32_t course, uint32_t score) const;
+
+public:
+    void Build(const BinarySearchTree& tree);
+    void Record(string_view courseNumber) const;
+    void InheritScores(const CompletionIndex& previous, const CompletionIndex* base = nullptr) const;
+    void SetScore(string_view courseNumber, uint32_t score) const;
+    [[nodiscard]] vector<uint64_t> Popularity() const;
+    [[nodiscard]] const vector<const Course*>& Courses() const;
+    [[nodiscard]] vector<pair<const Course*, uint32_t>> Complete(const string& prefix,
+                                                                 size_t count) const;
+};
+
+/**
+ * Build the trie over every course in a tree
+ * Course numbers and titles are indexed in upper case; all popularity
+ * counts start at zero.
+ *
+ * @param tree The loaded courses
+ */
+void CompletionIndex::Build(const BinarySearchTree& tree) {
+    labels.clear();
+    nodes.assign(1, TrieNode());
+    terminals.clear();
+    courses.clear();
+    courseNodes.clear();
+    courses.reserve(tree.Size());
+
+    tree.ForEach([&](const Course& course) { courses.push_back(&course); });
+
+    for (uint32_t id = 0; id < courses.size(); id++) {
+        array<uint32_t, 2> ends{};
+        const string texts[2] = {toUpperCase(courses[id]->courseNumber),
+                                 toUpperCase(courses[id]->courseTitle.Text())};
+        for (int i = 0; i < 2; i++) {
+            ends[i] = insert(texts[i]);
+            terminals.push_back({id, nodes[ends[i]].firstTerminal});
+            nodes[ends[i]].firstTerminal = static_cast<uint32_t>(terminals.size() - 1);
+        }
+        courseNodes.push_back(ends);
+    }
+
+    scores = make_unique<atomic<uint32_t>[]>(courses.size());
+    maxScores = make_unique<atomic<uint32_t>[]>(nodes.size());
+}
+
+// Insert a string, splitting edges as needed, and return its end node
+uint32_t CompletionIndex::insert(const string& text) {
+    uint32_t node = 0;
+    size_t position = 0;
+
+    while (position < text.size()) {
+        // Find the child edge starting with the next character
+        uint32_t previous = none;
+        uint32_t child = nodes[node].firstChild;
+        while (child != none && labels[nodes[child].labelOffset] != text[position]) {
+            previous = child;
+            child = nodes[child].nextSibling;
+        }
+
+        // No edge yet: the rest of the text becomes a new leaf
+        if (child == none) {
+            TrieNode leaf;
+            leaf.labelOffset = static_cast<uint32_t>(labels.size());
+            leaf.labelLength = static_cast<uint32_t>(text.size() - position);
+            leaf.parent = node;
+            leaf.nextSibling = nodes[node].firstChild;
+            labels.append(text, position);
+            nodes.push_back(leaf);
+            nodes[node].firstChild = static_cast<uint32_t>(nodes.size() - 1);
+            return nodes[node].firstChild;
+        }
+
+        // Match as much of the edge label as possible
+        const TrieNode edge = nodes[child];
+        uint32_t common = 0;
+        while (common < edge.labelLength && position + common < text.size() &&
+               labels[edge.labelOffset + common] == text[position + common]) {
+            common++;
+        }
+
+        if (common < edge.labelLength) {
+            // Split the edge: a new middle node takes the shared part
+            TrieNode middle;
+            middle.labelOffset = edge.labelOffset;
+            middle.labelLength = common;
+            middle.parent = node;
+            middle.firstChild = child;
+            middle.nextSibling = edge.nextSibling;
+            nodes.push_back(middle);
+            const auto middleId = static_cast<uint32_t>(nodes.size() - 1);
+
+            nodes[child].labelOffset += common;
+            nodes[child].labelLength -= common;
+            nodes[child].parent = middleId;
+            nodes[child].nextSibling = none;
+            if (previous == none) {
+                nodes[node].firstChild = middleId;
+            } else {
+                nodes[previous].nextSibling = middleId;
+            }
+            child = middleId;
+        }
+
+        node = child;
+        position += common;
+    }
+
+    return node;
+}
+
+// Binary search the sorted course list for a course number
+uint32_t CompletionIndex::findCourse(const string_view courseNumber) const {
+    const auto found = ranges::lower_bound(courses, courseNumber, {},
+                                           [](const Course* course) -> string_view {
+                                               return course->courseNumber;
+                                           });
+    if (found == courses.end() || (*found)->courseNumber != courseNumber) {
+        return none;
+    }
+    return static_cast<uint32_t>(found - courses.begin());
+}
+
+// Raise the subtree maxima above a course's terminals to a new score
+void CompletionIndex::raise(const uint32_t course, const uint32_t score) const {
+    for (uint32_t node : courseNodes[course]) {
+        while (node != none) {
+            uint32_t current = maxScores[node].load(memory_order_relaxed);
+            while (current < score &&
+                   !maxScores[node].compare_exchange_weak(current, score, memory_order_relaxed)) {
+            }
+            // Ancestors already bound a score at least this high
+            if (current >= score) {
+                break;
+            }
+            node = nodes[node].parent;
+        }
+    }
+}
+
+/**
+ * Count one lookup of a course
+ *
+ * @param courseNumber Course number that was looked up
+ */
+void CompletionIndex::Record(const string_view courseNumber) const {
+    const uint32_t course = findCourse(courseNumber);
+    if (course != none) {
+        raise(course, scores[course].fetch_add(1, memory_order_relaxed) + 1);
+    }
+}
+
+/**
+ * Copy popularity counts from an index over an older catalog
+ * Courses are matched by course number; new courses start at zero. With
+ * a base, the lookups previous recorded since it was copied from base are
+ * added instead, which merges a per-node replica's counts.
+ *
+ * @param previous The index being replaced
+ * @param base Index previous was copied from, over the same courses, or
+ *             nullptr to copy previous's counts
+ */
+void CompletionIndex::InheritScores(const CompletionIndex& previous, const CompletionIndex* base) const {
+    for (uint32_t course = 0; course < courses.size(); course++) {
+        const uint32_t old = previous.findCourse(courses[course]->courseNumber);
+        if (old == none) {
+            continue;
+        }
+        uint32_t score = previous.scores[old].load(memory_order_relaxed);
+        if (base != nullptr) {
+            score = scores[course].load(memory_order_relaxed) +
+                    (score - base->scores[old].load(memory_order_relaxed));
+        }
+        scores[course].store(score, memory_order_relaxed);
+        raise(course, score);
+    }
+}
+
+/**
+ * Set the popularity of one course, e.g. from a saved frequency file
+ * Only valid while scores are not being recorded concurrently.
+ *
+ * @param courseNumber Course number to set
+ * @param score The new popularity
+ */
+void CompletionIndex::SetScore(const string_view courseNumber, const uint32_t score) const {
+    const uint32_t course = findCourse(courseNumber);
+    if (course != none) {
+        scores[course].store(score, memory_order_relaxed);
+        raise(course, score);
+    }
+}
+
+/**
+ * Get every course's popularity in sorted course order
+ */
+vector<uint64_t> CompletionIndex::Popularity() const {
+    vector<uint64_t> counts(courses.size());
+    for (size_t i = 0; i < courses.size(); i++) {
+        counts[i] = scores[i].load(memory_order_relaxed);
+    }
+    return counts;
+}
+
+/**
+ * Get the indexed courses in sorted order
+ */
+const vector<const Course*>& CompletionIndex::Courses() const {
+    return courses;
+}
+
+/**
+ * Find the most popular courses whose number or title starts with a prefix
+ * Explores the trie best-first by subtree maximum, so only subtrees that
+ * could still hold a top result are visited.
+ *
+ * @param prefix Partial course number or title, any case
+ * @param count Maximum number of results
+ * @return Courses with their popularity, most popular first
+ */
+vector<pair<const Course*, uint32_t>> CompletionIndex::Complete(const string& prefix,
+                                                                const size_t count) const {
+    vector<pair<const Course*, uint32_t>> results;
+    if (nodes.empty() || count == 0) {
+        return results;
+    }
+
+    // Walk down to the node covering the whole prefix
+    const string text = toUpperCase(prefix);
+    uint32_t node = 0;
+    size_t position = 0;
+    while (position < text.size()) {
+        uint32_t child = nodes[node].firstChild;
+        while (child != none && labels[nodes[child].labelOffset] != text[position]) {
+            child = nodes[child].nextSibling;
+        }
+        if (child == none) {
+            return results;
+        }
+        const size_t length = min<size_t>(nodes[child].labelLength, text.size() - position);
+        if (labels.compare(nodes[child].labelOffset, length, text, position, length) != 0) {
+            return results;
+        }
+        node = child;
+        position += length;
+    }
+
+    // Candidates are (score, is a course, id). Courses win ties with
+    // subtrees, and tied courses come out in course number order.
+    using Candidate = tuple<uint32_t, bool, uint32_t>;
+    auto lowerPriority = [](const Candidate& a, const Candidate& b) {
+        if (get<0>(a) != get<0>(b)) return get<0>(a) < get<0>(b);
+        if (get<1>(a) != get<1>(b)) return get<1>(a) < get<1>(b);
+        return get<2>(a) > get<2>(b);
+    };
+    priority_queue<Candidate, vector<Candidate>, decltype(lowerPriority)> frontier(lowerPriority);
+    frontier.emplace(maxScores[node].load(memory_order_relaxed), false, node);
+    vector<uint32_t> returned;
+
+    while (!frontier.empty() && results.size() < count) {
+        const auto [score, isCourse, id] = frontier.top();
+        frontier.pop();
+
+        if (isCourse) {
+            // A course can be reached through both its number and its title
+            if (ranges::find(returned, id) == returned.end()) {
+                returned.push_back(id);
+                results.emplace_back(courses[id], score);
+            }
+            continue;
+        }
+
+        for (uint32_t t = nodes[id].firstTerminal; t != none; t = terminals[t].next) {
+            const uint32_t course = terminals[t].course;
+            frontier.emplace(scores[course].load(memory_order_relaxed), true, course);
+        }
+        for (uint32_t child = nodes[id].firstChild; child != none; child = nodes[child].nextSibling) {
+            frontier.emplace(maxScores[child].load(memory_order_relaxed), false, child);
+        }
+    }
+
+    return results;
+}
+
+//============================================================================
+// Title Index
+//============================================================================
+
+/**
+ * Trigram index over course titles for substring search
+ * Every three-character run of an upper-case title maps to the sorted ids
+ * of the courses containing it, so a search only has to verify courses
+ * that hold all of the term's trigrams.
+ */
+class TitleIndex final {
+    vector<uint32_t> trigrams;
+    vector<uint32_t> offsets;
+    vector<uint32_t> postings;
+
+    static uint32_t trigramAt(const string& text, size_t position);
+    [[nodiscard]] pair<const uint32_t*, const uint32_t*> find(uint32_t trigram) const;
+
+public:
+    static constexpr size_t minimumLength = 3;
+
+    void Build(const vector<const Course*>& courses);
+    [[nodiscard]] size_t Estimate(const string& term) const;
+    [[nodiscard]] vector<uint32_t> Candidates(const string& term) const;
+};
+
+// Pack the three characters at a position into one key
+uint32_t TitleIndex::trigramAt(const string& text, const size_t position) {
+    return static_cast<uint32_t>(static_cast<unsigned char>(text[position])) << 16 |
+           static_cast<uint32_t>(static_cast<unsigned char>(text[position + 1])) << 8 |
+           static_cast<unsigned char>(text[position + 2]);
+}
+
+// Get the posting list of one trigram, empty if no title contains it
+pair<const uint32_t*, const uint32_t*> TitleIndex::find(const uint32_t trigram) const {
+    const auto found = ranges::lower_bound(trigrams, trigram);
+    if (found == trigrams.end() || *found != trigram) {
+        return {nullptr, nullptr};
+    }
+    const size_t slot = found - trigrams.begin();
+    return {postings.data() + offsets[slot], postings.data() + offsets[slot + 1]};
+}
+
+/**
+ * Build the index over courses in sorted order
+ *
+ * @param courses The courses; ids are positions in this list
+ */
+void TitleIndex::Build(const vector<const Course*>& courses) {
+    vector<pair<uint32_t, uint32_t>> entries;
+    for (uint32_t id = 0; id < courses.size(); id++) {
+        const string title = toUpperCase(courses[id]->courseTitle.Text());
+        for (size_t i = 0; i + minimumLength <= title.size(); i++) {
+            entries.emplace_back(trigramAt(title, i), id);
+        }
+    }
+    ranges::sort(entries);
+    const auto [last, end] = ranges::unique(entries);
+    entries.erase(last, end);
+
+    trigrams.clear();
+    offsets.clear();
+    postings.clear();
+    postings.reserve(entries.size());
+    for (const auto& [trigram, id] : entries) {
+        if (trigrams.empty() || trigrams.back() != trigram) {
+            trigrams.push_back(trigram);
+            offsets.push_back(static_cast<uint32_t>(postings.size()));
+        }
+        postings.push_back(id);
+    }
+    offsets.push_back(static_cast<uint32_t>(postings.size()));
+}
+
+/**
+ * Bound the number of titles containing a term without intersecting lists
+ *
+ * @param term Upper-case search term
+ * @return Length of the term's shortest posting list, or SIZE_MAX if the
+ *         term is too short to use the index
+ */
+size_t TitleIndex::Estimate(const string& term) const {
+    if (term.size() < minimumLength) {
+        return numeric_limits<size_t>::max();
+    }
+    size_t shortest = numeric_limits<size_t>::max();
+    for (size_t i = 0; i + minimumLength <= term.size(); i++) {
+        const auto [first, last] = find(trigramAt(term, i));
+        shortest = min<size_t>(shortest, last - first);
+    }
+    return shortest;
+}
+
+/**
+ * Find the courses whose titles contain every trigram of a term
+ * The result is a superset of the real matches, which still need checking.
+ *
+ * @param term Upper-case search term of at least three characters
+ * @return Sorted course ids
+ */
+vector<uint32_t> TitleIndex::Candidates(const string& term) const {
+    vector<pair<const uint32_t*, const uint32_t*>> lists;
+    for (size_t i = 0; i + minimumLength <= term.size(); i++) {
+        lists.push_back(find(trigramAt(term, i)));
+    }
+    // Intersect starting from the shortest list
+    ranges::sort(lists, {}, [](const auto& list) { return list.second - list.first; });
+
+    vector<uint32_t> candidates(lists[0].first, lists[0].second);
+    vector<uint32_t> next;
+    for (size_t i = 1; i < lists.size() && !candidates.empty(); i++) {
+        next.clear();
+        set_intersection(candidates.begin(), candidates.end(), lists[i].first, lists[i].second,
+                         back_inserter(next));
+        candidates.swap(next);
+    }
+    return candidates;
+}
+
+//============================================================================
+// Course Columns
+//============================================================================
+
+/**
+ * Dense integer columns parsed from every course, in sorted course order
+ * Filters on these fields test 64 rows per mask word with SIMD compares
+ * instead of visiting each course. Departments are numbered by name.
+ */
+class CourseColumns final {
+public:
+    enum Column { Department, Level, Credits, PrereqCount, ColumnCount };
+
+private:
+    vector<string> departments;
+    array<vector<int32_t>, ColumnCount> columns;
+
+public:
+    void Build(const vector<const Course*>& courses);
+    [[nodiscard]] const int32_t* Values(Column column) const;
+    [[nodiscard]] int32_t DepartmentId(string_view name) const;
+};
+
+/**
+ * Parse the columns of every course
+ *
+ * @param courses The courses; row numbers are positions in this list
+ */
+void CourseColumns::Build(const vector<const Course*>& courses) {
+    departments.clear();
+    for (auto& column : columns) {
+        column.assign(courses.size(), -1);
+    }
+
+    vector<string_view> names(courses.size());
+    for (size_t row = 0; row < courses.size(); row++) {
+        int level;
+        names[row] = splitCourseNumber(courses[row]->courseNumber, &level);
+        columns[Level][row] = level;
+        columns[Credits][row] = courses[row]->credits;
+        columns[PrereqCount][row] = static_cast<int32_t>(courses[row]->prerequisites.size());
+    }
+
+    // Sorted course numbers group each department together
+    for (size_t row = 0; row < courses.size(); row++) {
+        if (departments.empty() || departments.back() != names[row]) {
+            departments.emplace_back(names[row]);
+        }
+    }
+    ranges::sort(departments);
+    const auto [last, end] = ranges::unique(departments);
+    departments.erase(last, end);
+    for (size_t row = 0; row < courses.size(); row++) {
+        columns[Department][row] = DepartmentId(names[row]);
+    }
+}
+
+/**
+ * Get one column, indexed by row
+ */
+const int32_t* CourseColumns::Values(const Column column) const {
+    return columns[column].data();
+}
+
+/**
+ * Look up the number of a department
+ *
+ * @param name Department letters, upper case
+ * @return The department id, or -1 if no course is in it
+ */
+int32_t CourseColumns::DepartmentId(const string_view name) const {
+    const auto found = ranges::lower_bound(departments, name);
+    if (found == departments.end() || *found != name) {
+        return -1;
+    }
+    return static_cast<int32_t>(found - departments.begin());
+}
+
+/**
+ * Clear the mask bits of rows whose value is outside [low, high], or
+ * inside it when negate is set
+ * The range test is one unsigned compare of value - low against the
+ * range width. Negative values mark a missing value and never pass a
+ * negated test; an empty range (high < low) passes nothing.
+ *
+ * @param values Column values
+ * @param count Number of rows
+ * @param low Smallest accepted value
+ * @param high Largest accepted value
+ * @param negate Whether to accept values outside the range instead
+ * @param mask One bit per row, 64 rows per word
+ */
+void andRangeMask(const int32_t* values, const size_t count, const int32_t low,
+                  const int32_t high, const bool negate, uint64_t* mask) {
+    if (high < low) {
+        fill_n(mask, (count + 63) / 64, uint64_t{0});
+        return;
+    }
+    const uint32_t width = static_cast<uint32_t>(high) - static_cast<uint32_t>(low);
+    size_t row = 0;
+
+#if defined(__AVX2__) || defined(__SSE2__)
+    // SIMD has no unsigned compare, so flip the sign bits and compare signed
+    for (; row + 64 <= count; row += 64) {
+        uint64_t outside = 0;
+        uint64_t missing = 0;
+#if defined(__AVX2__)
+        const __m256i offset = _mm256_set1_epi32(static_cast<int32_t>(0x80000000u - static_cast<uint32_t>(low)));
+        const __m256i limit = _mm256_set1_epi32(static_cast<int32_t>(width ^ 0x80000000u));
+        for (size_t lane = 0; lane < 64; lane += 8) {
+            const __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + row + lane));
+            const __m256i greater = _mm256_cmpgt_epi32(_mm256_add_epi32(value, offset), limit);
+            outside |= static_cast<uint64_t>(static_cast<uint32_t>(
+                           _mm256_movemask_ps(_mm256_castsi256_ps(greater)))) << lane;
+            missing |= static_cast<uint64_t>(static_cast<uint32_t>(
+                           _mm256_movemask_ps(_mm256_castsi256_ps(value)))) << lane;
+        }
+#else
+        const __m128i offset = _mm_set1_epi32(static_cast<int32_t>(0x80000000u - static_cast<uint32_t>(low)));
+        const __m128i limit = _mm_set1_epi32(static_cast<int32_t>(width ^ 0x80000000u));
+        for (size_t lane = 0; lane < 64; lane += 4) {
+            const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + row + lane));
+            const __m128i greater = _mm_cmpgt_epi32(_mm_add_epi32(value, offset), limit);
+            outside |= static_cast<uint64_t>(static_cast<uint32_t>(
+                           _mm_movemask_ps(_mm_castsi128_ps(greater)))) << lane;
+            missing |= static_cast<uint64_t>(static_cast<uint32_t>(
+                           _mm_movemask_ps(_mm_castsi128_ps(value)))) << lane;
+        }
+#endif
+        mask[row / 64] &= negate ? outside & ~missing : ~outside;
+    }
+#endif
+
+    for (; row < count; row++) {
+        const bool inside = static_cast<uint32_t>(values[row]) - static_cast<uint32_t>(low) <= width;
+        if (inside == negate || (negate && values[row] < 0)) {
+            mask[row / 64] &= ~(uint64_t{1} << (row % 64));
+        }
+    }
+}
+
+/**
+ * Clear the mask bits of rows whose value is not in a set, or is in it
+ * when negate is set
+ *
+ * @param values Column values
+ * @param count Number of rows
+ * @param set Accepted values, best kept small
+ * @param negate Whether to accept values outside the set instead
+ * @param mask One bit per row, 64 rows per word
+ */
+void andSetMask(const int32_t* values, const size_t count, const vector<int32_t>& set,
+                const bool negate, uint64_t* mask) {
+    size_t row = 0;
+
+#if defined(__AVX2__)
+    for (; row + 64 <= count; row += 64) {
+        uint64_t found = 0;
+        for (size_t lane = 0; lane < 64; lane += 8) {
+            const __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + row + lane));
+            __m256i equal = _mm256_setzero_si256();
+            for (const int32_t member : set) {
+                equal = _mm256_or_si256(equal, _mm256_cmpeq_epi32(value, _mm256_set1_epi32(member)));
+            }
+            found |= static_cast<uint64_t>(static_cast<uint32_t>(
+                         _mm256_movemask_ps(_mm256_castsi256_ps(equal)))) << lane;
+        }
+        mask[row / 64] &= negate ? ~found : found;
+    }
+#elif defined(__SSE2__)
+    for (; row + 64 <= count; row += 64) {
+        uint64_t found = 0;
+        for (size_t lane = 0; lane < 64; lane += 4) {
+            const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + row + lane));
+            __m128i equal = _mm_setzero_si128();
+            for (const int32_t member : set) {
+                equal = _mm_or_si128(equal, _mm_cmpeq_epi32(value, _mm_set1_epi32(member)));
+            }
+            found |= static_cast<uint64_t>(static_cast<uint32_t>(
+                         _mm_movemask_ps(_mm_castsi128_ps(equal)))) << lane;
+        }
+        mask[row / 64] &= negate ? ~found : found;
+    }
+#endif
+
+    for (; row < count; row++) {
+        if ((ranges::find(set, values[row]) != set.end()) == negate) {
+            mask[row / 64] &= ~(uint64_t{1} << (row % 64));
+        }
+    }
+}
+
+/**
+ * Turn a row mask into row numbers
+ *
+ * @param mask One bit per row, 64 rows per word
+ * @param count Number of rows
+ * @param base Number of the first row
+ * @param rows Receives the numbers of the rows whose bits are set
+ */
+void compactMask(const uint64_t* mask, const size_t count, const uint32_t base, vector<uint32_t>* rows) {
+    for (size_t word = 0; word * 64 < count; word++) {
+        for (uint64_t bits = mask[word]; bits != 0; bits &= bits - 1) {
+            rows->push_back(base + static_cast<uint32_t>(word * 64 + countr_zero(bits)));
+        }
+    }
+}
+
+//============================================================================
+// Sort Orders
+//============================================================================
+
+/**
+ * Orders a course listing can be printed in
+ * Number is the tree's own order; the others are precomputed permutations.
+ */
+enum class SortOrder { Number, Title, Level, Depth };
+
+/**
+ * Parse the name of a sort order
+ *
+ * @param name number, title, level or depth
+ * @param order Receives the order
+ * @return true if the name is known
+ */
+bool parseSortOrder(const string_view name, SortOrder* order) {
+    static constexpr pair<string_view, SortOrder> names[] = {
+        {"number", SortOrder::Number}, {"title", SortOrder::Title},
+        {"level", SortOrder::Level}, {"depth", SortOrder::Depth}};
+    const auto found = ranges::find(names, name, [](const auto& entry) { return entry.first; });
+    if (found == ranges::end(names)) {
+        return false;
+    }
+    *order = found->second;
+    return true;
+}
+
+/**
+ * Sort course rows on every core
+ * Each thread sorts one slice, then neighbouring slices are merged in
+ * parallel rounds.
+ *
+ * @param rows Row numbers to sort
+ * @param less Strict weak ordering on row numbers
+ */
+template <typename Less>
+void parallelSort(vector<uint32_t>& rows, Less less) {
+    constexpr size_t minimumSlice = 65536;
+    const size_t slices = clamp<size_t>(rows.size() / minimumSlice, 1, max(1u, thread::hardware_concurrency()));
+    vector<size_t> bounds(slices + 1);
+    for (size_t i = 0; i <= slices; i++) {
+        bounds[i] = rows.size() * i / slices;
+    }
+
+    const auto runAll = [](const size_t count, const auto& task) {
+        vector<thread> workers;
+        for (size_t i = 1; i < count; i++) {
+            workers.emplace_back(task, i);
+        }
+        if (count > 0) {
+            task(0);
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    };
+
+    runAll(slices, [&](const size_t slice) {
+        sort(rows.begin() + bounds[slice], rows.begin() + bounds[slice + 1], less);
+    });
+    for (size_t width = 1; width < slices; width *= 2) {
+        runAll((slices + 2 * width - 1) / (2 * width), [&](const size_t pair) {
+            const size_t left = pair * 2 * width;
+            if (left + width < slices) {
+                inplace_merge(rows.begin() + bounds[left], rows.begin() + bounds[left + width],
+                              rows.begin() + bounds[min(left + 2 * width, slices)], less);
+            }
+        });
+    }
+}
+
+/**
+ * Precomputed listing orders over the courses in sorted course order
+ * Each order is a permutation of row numbers built once after loading,
+ * so any listing streams out in O(n) with no sort per request.
+ */
+class CourseOrders final {
+    array<vector<uint32_t>, 3> permutations;
+    vector<uint32_t> depths;
+
+    void computeDepths(const vector<const Course*>& courses, const EquivalencyTable& equivalencies);
+
+public:
+    void Build(const vector<const Course*>& courses, const CourseColumns& columns,
+               const EquivalencyTable& equivalencies);
+    [[nodiscard]] uint32_t RowAt(SortOrder order, size_t position) const;
+    [[nodiscard]] uint32_t Depth(uint32_t row) const;
+};
+
+/**
+ * Build every order
+ * Ties are broken by course number, so each order is deterministic.
+ *
+ * @param courses The courses in course number order
+ * @param columns Parsed department and level of every course
+ * @param equivalencies The frozen equivalency table, to follow prerequisites
+ */
+void CourseOrders::Build(const vector<const Course*>& courses, const CourseColumns& columns,
+                         const EquivalencyTable& equivalencies) {
+    computeDepths(courses, equivalencies);
+
+    const int32_t* departments = columns.Values(CourseColumns::Department);
+    const int32_t* levels = columns.Values(CourseColumns::Level);
+    const auto build = [&](const SortOrder order, const auto& less) {
+        vector<uint32_t>& rows = permutations[static_cast<size_t>(order) - 1];
+        rows.resize(courses.size());
+        for (uint32_t row = 0; row < courses.size(); row++) {
+            rows[row] = row;
+        }
+        parallelSort(rows, less);
+    };
+
+    // Titles are decoded once rather than on every comparison
+    vector<string> titles(courses.size());
+    for (uint32_t row = 0; row < courses.size(); row++) {
+        titles[row] = courses[row]->courseTitle.Text();
+    }
+    build(SortOrder::Title, [&](const uint32_t a, const uint32_t b) {
+        const int compared = titles[a].compare(titles[b]);
+        return compared != 0 ? compared < 0 : a < b;
+    });
+    build(SortOrder::Level, [&](const uint32_t a, const uint32_t b) {
+        return tie(departments[a], levels[a], a) < tie(departments[b], levels[b], b);
+    });
+    build(SortOrder::Depth, [&](const uint32_t a, const uint32_t b) {
+        return tie(depths[a], a) < tie(depths[b], b);
+    });
+}
+
+// Find the longest chain of prerequisites below each course. The walk uses
+// an explicit stack so long chains cannot overflow the call stack, and a
+// prerequisite cycle is cut where it closes.
+void CourseOrders::computeDepths(const vector<const Course*>& courses,
+                                 const EquivalencyTable& equivalencies) {
+    constexpr uint32_t unvisited = numeric_limits<uint32_t>::max();
+    constexpr uint32_t inProgress = unvisited - 1;
+
+    vector<int32_t> classRows(equivalencies.Size(), -1);
+    for (uint32_t row = 0; row < courses.size(); row++) {
+        classRows[courses[row]->equivalenceClass] = static_cast<int32_t>(row);
+    }
+
+    depths.assign(courses.size(), unvisited);
+    vector<pair<uint32_t, size_t>> stack;
+    for (uint32_t start = 0; start < courses.size(); start++) {
+        if (depths[start] != unvisited) {
+            continue;
+        }
+        depths[start] = inProgress;
+        stack.emplace_back(start, 0);
+
+        while (!stack.empty()) {
+            auto& [row, next] = stack.back();
+            const pmr::vector<int>& prerequisites = courses[row]->prerequisiteClasses;
+            if (next < prerequisites.size()) {
+                const int32_t child = classRows[prerequisites[next++]];
+                if (child >= 0 && depths[child] == unvisited) {
+                    depths[child] = inProgress;
+                    stack.emplace_back(child, 0);
+                }
+                continue;
+            }
+
+            uint32_t depth = 0;
+            for (const int classId : prerequisites) {
+                const int32_t child = classRows[classId];
+                if (child >= 0 && depths[child] != inProgress) {
+                    depth = max(depth, depths[child] + 1);
+                }
+            }
+            depths[row] = depth;
+            stack.pop_back();
+        }
+    }
+}
+
+/**
+ * Get the row at one position of an order
+ *
+ * @param order The listing order
+ * @param position Position in the listing
+ * @return Row number in course number order
+ */
+uint32_t CourseOrders::RowAt(const SortOrder order, const size_t position) const {
+    if (order == SortOrder::Number) {
+        return static_cast<uint32_t>(position);
+    }
+    return permutations[static_cast<size_t>(order) - 1][position];
+}
+
+/**
+ * Get the length of the longest prerequisite chain below a course
+ *
+ * @param row Row number in course number order
+ */
+uint32_t CourseOrders::Depth(const uint32_t row) const {
+    return depths[row];
+}
+
+//============================================================================
+// Prerequisite Graph
+//============================================================================
+
+/**
+ * Many short sorted lists of integers below a common bound, each
+ * Elias-Fano coded into one shared bit stream
+ * A list of c values below u keeps the low l = floor(log2(u / c)) bits of
+ * each value packed side by side, then the high parts as gaps in unary,
+ * for at most 2 + l bits per value. Values are decoded in order by
+ * scanning the unary part a word at a time.
+ */
+class EliasFanoLists final {
+    vector<uint64_t> bits;
+    PackedInts starts;
+    PackedInts counts;
+    uint64_t universe = 0;
+
+    [[nodiscard]] unsigned lowWidth(uint64_t count) const;
+    [[nodiscard]] uint64_t read(size_t position, unsigned width) const;
+    [[nodiscard]] bool bit(size_t position) const;
+
+public:
+    /**
+     * Position inside one list, for decoding a value at a time
+     */
+    struct Cursor {
+        size_t lows = 0;
+        size_t position = 0;
+        uint64_t high = 0;
+        size_t index = 0;
+        size_t count = 0;
+        unsigned width = 0;
+    };
+
+    void Build(const vector<vector<uint32_t>>& lists, uint64_t bound);
+    [[nodiscard]] size_t Count(size_t list) const;
+    [[nodiscard]] bool Contains(size_t list, uint32_t value) const;
+    [[nodiscard]] size_t Bytes() const;
+
+    /**
+     * Get a cursor before the first value of a list
+     *
+     * @param list Index of the list
+     */
+    [[nodiscard]] Cursor Begin(const size_t list) const {
+        Cursor cursor;
+        cursor.count = counts.Get(list);
+        cursor.width = lowWidth(cursor.count);
+        cursor.lows = starts.Get(list);
+        cursor.position = cursor.lows + cursor.count * cursor.width;
+        return cursor;
+    }
+
+    /**
+     * Decode the next value of a list
+     *
+     * @param cursor Cursor from Begin, advanced past the value
+     * @param value Receives the value
+     * @return false once every value has been read
+     */
+    bool Next(Cursor& cursor, uint32_t* value) const {
+        if (cursor.index == cursor.count) {
+            return false;
+        }
+        // Skip the zeros before the next set bit, a word at a time
+        while (true) {
+            const uint64_t word = bits[cursor.position / 64] >> (cursor.position % 64);
+            if (word != 0) {
+                const auto skip = static_cast<unsigned>(countr_zero(word));
+                cursor.high += skip;
+                cursor.position += skip + 1;
+                break;
+            }
+            cursor.high += 64 - cursor.position % 64;
+            cursor.position += 64 - cursor.position % 64;
+        }
+        *value = static_cast<uint32_t>((cursor.high << cursor.width) |
+                                       read(cursor.lows + cursor.index * cursor.width, cursor.width));
+        cursor.index++;
+        return true;
+    }
+
+    /**
+     * Visit the values of one list in increasing order
+     *
+     * @param list Index of the list
+     * @param visit Callable invoked with each value
+     */
+    template <typename Visitor>
+    void ForEach(const size_t list, Visitor visit) const {
+        Cursor cursor = Begin(list);
+        uint32_t value;
+        while (Next(cursor, &value)) {
+            visit(value);
+        }
+    }
+};
+
+// Bits kept verbatim per value for a list of this length
+unsigned EliasFanoLists::lowWidth(const uint64_t count) const {
+    return count == 0 || universe <= count ? 0 : static_cast<unsigned>(bit_width(universe / count)) - 1;
+}
+
+// Read width bits starting at a bit position
+uint64_t EliasFanoLists::read(const size_t position, const unsigned width) const {
+    if (width == 0) {
+        return 0;
+    }
+    uint64_t value = bits[position / 64] >> (position % 64);
+    if (position % 64 + width > 64) {
+        value |= bits[position / 64 + 1] << (64 - position % 64);
+    }
+    return value & ((uint64_t{1} << width) - 1);
+}
+
+// Read one bit
+bool EliasFanoLists::bit(const size_t position) const {
+    return (bits[position / 64] >> (position % 64)) & 1;
+}
+
+/**
+ * Encode every list
+ *
+ * @param lists Lists of distinct values in increasing order
+ * @param bound Every value is below this
+ */
+void EliasFanoLists::Build(const vector<vector<uint32_t>>& lists, const uint64_t bound) {
+    universe = bound;
+    bits.clear();
+    size_t size = 0;
+    auto append = [&](const uint64_t value, const unsigned width) {
+        for (unsigned i = 0; i < width; i++, size++) {
+            if (size % 64 == 0) {
+                bits.push_back(0);
+            }
+            bits.back() |= ((value >> i) & 1) << (size % 64);
+        }
+    };
+
+    vector<uint64_t> listStarts;
+    vector<uint64_t> listCounts;
+    for (const vector<uint32_t>& list : lists) {
+        listStarts.push_back(size);
+        listCounts.push_back(list.size());
+        const unsigned width = lowWidth(list.size());
+        for (const uint32_t value : list) {
+            append(value, width);
+        }
+        uint64_t high = 0;
+        for (const uint32_t value : list) {
+            for (; high < value >> width; high++) {
+                append(0, 1);
+            }
+            append(1, 1);
+        }
+    }
+
+    // One spare word so reads never run past the end
+    bits.push_back(0);
+    bits.shrink_to_fit();
+    starts.Build(listStarts);
+    counts.Build(listCounts);
+}
+
+/**
+ * Number of values in one list
+ *
+ * @param list Index of the list
+ */
+size_t EliasFanoLists::Count(const size_t list) const {
+    return counts.Get(list);
+}
+
+/**
+ * Check whether a list holds a value
+ * Only the values sharing the value's high part are compared.
+ *
+ * @param list Index of the list
+ * @param value Value to look for
+ * @return true if the list holds the value
+ */
+bool EliasFanoLists::Contains(const size_t list, const uint32_t value) const {
+    const size_t count = counts.Get(list);
+    const unsigned width = lowWidth(count);
+    const size_t lows = starts.Get(list);
+    const uint64_t target = value >> width;
+
+    // Pass the zeros that end the buckets below the value's bucket
+    size_t position = lows + count * width;
+    size_t index = 0;
+    for (uint64_t zeros = 0; zeros < target && index < count; position++) {
+        if (bit(position)) {
+            index++;
+        } else {
+            zeros++;
+        }
+    }
+
+    const uint64_t low = value & ((uint64_t{1} << width) - 1);
+    for (; index < count && bit(position); index++, position++) {
+        const uint64_t candidate = read(lows + index * width, width);
+        if (candidate >= low) {
+            return candidate == low;
+        }
+    }
+    return false;
+}
+
+/**
+ * Memory held by the encoded lists
+ */
+size_t EliasFanoLists::Bytes() const {
+    return bits.capacity() * sizeof(uint64_t) + starts.Bytes() + counts.Bytes();
+}
+
+/**
+ * Prerequisite graph of a catalog over compact integer ids
+ * Each course row lists the distinct equivalence classes it requires, and
+ * each class lists the rows that require it, both Elias-Fano coded. Rows
+ * are positions in course number order, as in the other catalog indexes.
+ * Classes are kept instead of courses so eligibility only needs the
+ * transcript's classes, even for prerequisites outside this catalog.
+ */
+class PrerequisiteGraph final {
+    static constexpr uint32_t none = numeric_limits<uint32_t>::max();
+
+    EliasFanoLists prerequisites;
+    EliasFanoLists dependents;
+    vector<uint32_t> classRows;
+    vector<uint32_t> rowClasses;
+
+public:
+    void Build(const vector<const Course*>& courses, const EquivalencyTable& equivalencies);
+    [[nodiscard]] const EliasFanoLists& Prerequisites() const;
+    [[nodiscard]] const EliasFanoLists& Dependents() const;
+    [[nodiscard]] bool RowOfClass(int classId, uint32_t* row) const;
+    [[nodiscard]] uint32_t ClassOfRow(uint32_t row) const;
+    [[nodiscard]] size_t Size() const;
+    [[nodiscard]] size_t Bytes() const;
+};
+
+/**
+ * Build both directions of the graph
+ *
+ * @param courses The courses in course number order
+ * @param equivalencies The frozen equivalency table
+ */
+void PrerequisiteGraph::Build(const vector<const Course*>& courses, const EquivalencyTable& equivalencies) {
+    const size_t classCount = equivalencies.Size();
+    classRows.assign(classCount, none);
+    rowClasses.resize(courses.size());
+
+    vector<vector<uint32_t>> required(courses.size());
+    vector<vector<uint32_t>> requiredBy(classCount);
+    for (uint32_t row = 0; row < courses.size(); row++) {
+        const Course& course = *courses[row];
+        rowClasses[row] = static_cast<uint32_t>(course.equivalenceClass);
+        if (equivalencies.CatalogCourseFor(course.equivalenceClass) == course.courseNumber) {
+            classRows[course.equivalenceClass] = row;
+        }
+
+        vector<uint32_t>& classes = required[row];
+        classes.assign(course.prerequisiteClasses.begin(), course.prerequisiteClasses.end());
+        ranges::sort(classes);
+        classes.erase(ranges::unique(classes).begin(), classes.end());
+        for (const uint32_t classId : classes) {
+            requiredBy[classId].push_back(row);
+        }
+    }
+
+    prerequisites.Build(required, classCount);
+    dependents.Build(requiredBy, courses.size());
+    classRows.shrink_to_fit();
+    rowClasses.shrink_to_fit();
+}
+
+/**
+ * Distinct prerequisite classes of each row
+ */
+const EliasFanoLists& PrerequisiteGraph::Prerequisites() const {
+    return prerequisites;
+}
+
+/**
+ * Rows requiring each class
+ */
+const EliasFanoLists& PrerequisiteGraph::Dependents() const {
+    return dependents;
+}
+
+/**
+ * Find the row of the catalog course standing for a class
+ *
+ * @param classId Equivalence class id
+ * @param row Receives the row
+ * @return false if the class has no course in this catalog
+ */
+bool PrerequisiteGraph::RowOfClass(const int classId, uint32_t* row) const {
+    *row = classRows[classId];
+    return *row != none;
+}
+
+/**
+ * Get the equivalence class of a row
+ *
+ * @param row Row number in course number order
+ */
+uint32_t PrerequisiteGraph::ClassOfRow(const uint32_t row) const {
+    return rowClasses[row];
+}
+
+/**
+ * Number of course rows
+ */
+size_t PrerequisiteGraph::Size() const {
+    return rowClasses.size();
+}
+
+/**
+ * Memory held by the graph
+ */
+size_t PrerequisiteGraph::Bytes() const {
+    return prerequisites.Bytes() + dependents.Bytes() +
+           (classRows.capacity() + rowClasses.capacity()) * sizeof(uint32_t);
+}
+
+//============================================================================
+// Catalog Definition
+//============================================================================
+
+/**
+ * A loaded catalog: the course tree plus its frozen equivalency table
+ * Query modes share one catalog between threads, so it is treated as
+ * read-only once loadCourses returns. The tree's nodes and everything
+ * their courses own (numbers, titles and prerequisite lists) come from
+ * the catalog's own arena, which is never shared while the tree is built.
+ * Dropping the catalog frees the arena in whole blocks without visiting
+ * a single node.
+ */
+struct Catalog {
+    TrackingResource memory;
+    pmr::monotonic_buffer_resource arena{&memory};
+    BinarySearchTree courses{&arena};
+    EquivalencyTable equivalencies;
+    CompletionIndex completions;
+    TitleIndex titles;
+    CourseColumns columns;
+    CourseOrders orders;
+    PrerequisiteGraph graph;
+    uint64_t version = 0;
+};
+
+/**
+ * Build the indexes derived from a catalog's courses
+ *
+ * @param catalog A catalog whose courses have been loaded
+ */
+void buildCatalogIndexes(Catalog* catalog) {
+    catalog->completions.Build(catalog->courses);
+    catalog->titles.Build(catalog->completions.Courses());
+    catalog->columns.Build(catalog->completions.Courses());
+    catalog->orders.Build(catalog->completions.Courses(), catalog->columns, catalog->equivalencies);
+    catalog->graph.Build(catalog->completions.Courses(), catalog->equivalencies);
+}
+
+/**
+ * Make a deep copy of a catalog
+ * All memory of the copy is allocated by the calling thread, so on a NUMA
+ * host it lands on that thread's node.
+ *
+ * @param source The catalog to copy
+ * @return The copy, with the same version
+ */
+shared_ptr<Catalog> copyCatalog(const Catalog& source) {
+    auto copy = make_shared<Catalog>();
+    copy->courses.CopyFrom(source.courses);
+    copy->equivalencies = source.equivalencies;
+    copy->version = source.version;
+    buildCatalogIndexes(copy.get());
+    copy->completions.InheritScores(source.completions);
+    return copy;
+}
+
+//============================================================================
+// Metrics
+//============================================================================
+
+/**
+ * Number of shards per metric; threads are spread across them round-robin
+ */
+constexpr size_t metricShards = 16;
+
+/**
+ * Number of QueryType values, which are declared with the query service
+ */
+constexpr size_t queryTypeCount = 7;
+
+/**
+ * Get the calling thread's metric shard
+ */
+size_t metricShard() {
+    static atomic<size_t> nextShard{0};
+    thread_local const size_t shard = nextShard++ % metricShards;
+    return shard;
+}
+
+/**
+ * Monotonic counter split into per-thread shards
+ * Each shard sits on its own cache line, so threads counting at the same
+ * time do not contend; reading sums the shards.
+ */
+class ShardedCounter final {
+    struct alignas(64) Shard {
+        atomic<uint64_t> value{0};
+    };
+
+    array<Shard, metricShards> shards;
+
+public:
+    void Add(uint64_t amount = 1);
+    [[nodiscard]] uint64_t Value() const;
+};
+
+/**
+ * Add to the counter
+ *
+ * @param amount Amount to add
+ */
+void ShardedCounter::Add(const uint64_t amount) {
+    shards[metricShard()].value.fetch_add(amount, memory_order_relaxed);
+}
+
+/**
+ * Get the counter's total
+ */
+uint64_t ShardedCounter::Value() const {
+    uint64_t total = 0;
+    for (const Shard& shard : shards) {
+        total += shard.value.load(memory_order_relaxed);
+    }
+    return total;
+}
+
+/**
+ * Latency histogram with fixed buckets, sharded like ShardedCounter
+ */
+class LatencyHistogram final {
+    static constexpr size_t bucketCount = 12;
+    static constexpr array<uint64_t, bucketCount> boundsNanos = {
+        1'000, 5'000, 10'000, 50'000, 100'000, 500'000, 1'000'000,
+        5'000'000, 10'000'000, 50'000'000, 250'000'000, 1'000'000'000};
+
+    // The last bucket counts observations above every bound
+    struct alignas(64) Shard {
+        array<atomic<uint64_t>, bucketCount + 1> buckets{};
+        atomic<uint64_t> sumNanos{0};
+    };
+
+    array<Shard, metricShards> shards;
+
+public:
+    void Observe(uint64_t nanos);
+    void Append(string& out, string_view name, string_view labels) const;
+};
+
+/**
+ * Record one observation
+ *
+ * @param nanos Observed duration in nanoseconds
+ */
+void LatencyHistogram::Observe(const uint64_t nanos) {
+    Shard& shard = shards[metricShard()];
+    const size_t bucket = static_cast<size_t>(ranges::lower_bound(boundsNanos, nanos) - boundsNanos.begin());
+    shard.buckets[bucket].fetch_add(1, memory_order_relaxed);
+    shard.sumNanos.fetch_add(nanos, memory_order_relaxed);
+}
+
+/**
+ * Append the histogram's samples in Prometheus text format
+ * Buckets are cumulative and bounds are in seconds.
+ *
+ * @param out Output buffer
+ * @param name Metric family name
+ * @param labels Extra labels such as type="course", or empty
+ */
+void LatencyHistogram::Append(string& out, const string_view name, const string_view labels) const {
+    array<uint64_t, bucketCount + 1> counts{};
+    uint64_t sum = 0;
+    for (const Shard& shard : shards) {
+        for (size_t i = 0; i <= bucketCount; i++) {
+            counts[i] += shard.buckets[i].load(memory_order_relaxed);
+        }
+        sum += shard.sumNanos.load(memory_order_relaxed);
+    }
+
+    const string prefix = labels.empty() ? string() : string(labels) + ',';
+    uint64_t cumulative = 0;
+    char bound[32];
+    for (size_t i = 0; i <= bucketCount; i++) {
+        cumulative += counts[i];
+        if (i < bucketCount) {
+            snprintf(bound, sizeof(bound), "%g", static_cast<double>(boundsNanos[i]) / 1e9);
+        } else {
+            strcpy(bound, "+Inf");
+        }
+        out += string(name) + "_bucket{" + prefix + "le=\"" + bound + "\"} " + to_string(cumulative) + '\n';
+    }
+
+    const string suffix = labels.empty() ? string() : '{' + string(labels) + '}';
+    snprintf(bound, sizeof(bound), "%.9f", static_cast<double>(sum) / 1e9);
+    out += string(name) + "_sum" + suffix + ' ' + bound + '\n';
+    out += string(name) + "_count" + suffix + ' ' + to_string(cumulative) + '\n';
+}
+
+/**
+ * Process-wide counters and histograms, exported in Prometheus format
+ * Query metrics are indexed by QueryType.
+ */
+struct PlannerMetrics {
+    array<ShardedCounter, queryTypeCount> queries;
+    array<LatencyHistogram, queryTypeCount> latency;
+    ShardedCounter loads;
+    LatencyHistogram loadDuration;
+};
+
+PlannerMetrics plannerMetrics;
+
+//============================================================================
+// Utility Functions
+//============================================================================
+
+/**
+ * Split a string by a delimiter
+ * Tokens are views into str, trimmed of whitespace, so str must outlive
+ * them; only the vector holding them is allocated, from resource.
+ *
+ * @param str The string to split
+ * @param delimiter The character to split on
+ * @param resource Supplies the vector's memory
+ * @return Vector of string tokens
+ */
+pmr::vector<string_view> tokenize(const string_view str, const char delimiter,
+                                  pmr::memory_resource* resource = pmr::get_default_resource()) {
+    pmr::vector<string_view> tokens(resource);
+    size_t start = 0;
+
+    while (start < str.size()) {
+        const size_t end = min(str.find(delimiter, start), str.size());
+        string_view token = str.substr(start, end - start);
+
+        // Trim whitespace from token
+        const size_t first = token.find_first_not_of(" \t\r\n");
+        token = first == string_view::npos
+                    ? string_view()
+                    : token.substr(first, token.find_last_not_of(" \t\r\n") - first + 1);
+        tokens.push_back(token);
+        start = end + 1;
+    }
+
+    return tokens;
+}
+
+//============================================================================
+// Catalog Snapshots
+//============================================================================
+
+/**
+ * Hash bytes with a fast non-cryptographic 64-bit hash
+ * Four independent multiply-rotate lanes consume 32 bytes per step, in
+ * the style of xxHash64, and a final avalanche mixes the lanes and tail.
+ *
+ * @param data Bytes to hash
+ * @return The hash
+ */
+uint64_t hashBytes(const string_view data) {
+    constexpr uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+    constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+    auto load = [&](const size_t at) {
+        uint64_t word;
+        memcpy(&word, data.data() + at, sizeof(word));
+        return word;
+    };
+    auto round = [&](const uint64_t lane, const uint64_t word) {
+        return rotl(lane + word * prime2, 31) * prime1;
+    };
+
+    uint64_t lanes[4] = {prime1 + prime2, prime2, 0, 0 - prime1};
+    size_t at = 0;
+    for (; at + 32 <= data.size(); at += 32) {
+        for (size_t lane = 0; lane < 4; lane++) {
+            lanes[lane] = round(lanes[lane], load(at + lane * 8));
+        }
+    }
+    uint64_t hash = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+    hash += data.size();
+    for (; at + 8 <= data.size(); at += 8) {
+        hash = rotl(hash ^ round(0, load(at)), 27) * prime1 + prime2;
+    }
+    for (; at < data.size(); at++) {
+        hash = rotl(hash ^ static_cast<uint8_t>(data[at]) * prime1, 11) * prime2;
+    }
+
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime1;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/**
+ * Get the default snapshot cache directory
+ * $XDG_CACHE_HOME/abcu-planner, else ~/.cache/abcu-planner; empty (no
+ * cache) when neither variable is set.
+ */
+string defaultSnapshotDirectory() {
+    if (const char* cache = getenv("XDG_CACHE_HOME"); cache != nullptr && *cache != '\0') {
+        return string(cache) + "/abcu-planner";
+    }
+    if (const char* home = getenv("HOME"); home != nullptr && *home != '\0') {
+        return string(home) + "/.cache/abcu-planner";
+    }
+    return string();
+}
+
+/**
+ * Content-addressed cache of parsed catalog files
+ * A snapshot holds a catalog's courses in file order, with their resolved
+ * classes, and its frozen equivalency table, and is named after the hash
+ * of the file's bytes and the duplicate policy, so identical files share
+ * one snapshot wherever they live. A small record per source path keeps
+ * the file's size, modification time and hash, so an unchanged file is
+ * not even read. Snapshots carry a checksum; a damaged one is ignored and
+ * rewritten.
+ */
+class SnapshotCache final {
+    static constexpr char magic[8] = {'A', 'B', 'C', 'U', 'S', 'N', 'P', '1'};
+
+    string directory;
+
+    // Writes snapshots one after another on a single background thread,
+    // started by the first save and drained before the process exits
+    class Writer final {
+        mutex lock;
+        condition_variable wake;
+        deque<pair<string, string>> queue;
+        bool stopping = false;
+        thread worker;
+
+        void run();
+
+    public:
+        ~Writer();
+        void Enqueue(string snapshotFile, string data);
+    };
+    static Writer writer;
+
+    [[nodiscard]] string recordPath(const string& filename) const;
+    static bool decode(string_view data, pmr::vector<Course>* courses, EquivalencyTable* equivalencies);
+
+public:
+    explicit SnapshotCache(string directory);
+    static bool readFile(const string& filename, string* content);
+    bool Locate(const string& filename, const string& variant, string* snapshotFile, string* content) const;
+    static bool Restore(const string& snapshotFile, pmr::vector<Course>* courses, EquivalencyTable* equivalencies);
+    static void Save(const string& snapshotFile, const pmr::vector<Course>& courses,
+                     const EquivalencyTable& equivalencies);
+};
+
+SnapshotCache::Writer SnapshotCache::writer;
+
+SnapshotCache::Writer::~Writer() {
+    {
+        lock_guard guard(lock);
+        stopping = true;
+    }
+    wake.notify_one();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+// Queue one encoded snapshot for writing
+void SnapshotCache::Writer::Enqueue(string snapshotFile, string data) {
+    {
+        lock_guard guard(lock);
+        queue.emplace_back(std::move(snapshotFile), std::move(data));
+        if (!worker.joinable()) {
+            worker = thread(&Writer::run, this);
+        }
+    }
+    wake.notify_one();
+}
+
+// Write queued snapshots to temporary files and rename them into place,
+// until stopped with nothing left to write
+void SnapshotCache::Writer::run() {
+    unique_lock guard(lock);
+    while (true) {
+        wake.wait(guard, [&] { return stopping || !queue.empty(); });
+        if (queue.empty()) {
+            return;
+        }
+        const auto [snapshotFile, data] = std::move(queue.front());
+        queue.pop_front();
+        guard.unlock();
+
+        error_code error;
+        filesystem::create_directories(filesystem::path(snapshotFile).parent_path(), error);
+        const string temporary =
+            snapshotFile + ".tmp" + to_string(chrono::steady_clock::now().time_since_epoch().count());
+        bool written;
+        {
+            ofstream out(temporary, ios::binary | ios::trunc);
+            written = static_cast<bool>(out.write(data.data(), static_cast<streamsize>(data.size())));
+        }
+        if (written) {
+            filesystem::rename(temporary, snapshotFile, error);
+        }
+        if (!written || error) {
+            filesystem::remove(temporary, error);
+        }
+        guard.lock();
+    }
+}
+
+/**
+ * Constructor
+ *
+ * @param directory Directory holding snapshots; created on first save
+ */
+SnapshotCache::SnapshotCache(string directory) : directory(std::move(directory)) {
+}
+
+// Path of the size/time/hash record for one source file
+string SnapshotCache::recordPath(const string& filename) const {
+    error_code error;
+    const filesystem::path absolute = filesystem::absolute(filename, error);
+    const string key = error ? filename : absolute.string();
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.source", static_cast<unsigned long long>(hashBytes(key)));
+    return directory + "/" + name;
+}
+
+/**
+ * Read a whole file into memory
+ *
+ * @param filename Path to the file
+ * @param content Receives the file's bytes
+ * @return false if the file cannot be opened
+ */
+bool SnapshotCache::readFile(const string& filename, string* content) {
+    ifstream file(filename, ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    ostringstream buffer;
+    buffer << file.rdbuf();
+    *content = std::move(buffer).str();
+    return true;
+}
+
+/**
+ * Find the snapshot name for a catalog file
+ * The file is only read when its size or modification time differ from
+ * the last time it was seen.
+ *
+ * @param filename Path to the catalog file
+ * @param variant Load settings that change the parsed result, kept apart
+ * @param snapshotFile Receives the path the snapshot has or would have
+ * @param content Receives the file's bytes if they had to be read
+ * @return false if the file cannot be read
+ */
+bool SnapshotCache::Locate(const string& filename, const string& variant, string* snapshotFile,
+                           string* content) const {
+    error_code error;
+    const uintmax_t size = filesystem::file_size(filename, error);
+    if (error) {
+        return false;
+    }
+    const auto modified = filesystem::last_write_time(filename, error).time_since_epoch().count();
+    if (error) {
+        return false;
+    }
+
+    const string record = recordPath(filename);
+    uint64_t hash = 0;
+    bool known = false;
+    {
+        ifstream in(record);
+        uintmax_t recordSize;
+        long long recordModified;
+        known = in >> recordSize >> recordModified >> hex >> hash && recordSize == size &&
+                recordModified == static_cast<long long>(modified);
+    }
+    if (!known) {
+        if (!readFile(filename, content)) {
+            return false;
+        }
+        hash = hashBytes(*content);
+        filesystem::create_directories(directory, error);
+        ofstream(record) << size << ' ' << static_cast<long long>(modified) << ' ' << hex << hash << endl;
+    }
+
+    char name[24];
+    snprintf(name, sizeof(name), "%016llx-", static_cast<unsigned long long>(hash));
+    *snapshotFile = directory + "/" + name + variant + ".snapshot";
+    return true;
+}
+
+// Decode a snapshot's body into courses and an equivalency table
+bool SnapshotCache::decode(string_view data, pmr::vector<Course>* courses, EquivalencyTable* equivalencies) {
+    if (data.size() < sizeof(magic) + sizeof(uint64_t) || data.substr(0, sizeof(magic)) != string_view(magic, sizeof(magic))) {
+        return false;
+    }
+    uint64_t checksum;
+    memcpy(&checksum, data.data() + data.size() - sizeof(checksum), sizeof(checksum));
+    data = data.substr(sizeof(magic), data.size() - sizeof(magic) - sizeof(checksum));
+    if (hashBytes(data) != checksum || !equivalencies->Restore(data)) {
+        return false;
+    }
+
+    const uint64_t classCount = equivalencies->Size();
+    uint64_t courseCount;
+    if (!readVarint(data, &courseCount) || courseCount > data.size()) {
+        return false;
+    }
+    courses->clear();
+    courses->resize(courseCount);
+    for (Course& course : *courses) {
+        string_view number;
+        string_view title;
+        uint64_t credits;
+        uint64_t classId;
+        uint64_t count;
+        if (!readField(data, &number) || !readField(data, &title) || !readVarint(data, &credits) ||
+            !readVarint(data, &classId) || classId >= classCount || !readVarint(data, &count) ||
+            count > data.size()) {
+            return false;
+        }
+        course.courseNumber = number;
+        course.courseTitle = CompressedTitle(title, courses->get_allocator());
+        course.credits = static_cast<int>(credits) - 1;
+        course.equivalenceClass = static_cast<int>(classId);
+        course.prerequisites.resize(count);
+        for (auto& prereq : course.prerequisites) {
+            string_view field;
+            if (!readField(data, &field)) {
+                return false;
+            }
+            prereq = field;
+        }
+        if (!readVarint(data, &count) || count > data.size()) {
+            return false;
+        }
+        course.prerequisiteClasses.resize(count);
+        for (int& prereqClass : course.prerequisiteClasses) {
+            if (!readVarint(data, &classId) || classId >= classCount) {
+                return false;
+            }
+            prereqClass = static_cast<int>(classId);
+        }
+    }
+    return data.empty();
+}
+
+/**
+ * Load a snapshot, mapping the file instead of copying it where possible
+ *
+ * @param snapshotFile Path from Locate
+ * @param courses Receives the courses in file order
+ * @param equivalencies Receives the frozen equivalency table
+ * @return false if there is no valid snapshot
+ */
+bool SnapshotCache::Restore(const string& snapshotFile, pmr::vector<Course>* courses,
+                            EquivalencyTable* equivalencies) {
+#ifdef __linux__
+    const int fd = open(snapshotFile.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat status {};
+    if (fstat(fd, &status) != 0 || status.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    const auto size = static_cast<size_t>(status.st_size);
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    madvise(mapped, size, MADV_SEQUENTIAL);
+    const bool restored = decode(string_view(static_cast<const char*>(mapped), size), courses, equivalencies);
+    munmap(mapped, size);
+#else
+    string data;
+    const bool restored = readFile(snapshotFile, &data) && decode(data, courses, equivalencies);
+#endif
+    if (!restored) {
+        equivalencies->Clear();
+        courses->clear();
+    }
+    return restored;
+}
+
+/**
+ * Write a snapshot in the background
+ * The snapshot is encoded before returning, so the caller may change the
+ * courses right away; only the disk write runs on the cache's writer
+ * thread. It is written to a temporary file and renamed, so readers never
+ * see half of it.
+ *
+ * @param snapshotFile Path from Locate
+ * @param courses The validated courses in file order
+ * @param equivalencies The frozen equivalency table
+ */
+void SnapshotCache::Save(const string& snapshotFile, const pmr::vector<Course>& courses,
+                         const EquivalencyTable& equivalencies) {
+    string body;
+    equivalencies.Save(body);
+    appendVarint(body, courses.size());
+    for (const Course& course : courses) {
+        appendField(body, course.courseNumber);
+        appendField(body, course.courseTitle.Text());
+        appendVarint(body, static_cast<uint64_t>(course.credits + 1));
+        appendVarint(body, static_cast<uint64_t>(course.equivalenceClass));
+        appendVarint(body, course.prerequisites.size());
+        for (const auto& prereq : course.prerequisites) {
+            appendField(body, prereq);
+        }
+        appendVarint(body, course.prerequisiteClasses.size());
+        for (const int classId : course.prerequisiteClasses) {
+            appendVarint(body, static_cast<uint64_t>(classId));
+        }
+    }
+
+    string data(magic, sizeof(magic));
+    data += body;
+    const uint64_t checksum = hashBytes(body);
+    data.append(reinterpret_cast<const char*>(&checksum), sizeof(checksum));
+
+    writer.Enqueue(snapshotFile, std::move(data));
+}
+
+//============================================================================
+// Course Loading
+//============================================================================
+
+/**
+ * How loadCourses treats a course number that appears more than once
+ */
+enum class DuplicatePolicy { Reject, FirstWins, LastWins };
+
+/**
+ * Settings for loading a catalog file
+ */
+struct LoadOptions {
+    DuplicatePolicy duplicates = DuplicatePolicy::Reject;
+    string frequencyFile;
+    string snapshotDirectory = defaultSnapshotDirectory();
+    bool memoryReport = false;
+};
+
+/**
+ * Parse a load option at args[i], advancing past its value
+ * Accepts "--duplicates reject|first|last", "--frequencies <file>",
+ * "--snapshot-cache <directory>|off" and "--memory-report".
+ *
+ * @param args Command-line arguments
+ * @param i Index of the option; left on its last argument when parsed
+ * @param options Receives the parsed setting
+ * @return true if args[i] was a valid load option
+ */
+bool parseLoadOption(const vector<string>& args, size_t& i, LoadOptions& options) {
+    if (args[i] == "--memory-report") {
+        options.memoryReport = true;
+        return true;
+    }
+    if (i + 1 >= args.size()) {
+        return false;
+    }
+    if (args[i] == "--frequencies") {
+        options.frequencyFile = args[++i];
+        return true;
+    }
+    if (args[i] == "--snapshot-cache") {
+        options.snapshotDirectory = args[++i] == "off" ? string() : args[i];
+        return true;
+    }
+    if (args[i] != "--duplicates") {
+        return false;
+    }
+
+    const string& policy = args[i + 1];
+    if (policy == "reject") {
+        options.duplicates = DuplicatePolicy::Reject;
+    } else if (policy == "first") {
+        options.duplicates = DuplicatePolicy::FirstWins;
+    } else if (policy == "last") {
+        options.duplicates = DuplicatePolicy::LastWins;
+    } else {
+        cout << "Error: Unknown duplicate policy " << policy
+             << " (expected reject, first or last)" << endl;
+        return false;
+    }
+    i++;
+    return true;
+}
+
+/**
+ * Read course data and check its basic structure
+ * This is the first pass of loadCourses: it parses every line, collects
+ * equivalencies and resolves duplicate course numbers, but does not check
+ * prerequisites.
+ *
+ * @param file Stream holding the course data
+ * @param courses Receives the courses in file order
+ * @param equivalencies Pointer to the table receiving course equivalencies
+ * @param options Duplicate handling and other load settings
+ * @return true if the data was read successfully, false otherwise
+ */
+bool readCourseStream(istream& file, pmr::vector<Course>* courses,
+                      EquivalencyTable* equivalencies, const LoadOptions& options) {
+    pmr::unordered_map<pmr::string, pair<size_t, int>> seen(courses->get_allocator().resource());
+    size_t duplicateCount = 0;
+    string line;
+    int lineNumber = 0;
+    courses->clear();
+    equivalencies->Clear();
+
+    // Each line's token list is returned to a pool and reused by the next
+    pmr::unsynchronized_pool_resource lineMemory(courses->get_allocator().resource());
+
+    // Read and validate basic structure
+    while (getline(file, line)) {
+        lineNumber++;
+
+        // Skip empty lines
+        if (line.empty()) {
+            continue;
+        }
+
+        // Equivalency group: merge every listed course into one class
+        if (line[0] == '=') {
+            pmr::vector<string_view> group = tokenize(string_view(line).substr(1), ',', &lineMemory);
+            erase(group, string_view());
+            if (group.size() < 2) {
+                cout << "Error: Line " << lineNumber << " has insufficient data" << endl;
+                cout << "Each equivalency must list at least two courses" << endl;
+                return false;
+            }
+            for (size_t i = 1; i < group.size(); i++) {
+                equivalencies->Merge(group[0], group[i]);
+            }
+            continue;
+        }
+
+        // Parse line into tokens
+        const pmr::vector<string_view> tokens = tokenize(line, ',', &lineMemory);
+
+        // Validate minimum number of fields
+        if (tokens.size() < 2) {
+            cout << "Error: Line " << lineNumber << " has insufficient data" << endl;
+            cout << "Each line must have at least course number and title" << endl;
+            return false;
+        }
+
+        // Create course object, its lists drawn from the same memory as courses
+        Course course(tokens[0], tokens[1], courses->get_allocator());
+
+        // Add prerequisites (if any) - skip empty strings
+        for (size_t i = 2; i < tokens.size(); i++) {
+            // An optional credits=N field gives the credit hours
+            if (tokens[i].starts_with("credits=")) {
+                const string_view value = tokens[i].substr(8);
+                if (value.empty() || value.size() > 4 ||
+                    !ranges::all_of(value, [](const char c) { return isdigit(static_cast<unsigned char>(c)) != 0; })) {
+                    cout << "Error: Line " << lineNumber << " has invalid credits " << value << endl;
+                    return false;
+                }
+                from_chars(value.data(), value.data() + value.size(), course.credits);
+            } else if (!tokens[i].empty()) {
+                // Only add non-empty prerequisites
+                course.prerequisites.emplace_back(tokens[i]);
+            }
+        }
+
+        // Resolve repeated course numbers before anything reaches the tree
+        const auto [previous, isNew] =
+            seen.try_emplace(course.courseNumber, courses->size(), lineNumber);
+        if (!isNew) {
+            duplicateCount++;
+            if (options.duplicates == DuplicatePolicy::Reject) {
+                cout << "Error: Line " << lineNumber << " duplicates course "
+                     << course.courseNumber << " from line "
+                     << previous->second.second << endl;
+                return false;
+            }
+            if (options.duplicates == DuplicatePolicy::LastWins) {
+                (*courses)[previous->second.first] = std::move(course);
+                previous->second.second = lineNumber;
+            }
+            continue;
+        }
+
+        // Store course and track valid course numbers
+        equivalencies->MarkCatalogCourse(course.courseNumber);
+        courses->push_back(std::move(course));
+    }
+
+    if (duplicateCount > 0) {
+        cout << "Resolved " << duplicateCount << " duplicate course number(s) ("
+             << (options.duplicates == DuplicatePolicy::FirstWins ? "first" : "last")
+             << " wins)." << endl;
+    }
+    return true;
+}
+
+/**
+ * Read a course file and check its basic structure
+ *
+ * @param filename Path to the course data file
+ * @param courses Receives the courses in file order
+ * @param equivalencies Pointer to the table receiving course equivalencies
+ * @param options Duplicate handling and other load settings
+ * @return true if the file was read successfully, false otherwise
+ */
+bool readCourseFile(const string& filename, pmr::vector<Course>* courses,
+                    EquivalencyTable* equivalencies, const LoadOptions& options) {
+    ifstream file(filename);
+
+    // Check if file opened successfully
+    if (!file.is_open()) {
+        cout << "Error: Could not open file " << filename << endl;
+        return false;
+    }
+    return readCourseStream(file, courses, equivalencies, options);
+}
+
+/**
+ * Resolve and check every course's prerequisites
+ * This is the second pass of loadCourses. It freezes the equivalency
+ * table and records each course's class and prerequisite classes.
+ *
+ * @param courses Courses from readCourseStream
+ * @param equivalencies The table filled by readCourseStream
+ * @return true if every prerequisite names a catalog course
+ */
+bool resolvePrerequisites(pmr::vector<Course>* courses, EquivalencyTable* equivalencies) {
+    equivalencies->Freeze();
+
+    // Second pass: Validate prerequisites exist and resolve their classes
+    for (auto& course : *courses) {
+        course.equivalenceClass = equivalencies->ClassOf(course.courseNumber);
+
+        for (const auto& prereq : course.prerequisites) {
+            // Skip empty prerequisites
+            if (prereq.empty()) {
+                continue;
+            }
+
+            // A prerequisite may name any course equivalent to a catalog course
+            const int classId = equivalencies->ClassOf(prereq);
+            if (classId < 0 || equivalencies->CatalogCourseFor(classId).empty()) {
+                cout << "Error: Prerequisite " << prereq << " for course "
+                     << course.courseNumber << " does not exist" << endl;
+                return false;
+            }
+            course.prerequisiteClasses.push_back(classId);
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Insert checked courses into the BST
+ * Courses go in by number, middle first, so the tree stays shallow even
+ * when the file lists them in sorted order.
+ *
+ * @param courses Courses in file order
+ * @param bst Pointer to the binary search tree
+ */
+void insertCourses(const pmr::vector<Course>& courses, BinarySearchTree* bst) {
+    vector<const Course*> sorted;
+    sorted.reserve(courses.size());
+    for (const Course& course : courses) {
+        sorted.push_back(&course);
+    }
+    ranges::sort(sorted, {}, [](const Course* course) -> const pmr::string& { return course->courseNumber; });
+    forEachMidpoint(sorted.size(), [&](const size_t i) { bst->Insert(*sorted[i]); });
+}
+
+/**
+ * Load course data into the BST
+ * Performs two-pass validation to ensure data integrity. Lines starting
+ * with '=' list groups of equivalent courses, e.g. "=CSCI100,PSU:CMPSC121".
+ * Duplicate course numbers are resolved during the first pass, so the tree
+ * never holds more than one node per course number.
+ *
+ * @param file Stream holding the course data
+ * @param source File name or other description shown in messages
+ * @param bst Pointer to the binary search tree
+ * @param equivalencies Pointer to the table receiving course equivalencies
+ * @param options Duplicate handling and other load settings
+ * @param snapshotFile Where to save a snapshot of the checked courses, or
+ *                     empty for none
+ * @return true if load successful, false otherwise
+ */
+bool loadCourses(istream& file, const string& source, BinarySearchTree* bst,
+                 EquivalencyTable* equivalencies, const LoadOptions& options = {},
+                 const string& snapshotFile = string()) {
+    cout << "Loading course data from " << source << "..." << endl;
+
+    // Temporaries come from one arena, released at once when the load ends
+    TrackingResource scratchMemory;
+    pmr::monotonic_buffer_resource scratch(&scratchMemory);
+    pmr::vector<Course> courses(&scratch);
+
+    // First pass: Read and validate basic structure
+    if (!readCourseStream(file, &courses, equivalencies, options)) {
+        return false;
+    }
+    scratchMemory.Mark("parse");
+    if (!resolvePrerequisites(&courses, equivalencies)) {
+        return false;
+    }
+    scratchMemory.Mark("resolve");
+    if (!snapshotFile.empty()) {
+        SnapshotCache::Save(snapshotFile, courses, *equivalencies);
+    }
+
+    // All validation passed - load into BST
+    insertCourses(courses, bst);
+
+    cout << "Successfully loaded " << courses.size() << " courses." << endl;
+    if (options.memoryReport) {
+        scratchMemory.Report(cout, "Loader scratch");
+    }
+    return true;
+}
+
+/**
+ * Load courses from a file into the BST
+ * Unless options.snapshotDirectory is empty, a parsed copy of the file is
+ * kept there and reused while the file's contents stay the same.
+ *
+ * @param filename Path to the course data file
+ * @param bst Pointer to the binary search tree
+ * @param equivalencies Pointer to the table receiving course equivalencies
+ * @param options Duplicate handling and other load settings
+ * @return true if load successful, false otherwise
+ */
+bool loadCourses(const string& filename, BinarySearchTree* bst,
+                 EquivalencyTable* equivalencies, const LoadOptions& options = {}) {
+    string snapshotFile;
+    string content;
+    const SnapshotCache cache(options.snapshotDirectory);
+    if (options.snapshotDirectory.empty() ||
+        !cache.Locate(filename, to_string(static_cast<int>(options.duplicates)), &snapshotFile, &content)) {
+        ifstream file(filename);
+        if (!file.is_open()) {
+            cout << "Error: Could not open file " << filename << endl;
+            return false;
+        }
+        return loadCourses(file, filename, bst, equivalencies, options);
+    }
+
+    TrackingResource scratchMemory;
+    pmr::monotonic_buffer_resource scratch(&scratchMemory);
+    pmr::vector<Course> courses(&scratch);
+    if (SnapshotCache::Restore(snapshotFile, &courses, equivalencies)) {
+        scratchMemory.Mark("snapshot");
+        cout << "Loading course data from " << filename << "..." << endl;
+        insertCourses(courses, bst);
+        cout << "Successfully loaded " << courses.size() << " courses from snapshot." << endl;
+        if (options.memoryReport) {
+            scratchMemory.Report(cout, "Loader scratch");
+        }
+        return true;
+    }
+
+    // No snapshot yet: parse the file, reading it only if Locate did not
+    if (content.empty() && !SnapshotCache::readFile(filename, &content)) {
+        cout << "Error: Could not open file " << filename << endl;
+        return false;
+    }
+    istringstream file(std::move(content));
+    return loadCourses(file, filename, bst, equivalencies, options, snapshotFile);
+}
+
+/**
+ * Read saved lookup counts into a catalog's popularity scores
+ * The file holds "courseNumber,count" lines; unknown courses are ignored.
+ *
+ * @param filename Path to the frequency file
+ * @param catalog The catalog to seed
+ * @return true if the file was read
+ */
+bool loadFrequencies(const string& filename, const Catalog& catalog) {
+    ifstream file(filename);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    string line;
+    while (getline(file, line)) {
+        const pmr::vector<string_view> tokens = tokenize(line, ',');
+        uint32_t score;
+        if (tokens.size() == 2 && !tokens[1].empty() && ranges::all_of(tokens[1], ::isdigit) &&
+            from_chars(tokens[1].data(), tokens[1].data() + tokens[1].size(), score).ec == errc()) {
+            catalog.completions.SetScore(tokens[0], score);
+        }
+    }
+    return true;
+}
+
+/**
+ * Write a catalog's lookup counts for the next run
+ * Courses that were never looked up are left out.
+ *
+ * @param filename Path to the frequency file
+ * @param catalog The catalog whose counts are saved
+ * @return true if the file was written
+ */
+bool saveFrequencies(const string& filename, const Catalog& catalog) {
+    ofstream file(filename);
+    if (!file.is_open()) {
+        cout << "Error: Could not write file " << filename << endl;
+        return false;
+    }
+
+    const vector<uint64_t> counts = catalog.completions.Popularity();
+    const vector<const Course*>& courses = catalog.completions.Courses();
+    for (size_t i = 0; i < courses.size(); i++) {
+        if (counts[i] > 0) {
+            file << courses[i]->courseNumber << ',' << counts[i] << '\n';
+        }
+    }
+    return true;
+}
+
+/**
+ * Reshape a catalog's tree around its recorded lookup counts
+ * Must not run while other threads read the catalog.
+ *
+ * @param catalog The catalog to rebuild
+ */
+void rebuildByPopularity(Catalog* catalog) {
+    const vector<uint64_t> counts = catalog->completions.Popularity();
+    const double before = catalog->courses.AverageDepth(counts);
+    catalog->courses.RebuildWeighted(counts);
+    const double after = catalog->courses.AverageDepth(counts);
+
+    cout << fixed << setprecision(2) << "Rebuilt index: average lookup depth "
+         << before << " -> " << after << endl;
+    cout.unsetf(ios::floatfield);
+}
+
+// Build a freshly loaded catalog's indexes, apply saved lookup counts and
+// record the load in plannerMetrics
+void finishCatalogLoad(Catalog* catalog, const LoadOptions& options,
+                       const chrono::steady_clock::time_point start) {
+    catalog->memory.Mark("courses");
+    if (options.memoryReport) {
+        catalog->memory.Report(cout, "Catalog arena");
+    }
+    buildCatalogIndexes(catalog);
+
+    if (!options.frequencyFile.empty() && loadFrequencies(options.frequencyFile, *catalog)) {
+        rebuildByPopularity(catalog);
+    }
+
+    plannerMetrics.loads.Add();
+    plannerMetrics.loadDuration.Observe(static_cast<uint64_t>(
+        chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count()));
+}
+
+/**
+ * Load catalog data and build its derived indexes
+ * With a frequency file, its counts seed popularity and the tree is
+ * rebuilt around them straight away. Successful loads are counted and
+ * timed in plannerMetrics.
+ *
+ * @param file Stream holding the course data
+ * @param source File name or other description shown in messages
+ * @param catalog Pointer to an empty catalog
+ * @param options Duplicate handling and other load settings
+ * @return true if load successful, false otherwise
+ */
+bool loadCatalog(istream& file, const string& source, Catalog* catalog, const LoadOptions& options) {
+    const auto start = chrono::steady_clock::now();
+    if (!loadCourses(file, source, &catalog->courses, &catalog->equivalencies, options)) {
+        return false;
+    }
+    finishCatalogLoad(catalog, options, start);
+    return true;
+}
+
+/**
+ * Load a catalog file and build its derived indexes
+ *
+ * @param filename Path to the course data file
+ * @param catalog Pointer to an empty catalog
+ * @param options Duplicate handling and other load settings
+ * @return true if load successful, false otherwise
+ */
+bool loadCatalog(const string& filename, Catalog* catalog, const LoadOptions& options) {
+    const auto start = chrono::steady_clock::now();
+    if (!loadCourses(filename, &catalog->courses, &catalog->equivalencies, options)) {
+        return false;
+    }
+    finishCatalogLoad(catalog, options, start);
+    return true;
+}
+
+/**
+ * Find the row of a course in course number order
+ *
+ * @param catalog The loaded catalog
+ * @param courseNumber Course number, upper case
+ * @param row Receives the row
+ * @return true if the course is in the catalog
+ */
+bool findCourseRow(const Catalog& catalog, const string_view courseNumber, uint32_t* row) {
+    const vector<const Course*>& courses = catalog.completions.Courses();
+    const auto found = ranges::lower_bound(courses, courseNumber, {},
+                                           [](const Course* course) -> string_view {
+                                               return course->courseNumber;
+                                           });
+    if (found == courses.end() || (*found)->courseNumber != courseNumber) {
+        return false;
+    }
+    *row = static_cast<uint32_t>(found - courses.begin());
+    return true;
+}
+
+/**
+ * Check whether completed classes satisfy every prerequisite of a course
+ *
+ * @param graph The catalog's prerequisite graph
+ * @param row Row of the course to check
+ * @param completed Flags indexed by equivalence class id
+ * @return true if the course can be taken
+ */
+bool isEligible(const PrerequisiteGraph& graph, const uint32_t row, const vector<char>& completed) {
+    bool eligible = true;
+    graph.Prerequisites().ForEach(row, [&](const uint32_t classId) { eligible &= completed[classId] != 0; });
+    return eligible;
+}
+
+/**
+ * Find every course the completed classes make available
+ * Each completed class credits the rows that require it, so no prerequisite
+ * list is decoded; the scans over every class and every row still make the
+ * work proportional to the size of the catalog.
+ *
+ * @param graph The catalog's prerequisite graph
+ * @param completed Flags indexed by equivalence class id
+ * @return Rows of the courses that can now be taken, in course number order,
+ *         leaving out courses the transcript already covers
+ */
+vector<uint32_t> eligibleRows(const PrerequisiteGraph& graph, const vector<char>& completed) {
+    vector<uint32_t> satisfied(graph.Size(), 0);
+    for (size_t classId = 0; classId < completed.size(); classId++) {
+        if (completed[classId]) {
+            graph.Dependents().ForEach(classId, [&](const uint32_t row) { satisfied[row]++; });
+        }
+    }
+
+    vector<uint32_t> rows;
+    for (uint32_t row = 0; row < satisfied.size(); row++) {
+        if (!completed[graph.ClassOfRow(row)] && satisfied[row] == graph.Prerequisites().Count(row)) {
+            rows.push_back(row);
+        }
+    }
+    return rows;
+}
+
+/**
+ * Collect the prerequisites of a course, deepest first
+ * The depth-first walk keeps an explicit stack of rows and their position
+ * in each prerequisite list, so a long chain cannot overflow the call stack.
+ *
+ * @param graph The catalog's prerequisite graph
+ * @param row Row of the course whose prerequisites are collected
+ * @param visited Flags indexed by equivalence class id
+ * @param order Receives the row of each prerequisite after its own prerequisites
+ */
+void collectClosure(const PrerequisiteGraph& graph, const uint32_t row,
+                    vector<char>& visited, vector<uint32_t>& order) {
+    const EliasFanoLists& prerequisites = graph.Prerequisites();
+    vector<pair<uint32_t, EliasFanoLists::Cursor>> stack;
+    stack.emplace_back(row, prerequisites.Begin(row));
+
+    while (!stack.empty()) {
+        auto& [current, next] = stack.back();
+        uint32_t classId;
+        if (prerequisites.Next(next, &classId)) {
+            if (visited[classId]) {
+                continue;
+            }
+            visited[classId] = 1;
+
+            uint32_t prereq;
+            if (graph.RowOfClass(static_cast<int>(classId), &prereq)) {
+                stack.emplace_back(prereq, prerequisites.Begin(prereq));
+            }
+            continue;
+        }
+
+        // Every prerequisite of this row is placed; the starting course is not
+        if (stack.size() > 1) {
+            order.push_back(current);
+        }
+        stack.pop_back();
+    }
+}
+
+/**
+ * Get every direct and indirect prerequisite of a course
+ * The result lists courses in an order they can be taken.
+ *
+ * @param catalog The loaded catalog
+ * @param row Row of the course to expand
+ * @return Rows of the prerequisite closure, excluding the course itself
+ */
+vector<uint32_t> prerequisiteClosure(const Catalog& catalog, const uint32_t row) {
+    vector<char> visited(catalog.equivalencies.Size(), 0);
+    vector<uint32_t> order;
+    visited[catalog.graph.ClassOfRow(row)] = 1;
+    collectClosure(catalog.graph, row, visited, order);
+    return order;
+}
+
+/**
+ * Resolve a transfer transcript and print the courses it makes available
+ * Each transcript entry costs one hash lookup; eligibility then only
+ * follows the prerequisite graph by class id.
+ *
+ * @param catalog Pointer to the loaded catalog
+ * @param transcript Comma-separated list of completed courses
+ */
+void printTransferEligibility(const Catalog* catalog, const string& transcript) {
+    const EquivalencyTable* equivalencies = &catalog->equivalencies;
+    vector<char> completed(equivalencies->Size(), 0);
+
+    cout << "Transfer credit:" << endl;
+    for (const string_view field : tokenize(transcript, ',')) {
+        if (field.empty()) {
+            continue;
+        }
+        const string entry = toUpperCase(field);
+
+        const int classId = equivalencies->ClassOf(entry);
+        if (classId < 0) {
+            cout << "  " << entry << " -> no known equivalent" << endl;
+            continue;
+        }
+        completed[classId] = 1;
+
+        const string_view equivalent = equivalencies->CatalogCourseFor(classId);
+        cout << "  " << entry << " -> "
+             << (equivalent.empty() ? "no ABCU equivalent" : equivalent) << endl;
+    }
+
+    cout << "\nEligible courses:" << endl;
+    const vector<const Course*>& courses = catalog->completions.Courses();
+    const vector<uint32_t> eligible = eligibleRows(catalog->graph, completed);
+    for (const uint32_t row : eligible) {
+        cout << "  " << courses[row]->courseNumber << ", " << courses[row]->courseTitle << endl;
+    }
+
+    if (eligible.empty()) {
+        cout << "  None" << endl;
+    }
+}
+
+/**
+ * Display the main menu
+ */
+void displayMenu() {
+    cout << "\n========================================" << endl;
+    cout << "Welcome to the course planner." << endl;
+    cout << "========================================" << endl;
+    cout << "  1. Load Data Structure" << endl;
+    cout << "  2. Print Course List" << endl;
+    cout << "  3. Print Course" << endl;
+    cout << "  4. Check Transfer Eligibility" << endl;
+    cout << "  5. Autocomplete Course" << endl;
+    cout << "  6. Optimize Index For Lookups" << endl;
+    cout << "  7. Filter Courses" << endl;
+    cout << "  8. Print Course List In Another Order" << endl;
+    cout << "\n  9. Exit" << endl;
+    cout << "========================================" << endl;
+    cout << "What would you like to do? ";
+}
+
+/**
+ * Clean up a course number typed at the menu
+ *
+ * @param courseNumber Raw input
+ * @return The first token, trimmed and in upper case
+ */
+string normalizeCourseNumber(string courseNumber) {
+    // Extract only the course number (first token before comma or space)
+    const size_t commaPos = courseNumber.find(',');
+    const size_t spacePos = courseNumber.find(' ');
+
+    if (const size_t endPos = min(commaPos, spacePos); endPos != string::npos) {
+        courseNumber = courseNumber.substr(0, endPos);
+    }
+
+    // Trim whitespace
+    courseNumber.erase(0, courseNumber.find_first_not_of(" \t\r\n"));
+    courseNumber.erase(courseNumber.find_last_not_of(" \t\r\n") + 1);
+
+    // Convert to uppercase for case-insensitive search
+    ranges::transform(courseNumber,
+                      courseNumber.begin(), ::toupper);
+    return courseNumber;
+}
+
+/**
+ * Print a course's number, title, credits and prerequisites
+ *
+ * @param course The course to print
+ */
+void printCourseDetails(const Course& course) {
+    cout << course.courseNumber << "," << course.courseTitle << endl;
+    if (course.credits >= 0) {
+        cout << "Credits: " << course.credits << endl;
+    }
+
+    // Print prerequisites
+    if (course.prerequisites.empty()) {
+        cout << "Prerequisites: None" << endl;
+    } else {
+        cout << "Prerequisites: ";
+        for (size_t i = 0; i < course.prerequisites.size(); i++) {
+            cout << course.prerequisites[i];
+            if (i < course.prerequisites.size() - 1) {
+                cout << ", ";
+            }
+        }
+        cout << endl;
+    }
+}
+
+/**
+ * Print information for a specific course including prerequisites
+ * Each successful lookup counts towards the course's popularity.
+ *
+ * @param catalog Pointer to the loaded catalog
+ * @param courseNumber Course number to search for
+ */
+void printCourse(const Catalog* catalog, string courseNumber) {
+    courseNumber = normalizeCourseNumber(courseNumber);
+    const Course course = catalog->courses.Search(courseNumber);
+
+    // Check if course was found
+    if (course.courseNumber.empty()) {
+        cout << "Course " << courseNumber << " not found." << endl;
+        return;
+    }
+    catalog->completions.Record(course.courseNumber);
+    printCourseDetails(course);
+}
+
+//============================================================================
+// Course Filters
+//============================================================================
+
+/**
+ * A compiled catalog filter such as: dept=CSCI level>=300 title~"data"
+ * Terms are ANDed together. Terms on department, level, credits and
+ * prerequisite count run as SIMD kernels over the catalog's integer
+ * columns; the rest are checked afterwards, one course at a time, on the
+ * rows that survive. Candidates come from whichever access path is
+ * smallest: a course number prefix range, the title trigram index or a
+ * full scan.
+ *
+ * Fields: dept, number, level, credits, prereq-count, prereq and title.
+ * Operators: = and != for every field, < <= > >= for level, credits and
+ * prereq-count, and ~ (contains, any case) for number and title. dept
+ * accepts a comma-separated list of departments.
+ */
+class CourseFilter final {
+    enum class Field { Level, Credits, PrereqCount, Department, Number, Prerequisite, Title };
+    enum class Op { Equal, NotEqual, Less, LessEqual, Greater, GreaterEqual, Contains };
+
+    struct Predicate {
+        Field field;
+        Op op;
+        string text;
+    };
+
+    // A test on one integer column: value in [low, high], or in the listed
+    // departments, inverted by negate
+    struct ColumnTerm {
+        CourseColumns::Column column;
+        int32_t low = 0;
+        int32_t high = 0;
+        bool negate = false;
+        vector<string> departments;
+    };
+
+    // A column term bound to one catalog's columns
+    struct ColumnTest {
+        const int32_t* values;
+        int32_t low;
+        int32_t high;
+        bool negate;
+        bool isSet;
+        vector<int32_t> set;
+    };
+
+    // Rows per unit of parallel work in a scan
+    static constexpr size_t chunkSize = 16384;
+
+    vector<Predicate> predicates;
+    vector<ColumnTerm> columnTerms;
+    string rangePrefix;
+    vector<string> titleTerms;
+
+    static bool containsIgnoreCase(string_view text, string_view term);
+    static bool passes(const ColumnTest& test, uint32_t row);
+    [[nodiscard]] bool matches(const Course& course) const;
+    [[nodiscard]] vector<ColumnTest> bind(const CourseColumns& columns) const;
+
+    // Split count items into chunks and call matchChunk(begin, end, out) on
+    // each in parallel; out holds the chunk's matches in order
+    template <typename ChunkMatcher>
+    static vector<const Course*> inParallel(const size_t count, ChunkMatcher matchChunk) {
+        const size_t chunks = (count + chunkSize - 1) / chunkSize;
+        vector<vector<const Course*>> matched(chunks);
+        atomic<size_t> nextChunk{0};
+
+        auto worker = [&] {
+            for (size_t chunk; (chunk = nextChunk.fetch_add(1, memory_order_relaxed)) < chunks;) {
+                matchChunk(chunk * chunkSize, min(count, (chunk + 1) * chunkSize), matched[chunk]);
+            }
+        };
+
+        const size_t workerCount = min<size_t>(max(1u, thread::hardware_concurrency()), chunks);
+        vector<thread> workers;
+        for (size_t i = 1; i < workerCount; i++) {
+            workers.emplace_back(worker);
+        }
+        worker();
+        for (auto& thread : workers) {
+            thread.join();
+        }
+
+        vector<const Course*> results;
+        for (const auto& part : matched) {
+            results.insert(results.end(), part.begin(), part.end());
+        }
+        return results;
+    }
+
+public:
+    bool Compile(const string& expression, string* error);
+    [[nodiscard]] vector<const Course*> Run(const Catalog& catalog, string* plan) const;
+};
+
+// Search for an upper-case term in text of any case without copying it
+bool CourseFilter::containsIgnoreCase(const string_view text, const string_view term) {
+    return ranges::search(text, term, [](const char a, const char b) {
+        return toupper(static_cast<unsigned char>(a)) == b;
+    }).begin() != text.end() || term.empty();
+}
+
+// Check one row against a column test without SIMD, with the same
+// treatment of missing values and empty ranges as andRangeMask
+bool CourseFilter::passes(const ColumnTest& test, const uint32_t row) {
+    const int32_t value = test.values[row];
+    if (test.isSet) {
+        return (ranges::find(test.set, value) != test.set.end()) != test.negate;
+    }
+    if (test.high < test.low || (test.negate && value < 0)) {
+        return false;
+    }
+    const bool inside = static_cast<uint32_t>(value) - static_cast<uint32_t>(test.low) <=
+                        static_cast<uint32_t>(test.high) - static_cast<uint32_t>(test.low);
+    return inside != test.negate;
+}
+
+/**
+ * Compile a filter expression
+ *
+ * @param expression Whitespace-separated terms; values containing spaces
+ *                   are written in double quotes
+ * @param error Receives a description of the first problem
+ * @return true if the expression is valid
+ */
+bool CourseFilter::Compile(const string& expression, string* error) {
+    static constexpr pair<string_view, Op> operators[] = {
+        {"!=", Op::NotEqual}, {"<=", Op::LessEqual}, {">=", Op::GreaterEqual},
+        {"=", Op::Equal}, {"<", Op::Less}, {">", Op::Greater}, {"~", Op::Contains}};
+    static constexpr pair<string_view, Field> fields[] = {
+        {"dept", Field::Department}, {"number", Field::Number}, {"level", Field::Level},
+        {"credits", Field::Credits}, {"prereq-count", Field::PrereqCount},
+        {"prereq", Field::Prerequisite}, {"title", Field::Title}};
+
+    predicates.clear();
+    columnTerms.clear();
+    rangePrefix.clear();
+    titleTerms.clear();
+
+    size_t position = 0;
+    while (true) {
+        while (position < expression.size() && isspace(static_cast<unsigned char>(expression[position]))) {
+            position++;
+        }
+        if (position == expression.size()) {
+            break;
+        }
+
+        // Field name
+        const size_t nameStart = position;
+        while (position < expression.size() &&
+               (isalpha(static_cast<unsigned char>(expression[position])) || expression[position] == '-')) {
+            position++;
+        }
+        const string name = expression.substr(nameStart, position - nameStart);
+        const auto field = ranges::find(fields, name, [](const auto& entry) { return entry.first; });
+        if (field == ranges::end(fields)) {
+            *error = name.empty() ? "expected a field name at position " + to_string(nameStart)
+                                  : "unknown field '" + name + "'";
+            return false;
+        }
+
+        // Operator, longest first
+        const auto op = ranges::find_if(operators, [&](const auto& entry) {
+            return expression.compare(position, entry.first.size(), entry.first) == 0;
+        });
+        if (op == ranges::end(operators)) {
+            *error = "expected an operator after '" + name + "'";
+            return false;
+        }
+        position += op->first.size();
+
+        // Value, optionally quoted
+        string value;
+        if (position < expression.size() && expression[position] == '"') {
+            const size_t closing = expression.find('"', position + 1);
+            if (closing == string::npos) {
+                *error = "unterminated quote in value of '" + name + "'";
+                return false;
+            }
+            value = expression.substr(position + 1, closing - position - 1);
+            position = closing + 1;
+        } else {
+            while (position < expression.size() && !isspace(static_cast<unsigned char>(expression[position]))) {
+                value += expression[position++];
+            }
+        }
+        if (value.empty()) {
+            *error = "missing value for '" + name + "'";
+            return false;
+        }
+
+        Predicate predicate{field->second, op->second, toUpperCase(value)};
+        const bool numeric = predicate.field == Field::Level || predicate.field == Field::Credits ||
+                             predicate.field == Field::PrereqCount;
+        if (numeric) {
+            if (predicate.op == Op::Contains || value.size() > 9 ||
+                !ranges::all_of(value, [](const char c) { return isdigit(static_cast<unsigned char>(c)) != 0; })) {
+                *error = "'" + name + "' takes =, !=, <, <=, > or >= and a whole number";
+                return false;
+            }
+
+            // Every comparison becomes a range test. Missing values are
+            // stored as -1, so ranges start at 0 to leave them out
+            static constexpr int32_t lowest = 0;
+            static constexpr int32_t highest = numeric_limits<int32_t>::max();
+            const int32_t number = stoi(value);
+            ColumnTerm term;
+            term.column = predicate.field == Field::Level     ? CourseColumns::Level
+                          : predicate.field == Field::Credits ? CourseColumns::Credits
+                                                              : CourseColumns::PrereqCount;
+            term.negate = predicate.op == Op::NotEqual;
+            switch (predicate.op) {
+                case Op::Less: term.low = lowest; term.high = number - 1; break;
+                case Op::LessEqual: term.low = lowest; term.high = number; break;
+                case Op::Greater: term.low = number + 1; term.high = highest; break;
+                case Op::GreaterEqual: term.low = number; term.high = highest; break;
+                default: term.low = number; term.high = number; break;
+            }
+            columnTerms.push_back(std::move(term));
+            continue;
+        }
+
+        if (predicate.op != Op::Equal && predicate.op != Op::NotEqual &&
+            !(predicate.op == Op::Contains &&
+              (predicate.field == Field::Number || predicate.field == Field::Title))) {
+            *error = "operator " + string(op->first) + " cannot be used with '" + name + "'";
+            return false;
+        }
+
+        if (predicate.field == Field::Department) {
+            ColumnTerm term;
+            term.column = CourseColumns::Department;
+            term.negate = predicate.op == Op::NotEqual;
+            for (const string_view department : tokenize(predicate.text, ',')) {
+                if (!department.empty()) {
+                    term.departments.emplace_back(department);
+                }
+            }
+            if (!term.negate && term.departments.size() == 1 && predicate.text.size() > rangePrefix.size()) {
+                rangePrefix = predicate.text;
+            }
+            columnTerms.push_back(std::move(term));
+            continue;
+        }
+
+        // Note the terms an index can answer
+        if (predicate.op == Op::Equal && predicate.field == Field::Number &&
+            predicate.text.size() > rangePrefix.size()) {
+            rangePrefix = predicate.text;
+        }
+        if (predicate.field == Field::Title && predicate.op != Op::NotEqual &&
+            predicate.text.size() >= TitleIndex::minimumLength) {
+            titleTerms.push_back(predicate.text);
+        }
+        predicates.push_back(std::move(predicate));
+    }
+
+    if (predicates.empty() && columnTerms.empty()) {
+        *error = "empty filter";
+        return false;
+    }
+
+    // Exact comparisons before substring searches
+    ranges::stable_sort(predicates, {}, &Predicate::field);
+    return true;
+}
+
+// Check the predicates that have no column against one course
+bool CourseFilter::matches(const Course& course) const {
+    thread_local string title;
+    bool decoded = false;
+    for (const Predicate& predicate : predicates) {
+        bool result = false;
+        switch (predicate.field) {
+            case Field::Number:
+                result = predicate.op == Op::Contains
+                             ? containsIgnoreCase(course.courseNumber, predicate.text)
+                             : (course.courseNumber == string_view(predicate.text)) == (predicate.op == Op::Equal);
+                break;
+            case Field::Prerequisite:
+                result = (ranges::find(course.prerequisites, string_view(predicate.text)) != course.prerequisites.end()) ==
+                         (predicate.op == Op::Equal);
+                break;
+            case Field::Title:
+                if (!decoded) {
+                    title.clear();
+                    course.courseTitle.AppendTo(title);
+                    decoded = true;
+                }
+                result = predicate.op == Op::Contains
+                             ? containsIgnoreCase(title, predicate.text)
+                             : (title.size() == predicate.text.size() &&
+                                containsIgnoreCase(title, predicate.text)) ==
+                                   (predicate.op == Op::Equal);
+                break;
+            default:
+                result = true;
+                break;
+        }
+        if (!result) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Resolve column terms against a catalog's columns and department numbers
+vector<CourseFilter::ColumnTest> CourseFilter::bind(const CourseColumns& columns) const {
+    vector<ColumnTest> tests;
+    for (const ColumnTerm& term : columnTerms) {
+        ColumnTest test{columns.Values(term.column), term.low, term.high, term.negate,
+                        term.column == CourseColumns::Department, {}};
+        for (const string& department : term.departments) {
+            if (const int32_t id = columns.DepartmentId(department); id >= 0) {
+                test.set.push_back(id);
+            }
+        }
+        tests.push_back(std::move(test));
+    }
+    return tests;
+}
+
+/**
+ * Find every course matching the filter
+ *
+ * @param catalog The loaded catalog
+ * @param plan Receives a description of the access path used
+ * @return Matching courses in course number order
+ */
+vector<const Course*> CourseFilter::Run(const Catalog& catalog, string* plan) const {
+    const vector<const Course*>& courses = catalog.completions.Courses();
+    const vector<ColumnTest> tests = bind(catalog.columns);
+
+    // Course numbers sharing a prefix are contiguous in sorted order
+    size_t first = 0;
+    size_t last = courses.size();
+    *plan = "full scan";
+    if (!rangePrefix.empty()) {
+        const auto byNumber = [](const Course* course) -> string_view { return course->courseNumber; };
+        const auto begin = ranges::lower_bound(courses, string_view(rangePrefix), {}, byNumber);
+        const auto end = partition_point(begin, courses.end(), [&](const Course* course) {
+            return course->courseNumber.starts_with(rangePrefix);
+        });
+        first = begin - courses.begin();
+        last = end - courses.begin();
+        *plan = "prefix range " + rangePrefix;
+    }
+
+    // Use the title index instead if its shortest posting list is smaller
+    const string* bestTerm = nullptr;
+    size_t bestEstimate = last - first;
+    for (const string& term : titleTerms) {
+        if (const size_t estimate = catalog.titles.Estimate(term); estimate < bestEstimate) {
+            bestTerm = &term;
+            bestEstimate = estimate;
+        }
+    }
+
+    if (bestTerm != nullptr) {
+        const vector<uint32_t> candidates = catalog.titles.Candidates(*bestTerm);
+        *plan = "title index \"" + *bestTerm + "\"";
+        *plan += ", " + to_string(candidates.size()) + " candidates";
+        return inParallel(candidates.size(), [&](const size_t begin, const size_t end,
+                                                  vector<const Course*>& out) {
+            for (size_t i = begin; i < end; i++) {
+                const uint32_t row = candidates[i];
+                if (ranges::all_of(tests, [&](const ColumnTest& test) { return passes(test, row); }) &&
+                    matches(*courses[row])) {
+                    out.push_back(courses[row]);
+                }
+            }
+        });
+    }
+
+    // Scan the range a mask word at a time, then check the survivors
+    *plan += ", " + to_string(last - first) + " candidates";
+    return inParallel(last - first, [&](const size_t begin, const size_t end, vector<const Course*>& out) {
+        const size_t count = end - begin;
+        const auto base = static_cast<uint32_t>(first + begin);
+        array<uint64_t, chunkSize / 64> mask;
+        mask.fill(~uint64_t{0});
+        if (count % 64 != 0) {
+            mask[count / 64] = (uint64_t{1} << (count % 64)) - 1;
+        }
+
+        for (const ColumnTest& test : tests) {
+            if (test.isSet) {
+                andSetMask(test.values + base, count, test.set, test.negate, mask.data());
+            } else {
+                andRangeMask(test.values + base, count, test.low, test.high, test.negate, mask.data());
+            }
+        }
+
+        vector<uint32_t> rows;
+        compactMask(mask.data(), count, base, &rows);
+        for (const uint32_t row : rows) {
+            if (matches(*courses[row])) {
+                out.push_back(courses[row]);
+            }
+        }
+    });
+}
+
+//============================================================================
+// NUMA Topology
+//============================================================================
+
+// NUMA node of the current query thread, used to pick its catalog replica
+thread_local size_t queryNode = 0;
+
+/**
+ * Parse a Linux CPU list such as "0-3,8-11"
+ *
+ * @param list The CPU list text
+ * @return The CPU numbers
+ */
+vector<int> parseCpuList(const string& list) {
+    vector<int> cpus;
+    for (const string_view field : tokenize(list, ',')) {
+        if (field.empty()) {
+            continue;
+        }
+        const string range(field);
+        const size_t dash = range.find('-');
+        const int first = atoi(range.c_str());
+        const int last = dash == string::npos ? first : atoi(range.c_str() + dash + 1);
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+/**
+ * Find the CPUs of each NUMA node
+ * Falls back to a single node holding every CPU when sysfs is unavailable.
+ *
+ * @return CPU numbers indexed by node
+ */
+vector<vector<int>> detectNumaNodes() {
+    vector<vector<int>> nodes;
+    for (int node = 0;; node++) {
+        ifstream file("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+        if (!file.is_open()) {
+            break;
+        }
+        string list;
+        getline(file, list);
+        if (vector<int> cpus = parseCpuList(list); !cpus.empty()) {
+            nodes.push_back(std::move(cpus));
+        }
+    }
+
+    if (nodes.empty()) {
+        nodes.emplace_back();
+        for (unsigned cpu = 0; cpu < max(1u, thread::hardware_concurrency()); cpu++) {
+            nodes.back().push_back(static_cast<int>(cpu));
+        }
+    }
+    return nodes;
+}
+
+/**
+ * Restrict the calling thread to a set of CPUs
+ *
+ * @param cpus CPU numbers the thread may run on
+ * @return true if the affinity was applied
+ */
+bool pinCurrentThread(const vector<int>& cpus) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const int cpu : cpus) {
+        CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+//============================================================================
+// Catalog Edits
+//============================================================================
+
+/**
+ * Write a course as a catalog file line
+ *
+ * @param course The course to write
+ * @return The line, without a newline
+ */
+string serializeCourse(const Course& course) {
+    string line(course.courseNumber);
+    line += ',';
+    course.courseTitle.AppendTo(line);
+    if (course.credits >= 0) {
+        line += ",credits=" + to_string(course.credits);
+    }
+    for (const auto& prereq : course.prerequisites) {
+        line += ',';
+        line += prereq;
+    }
+    return line;
+}
+
+/**
+ * Write a catalog in the catalog file format
+ * Equivalency groups come first. The course representing each class is
+ * written before the other courses, so loading the text picks the same
+ * representatives.
+ *
+ * @param catalog The catalog to write
+ * @return Catalog text that loads into an equal catalog
+ */
+string serializeCatalog(const Catalog& catalog) {
+    string text;
+    for (const vector<string>& group : catalog.equivalencies.Groups()) {
+        text += '=';
+        for (size_t i = 0; i < group.size(); i++) {
+            text += (i > 0 ? "," : "") + group[i];
+        }
+        text += '\n';
+    }
+
+    const vector<const Course*>& courses = catalog.completions.Courses();
+    for (const bool representatives : {true, false}) {
+        for (const Course* course : courses) {
+            const bool represents =
+                catalog.equivalencies.CatalogCourseFor(course->equivalenceClass) == course->courseNumber;
+            if (represents == representatives) {
+                text += serializeCourse(*course) + '\n';
+            }
+        }
+    }
+    return text;
+}
+
+/**
+ * Describe how one catalog differs from another as edit lines
+ * "+line" adds or replaces a course and "-number" removes one.
+ * Equivalency changes cannot be expressed as edits; a snapshot is needed.
+ *
+ * @param before The older catalog
+ * @param after The newer catalog
+ * @param edits Receives the edit lines
+ * @return false if the equivalencies changed and only a snapshot will do
+ */
+bool diffCatalogs(const Catalog& before, const Catalog& after, string* edits) {
+    if (before.equivalencies.Groups() != after.equivalencies.Groups()) {
+        return false;
+    }
+
+    // Both course lists are sorted, so one merge finds every change
+    const vector<const Course*>& left = before.completions.Courses();
+    const vector<const Course*>& right = after.completions.Courses();
+    size_t i = 0;
+    size_t j = 0;
+    while (i < left.size() || j < right.size()) {
+        if (j == right.size() || (i < left.size() && left[i]->courseNumber < right[j]->courseNumber)) {
+            *edits += '-' + left[i++]->courseNumber + '\n';
+        } else if (i == left.size() || right[j]->courseNumber < left[i]->courseNumber) {
+            *edits += '+' + serializeCourse(*right[j++]) + '\n';
+        } else {
+            const string line = serializeCourse(*right[j]);
+            if (serializeCourse(*left[i]) != line) {
+                *edits += '+' + line + '\n';
+            }
+            i++;
+            j++;
+        }
+    }
+    return true;
+}
+
+/**
+ * Build the catalog that results from applying edit lines to another
+ * Lines are "+line" to add or replace a course, "-number" to remove one
+ * and "=course,course..." to add an equivalency group. Only the edit lines
+ * are parsed: the base's courses are copied, every prerequisite is
+ * resolved again against the new equivalency table, and the tree and
+ * indexes are rebuilt, so the result gets the same validation as a
+ * catalog file without writing and reparsing the whole catalog.
+ *
+ * @param base The catalog to edit
+ * @param edits Edit lines separated by newlines
+ * @param next Pointer to an empty catalog receiving the result
+ * @param error Receives a description when the edits are rejected
+ * @return true if every edit applied and the result is a valid catalog
+ */
+bool applyCatalogEdits(const Catalog& base, const string& edits, Catalog* next, string* error) {
+    const auto start = chrono::steady_clock::now();
+
+    // Course lines added or replaced by number, base courses dropped, and
+    // new equivalency groups, in the order the edits give them
+    map<string, string, less<>> added;
+    unordered_set<string, StringHash, equal_to<>> removed;
+    string groups;
+
+    istringstream changes(edits);
+    string line;
+    int lineNumber = 0;
+    uint32_t row;
+    while (getline(changes, line)) {
+        lineNumber++;
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty()) {
+            continue;
+        }
+
+        const string body = line.substr(1);
+        const string number = body.substr(0, body.find(','));
+        const bool inBase = findCourseRow(base, number, &row);
+        if (line[0] == '+' && body.find(',') != string::npos && !number.empty()) {
+            added[number] = body;
+            if (inBase) {
+                removed.insert(number);
+            }
+        } else if (line[0] == '-' && body.find(',') == string::npos && !body.empty()) {
+            const bool present = added.erase(number) > 0 || (inBase && !removed.contains(number));
+            if (!present) {
+                *error = "edit line " + to_string(lineNumber) + " removes unknown course " + number;
+                return false;
+            }
+            if (inBase) {
+                removed.insert(number);
+            }
+        } else if (line[0] == '=') {
+            groups += line + '\n';
+        } else {
+            *error = "edit line " + to_string(lineNumber) + " is not +course, -number or =group";
+            return false;
+        }
+    }
+
+    // Parse just the new lines, checking them like a catalog file
+    TrackingResource scratchMemory;
+    pmr::monotonic_buffer_resource scratch(&scratchMemory);
+    pmr::vector<Course> addedCourses(&scratch);
+    EquivalencyTable addedGroups;
+    {
+        string text = groups;
+        for (const auto& [number, course] : added) {
+            text += course + '\n';
+        }
+        istringstream input(text);
+        if (!readCourseStream(input, &addedCourses, &addedGroups, LoadOptions())) {
+            *error = "edits leave the catalog invalid";
+            return false;
+        }
+        addedGroups.Freeze();
+    }
+
+    // Merge the kept base courses and the added ones, both in number order
+    const vector<const Course*>& baseCourses = base.completions.Courses();
+    pmr::vector<Course> courses(&scratch);
+    courses.reserve(baseCourses.size() + addedCourses.size());
+    size_t nextAdded = 0;
+    for (const Course* course : baseCourses) {
+        while (nextAdded < addedCourses.size() && addedCourses[nextAdded].courseNumber < course->courseNumber) {
+            courses.push_back(std::move(addedCourses[nextAdded++]));
+        }
+        if (!removed.contains(string_view(course->courseNumber))) {
+            courses.push_back(*course);
+            courses.back().prerequisiteClasses.clear();
+        }
+    }
+    while (nextAdded < addedCourses.size()) {
+        courses.push_back(std::move(addedCourses[nextAdded++]));
+    }
+
+    // Equivalencies: a copy of the base's plus the new groups. Classes that
+    // lose their representative course, or are merged, choose it again the
+    // way a load would: the base's representatives first, then every other
+    // course in number order. Removed course numbers keep their ids.
+    EquivalencyTable& equivalencies = next->equivalencies;
+    equivalencies = base.equivalencies;
+    for (const string& number : removed) {
+        equivalencies.ClearCatalogCourse(number);
+    }
+    for (const vector<string>& group : addedGroups.Groups()) {
+        for (const string& member : group) {
+            equivalencies.ClearCatalogCourse(member);
+        }
+        for (size_t i = 1; i < group.size(); i++) {
+            equivalencies.Merge(group[0], group[i]);
+        }
+    }
+    for (const Course* course : baseCourses) {
+        const bool represents =
+            base.equivalencies.CatalogCourseFor(course->equivalenceClass) == course->courseNumber;
+        if (represents && (!removed.contains(string_view(course->courseNumber)) || added.contains(string_view(course->courseNumber)))) {
+            equivalencies.MarkCatalogCourse(course->courseNumber);
+        }
+    }
+    for (const Course& course : courses) {
+        equivalencies.MarkCatalogCourse(course.courseNumber);
+    }
+    if (!resolvePrerequisites(&courses, &equivalencies)) {
+        *error = "edits leave the catalog invalid";
+        return false;
+    }
+
+    // Insert midpoints first so the sorted courses form a balanced tree
+    forEachMidpoint(courses.size(), [&](const size_t i) { next->courses.Insert(courses[i]); });
+    finishCatalogLoad(next, LoadOptions(), start);
+    return true;
+}
+
+//============================================================================
+// Query Timing
+//============================================================================
+
+/**
+ * Phases a query's time is split into for the slow-query log
+ * Lookup covers index and filter work, Graph prerequisite traversal,
+ * Format building the JSON body, Cache waiting on the result cache and
+ * Output everything after the result is ready until it is written.
+ */
+enum class QueryPhase { Lookup, Graph, Format, Cache, Output };
+
+constexpr size_t queryPhaseCount = 5;
+constexpr const char* queryPhaseNames[queryPhaseCount] = {"lookup", "graph", "format", "cache", "output"};
+
+/**
+ * Per-thread stopwatch splitting one query's time into phases
+ * Only runs while a slow-query log is attached, so untimed queries pay a
+ * single branch per phase change.
+ */
+struct QueryTimer {
+    bool active = false;
+    QueryPhase phase = QueryPhase::Lookup;
+    chrono::steady_clock::time_point start;
+    chrono::steady_clock::time_point mark;
+    array<uint64_t, queryPhaseCount> nanos{};
+
+    void Begin();
+    void Enter(QueryPhase next);
+    uint64_t End();
+};
+
+thread_local QueryTimer queryTimer;
+
+/**
+ * Start timing a query in the lookup phase
+ */
+void QueryTimer::Begin() {
+    active = true;
+    phase = QueryPhase::Lookup;
+    nanos.fill(0);
+    start = chrono::steady_clock::now();
+    mark = start;
+}
+
+/**
+ * Charge the time since the last mark to the current phase and switch
+ *
+ * @param next Phase the query is entering
+ */
+void QueryTimer::Enter(const QueryPhase next) {
+    const auto now = chrono::steady_clock::now();
+    nanos[static_cast<size_t>(phase)] += chrono::duration_cast<chrono::nanoseconds>(now - mark).count();
+    mark = now;
+    phase = next;
+}
+
+/**
+ * Stop timing
+ *
+ * @return Total nanoseconds since Begin
+ */
+uint64_t QueryTimer::End() {
+    Enter(phase);
+    active = false;
+    return chrono::duration_cast<chrono::nanoseconds>(mark - start).count();
+}
+
+/**
+ * Mark the calling thread's query as entering a phase, if it is timed
+ *
+ * @param phase Phase the query is entering
+ */
+void enterPhase(const QueryPhase phase) {
+    if (queryTimer.active) {
+        queryTimer.Enter(phase);
+    }
+}
+
+//============================================================================
+// JSON Query Functions
+//============================================================================
+
+/**
+ * Append a string to a JSON document as a quoted, escaped value
+ *
+ * @param out Output buffer
+ * @param value String to append
+ */
+void appendJsonString(string& out, const string_view value) {
+    static constexpr char hexDigits[] = "0123456789abcdef";
+
+    out += '"';
+    for (const char c : value) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    out += "\\u00";
+                    out += hexDigits[(c >> 4) & 0xF];
+                    out += hexDigits[c & 0xF];
+                } else {
+                    out += c;
+                }
+                break;
+        }
+    }
+    out += '"';
+}
+
+/**
+ * Append a JSON error object
+ *
+ * @param out Output buffer
+ * @param message Error description
+ */
+void appendJsonError(string& out, const string_view message) {
+    out += "{\"error\":";
+    appendJsonString(out, message);
+    out += '}';
+}
+
+/**
+ * Append a course as a JSON object
+ *
+ * @param out Output buffer
+ * @param course Course to append
+ */
+void appendCourseJson(string& out, const Course& course) {
+    out += "{\"courseNumber\":";
+    appendJsonString(out, course.courseNumber);
+    out += ",\"courseTitle\":";
+    appendJsonString(out, course.courseTitle.Text());
+    if (course.credits >= 0) {
+        out += ",\"credits\":" + to_string(course.credits);
+    }
+    out += ",\"prerequisites\":[";
+    for (size_t i = 0; i < course.prerequisites.size(); i++) {
+        if (i > 0) {
+            out += ',';
+        }
+        appendJsonString(out, course.prerequisites[i]);
+    }
+    out += "]}";
+}
+
+/**
+ * Look up one course
+ *
+ * @param catalog The loaded catalog
+ * @param courseNumber Course number to find
+ * @param out Receives the JSON response body
+ * @return HTTP status code
+ */
+int queryCourse(const Catalog& catalog, const string& courseNumber, string& out) {
+    const Course* course = catalog.courses.Find(toUpperCase(courseNumber));
+    enterPhase(QueryPhase::Format);
+    if (course == nullptr) {
+        appendJsonError(out, "course not found");
+        return 404;
+    }
+    appendCourseJson(out, *course);
+    return 200;
+}
+
+/**
+ * List one page of courses
+ *
+ * @param catalog The loaded catalog
+ * @param orderName number, title, level or depth; empty means number
+ * @param offset Number of courses to skip
+ * @param limit Maximum number of courses to return
+ * @param out Receives the JSON response body
+ * @return HTTP status code
+ */
+int queryCourseList(const Catalog& catalog, const string& orderName, const size_t offset,
+                    const size_t limit, string& out) {
+    enterPhase(QueryPhase::Format);
+    SortOrder order = SortOrder::Number;
+    if (!orderName.empty() && !parseSortOrder(orderName, &order)) {
+        appendJsonError(out, "order must be number, title, level or depth");
+        return 400;
+    }
+
+    const vector<const Course*>& courses = catalog.completions.Courses();
+    out += "{\"total\":" + to_string(courses.size()) +
+           ",\"offset\":" + to_string(offset) +
+           ",\"limit\":" + to_string(limit) + ",\"courses\":[";
+
+    for (size_t position = offset; position < courses.size() && position - offset < limit; position++) {
+        if (position > offset) {
+            out += ',';
+        }
+        appendCourseJson(out, *courses[catalog.orders.RowAt(order, position)]);
+    }
+
+    out += "]}";
+    return 200;
+}
+
+/**
+ * List every direct and indirect prerequisite of a course
+ *
+ * @param catalog The loaded catalog
+ * @param courseNumber Course number to expand
+ * @param out Receives the JSON response body
+ * @return HTTP status code
+ */
+int queryClosure(const Catalog& catalog, const string& courseNumber, string& out) {
+    uint32_t row;
+    if (!findCourseRow(catalog, toUpperCase(courseNumber), &row)) {
+        enterPhase(QueryPhase::Format);
+        appendJsonError(out, "course not found");
+        return 404;
+    }
+
+    enterPhase(QueryPhase::Graph);
+    const vector<uint32_t> closure = prerequisiteClosure(catalog, row);
+    enterPhase(QueryPhase::Format);
+    const vector<const Course*>& courses = catalog.completions.Courses();
+    out += "{\"courseNumber\":";
+    appendJsonString(out, courses[row]->courseNumber);
+    out += ",\"closure\":[";
+    for (size_t i = 0; i < closure.size(); i++) {
+        if (i > 0) {
+            out += ',';
+        }
+        appendJsonString(out, courses[closure[i]]->courseNumber);
+    }
+    out += "]}";
+    return 200;
+}
+
+/**
+ * Resolve a transcript and report eligibility
+ * Without a course number every newly available course is listed;
+ * with one, only that course is checked and its missing prerequisites
+ * are reported.
+ *
+ * @param catalog The loaded catalog
+ * @param transcript Comma-separated list of completed courses
+ * @param courseNumber Optional course number to check
+ * @param out Receives the JSON response body
+ * @return HTTP status code
+ */
+int queryEligibility(const Catalog& catalog, const string& transcript,
+                     const string& courseNumber, string& out) {
+    const EquivalencyTable& equivalencies = catalog.equivalencies;
+    vector<char> completed(equivalencies.Size(), 0);
+
+    out += "{\"transfer\":[";
+    bool first = true;
+    for (const string_view field : tokenize(transcript, ',')) {
+        if (field.empty()) {
+            continue;
+        }
+        const string entry = toUpperCase(field);
+        const int classId = equivalencies.ClassOf(entry);
+        if (classId >= 0) {
+            completed[classId] = 1;
+        }
+
+        if (!first) {
+            out += ',';
+        }
+        first = false;
+        out += "{\"course\":";
+        appendJsonString(out, entry);
+        out += ",\"equivalent\":";
+        if (classId < 0 || equivalencies.CatalogCourseFor(classId).empty()) {
+            out += "null";
+        } else {
+            appendJsonString(out, equivalencies.CatalogCourseFor(classId));
+        }
+        out += '}';
+    }
+    out += ']';
+
+    // Checking prerequisites against the transcript is the graph work;
+    // the course bodies written along the way are small
+    const vector<const Course*>& courses = catalog.completions.Courses();
+    if (!courseNumber.empty()) {
+        uint32_t row;
+        const bool found = findCourseRow(catalog, toUpperCase(courseNumber), &row);
+        enterPhase(QueryPhase::Graph);
+        if (!found) {
+            out.clear();
+            appendJsonError(out, "course not found");
+            return 404;
+        }
+
+        out += ",\"courseNumber\":";
+        appendJsonString(out, courses[row]->courseNumber);
+        out += ",\"eligible\":";
+        out += isEligible(catalog.graph, row, completed) ? "true" : "false";
+        out += ",\"missing\":[";
+        first = true;
+        catalog.graph.Prerequisites().ForEach(row, [&](const uint32_t classId) {
+            if (!completed[classId]) {
+                if (!first) {
+                    out += ',';
+                }
+                first = false;
+                appendJsonString(out, equivalencies.CatalogCourseFor(static_cast<int>(classId)));
+            }
+        });
+        out += "]}";
+        return 200;
+    }
+
+    enterPhase(QueryPhase::Graph);
+    out += ",\"eligible\":[";
+    const vector<uint32_t> eligible = eligibleRows(catalog.graph, completed);
+    for (size_t i = 0; i < eligible.size(); i++) {
+        if (i > 0) {
+            out += ',';
+        }
+        appendCourseJson(out, *courses[eligible[i]]);
+    }
+    out += "]}";
+    return 200;
+}
+
+/**
+ * Complete a partial course number or title
+ *
+ * @param catalog The loaded catalog
+ * @param prefix Partial course number or title
+ * @param count Maximum number of completions
+ * @param out Receives the JSON response body
+ * @return HTTP status code
+ */
+int queryCompletions(const Catalog& catalog, const string& prefix, const size_t count,
+                     string& out) {
+    const auto completions = catalog.completions.Complete(prefix, count);
+    enterPhase(QueryPhase::Format);
+    out += "{\"prefix\":";
+    appendJsonString(out, prefix);
+    out += ",\"completions\":[";
+    for (size_t i = 0; i < completions.size(); i++) {
+        if (i > 0) {
+            out += ',';
+        }
+        out += "{\"courseNumber\":";
+        appendJsonString(out, completions[i].first->courseNumber);
+        out += ",\"courseTitle\":";
+        appendJsonString(out, completions[i].first->courseTitle.Text());
+        out += ",\"popularity\":" + to_string(completions[i].second) + "}";
+    }
+    out += "]}";
+    return 200;
+}
+
+/**
+ * Find the courses matching a filter expression
+ *
+ * @param catalog The loaded catalog
+ * @param expression Filter such as dept=CSCI level>=300
+ * @param limit Maximum number of courses to return; the count covers all
+ * @param out Receives the JSON response body
+ * @return HTTP status code
+ */
+int queryFilter(const Catalog& catalog, const string& expression, const size_t limit, string& out) {
+    CourseFilter filter;
+    string error;
+    if (!filter.Compile(expression, &error)) {
+        appendJsonError(out, error);
+        return 400;
+    }
+
+    string plan;
+    const vector<const Course*> matches = filter.Run(catalog, &plan);
+    enterPhase(QueryPhase::Format);
+    out += "{\"filter\":";
+    appendJsonString(out, expression);
+    out += ",\"plan\":";
+    appendJsonString(out, plan);
+    out += ",\"count\":" + to_string(matches.size());
+    out += ",\"courses\":[";
+    for (size_t i = 0; i < matches.size() && i < limit; i++) {
+        if (i > 0) {
+            out += ',';
+        }
+        appendCourseJson(out, *matches[i]);
+    }
+    out += "]}";
+    return 200;
+}
+
+/**
+ * Look up several courses at once
+ * Each course also lists its prerequisites resolved to catalog course
+ * numbers under "requires", in prerequisite graph order, so callers can
+ * follow them without the equivalency table. Unknown course numbers are
+ * left out.
+ *
+ * @param catalog The loaded catalog
+ * @param numbers Comma-separated course numbers
+ * @param out Receives the JSON response body
+ * @return HTTP status code
+ */
+int queryLookup(const Catalog& catalog, const string& numbers, string& out) {
+    out += "{\"courses\":[";
+    bool first = true;
+    for (const string_view number : tokenize(numbers, ',')) {
+        uint32_t row;
+        if (number.empty() || !findCourseRow(catalog, toUpperCase(number), &row)) {
+            continue;
+        }
+        if (!first) {
+            out += ',';
+        }
+        first = false;
+
+        // Reopen the course object to add the resolved prerequisites
+        appendCourseJson(out, *catalog.completions.Courses()[row]);
+        out.pop_back();
+        out += ",\"requires\":[";
+        bool firstPrereq = true;
+        catalog.graph.Prerequisites().ForEach(row, [&](const uint32_t classId) {
+            if (!firstPrereq) {
+                out += ',';
+            }
+            firstPrereq = false;
+            appendJsonString(out, catalog.equivalencies.CatalogCourseFor(static_cast<int>(classId)));
+        });
+        out += "]}";
+    }
+    out += "]}";
+    return 200;
+}
+
+//============================================================================
+// Query Service
+//============================================================================
+
+/**
+ * Kinds of query answered by the server and batch modes
+ */
+enum class QueryType { Course, List, Closure, Eligibility, Complete, Filter, Lookup };
+
+static_assert(static_cast<size_t>(QueryType::Lookup) + 1 == queryTypeCount);
+
+/**
+ * Query type names used in logs and metrics, matching the batch commands
+ */
+constexpr const char* queryTypeNames[queryTypeCount] = {"course", "list", "closure", "eligible", "complete", "filter",
+                                                         "lookup"};
+
+/**
+ * One parsed query
+ * key holds the course number, the sort order for lists, the transcript
+ * for eligibility queries, the prefix for completion queries, the
+ * expression for filters or the comma-separated course numbers for
+ * lookups.
+ */
+struct Query {
+    QueryType type = QueryType::Course;
+    string key;
+    string course;
+    size_t offset = 0;
+    size_t limit = 100;
+};
+
+/**
+ * A finished query response
+ */
+struct QueryResult {
+    int status = 200;
+    string body;
+};
+
+/**
+ * Bounded result cache with CLOCK eviction and single-flight coalescing
+ * Concurrent misses on the same key wait for the first caller's result
+ * instead of computing it again.
+ */
+class QueryCache final {
+    struct Slot {
+        string key;
+        shared_ptr<const QueryResult> result;
+        bool referenced = false;
+    };
+
+    mutable mutex lock;
+    vector<Slot> slots;
+    unordered_map<string, size_t> index;
+    unordered_map<string, shared_future<shared_ptr<const QueryResult>>> inFlight;
+    size_t capacity;
+    size_t hand = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t coalesced = 0;
+
+    void store(const string& key, shared_ptr<const QueryResult> result);
+
+public:
+    explicit QueryCache(size_t capacity);
+    shared_ptr<const QueryResult> GetOrCompute(const string& key,
+                                               const function<QueryResult()>& compute);
+    void Clear();
+    void PrintStats(ostream& out) const;
+    void AppendMetrics(string& out) const;
+};
+
+/**
+ * Constructor
+ *
+ * @param capacity Maximum number of cached results, 0 to disable caching
+ */
+QueryCache::QueryCache(const size_t capacity) : capacity(capacity) {
+    slots.reserve(capacity);
+}
+
+/**
+ * Return a cached result, joining an in-progress computation if one exists
+ *
+ * @param key Cache key, which must include the catalog version
+ * @param compute Produces the result on a miss
+ * @return The shared result
+ */
+shared_ptr<const QueryResult> QueryCache::GetOrCompute(const string& key,
+                                                       const function<QueryResult()>& compute) {
+    promise<shared_ptr<const QueryResult>> pending;
+    {
+        unique_lock guard(lock);
+        if (const auto found = index.find(key); found != index.end()) {
+            Slot& slot = slots[found->second];
+            slot.referenced = true;
+            hits++;
+            return slot.result;
+        }
+
+        // Someone else is already computing this key: wait for them
+        if (const auto running = inFlight.find(key); running != inFlight.end()) {
+            const auto shared = running->second;
+            coalesced++;
+            guard.unlock();
+            return shared.get();
+        }
+
+        misses++;
+        inFlight.emplace(key, pending.get_future().share());
+    }
+
+    shared_ptr<const QueryResult> result;
+    try {
+        result = make_shared<const QueryResult>(compute());
+    } catch (...) {
+        {
+            lock_guard guard(lock);
+            inFlight.erase(key);
+        }
+        pending.set_exception(current_exception());
+        throw;
+    }
+
+    {
+        lock_guard guard(lock);
+        store(key, result);
+        inFlight.erase(key);
+    }
+    pending.set_value(result);
+    return result;
+}
+
+// Insert a result, evicting with the CLOCK hand once the cache is full
+void QueryCache::store(const string& key, shared_ptr<const QueryResult> result) {
+    if (capacity == 0) {
+        return;
+    }
+
+    if (slots.size() < capacity) {
+        index[key] = slots.size();
+        slots.push_back({key, std::move(result), false});
+        return;
+    }
+
+    // Give referenced slots a second chance until an unreferenced one turns up
+    while (slots[hand].referenced) {
+        slots[hand].referenced = false;
+        hand = (hand + 1) % capacity;
+    }
+
+    index.erase(slots[hand].key);
+    slots[hand] = {key, std::move(result), false};
+    index[key] = hand;
+    hand = (hand + 1) % capacity;
+}
+
+/**
+ * Drop every cached result
+ * Computations already in flight still complete for their own callers.
+ */
+void QueryCache::Clear() {
+    lock_guard guard(lock);
+    slots.clear();
+    index.clear();
+    hand = 0;
+}
+
+/**
+ * Print hit, miss and coalescing counts
+ *
+ * @param out Stream to print to
+ */
+void QueryCache::PrintStats(ostream& out) const {
+    lock_guard guard(lock);
+    out << "Cache: " << hits << " hits, " << misses << " misses, "
+        << coalesced << " coalesced, " << slots.size() << "/" << capacity
+        << " entries" << endl;
+}
+
+/**
+ * Append hit, miss, coalescing and occupancy metrics in Prometheus format
+ *
+ * @param out Output buffer
+ */
+void QueryCache::AppendMetrics(string& out) const {
+    lock_guard guard(lock);
+    out += "# HELP abcu_cache_hits_total Queries answered from the result cache.\n"
+           "# TYPE abcu_cache_hits_total counter\n"
+           "abcu_cache_hits_total " + to_string(hits) + "\n"
+           "# HELP abcu_cache_misses_total Queries computed because no result was cached.\n"
+           "# TYPE abcu_cache_misses_total counter\n"
+           "abcu_cache_misses_total " + to_string(misses) + "\n"
+           "# HELP abcu_cache_coalesced_total Queries that waited on an identical query in flight.\n"
+           "# TYPE abcu_cache_coalesced_total counter\n"
+           "abcu_cache_coalesced_total " + to_string(coalesced) + "\n"
+           "# HELP abcu_cache_entries Results currently cached.\n"
+           "# TYPE abcu_cache_entries gauge\n"
+           "abcu_cache_entries " + to_string(slots.size()) + "\n"
+           "# HELP abcu_cache_capacity Maximum number of cached results.\n"
+           "# TYPE abcu_cache_capacity gauge\n"
+           "abcu_cache_capacity " + to_string(capacity) + "\n";
+}
+
+//============================================================================
+// Query Log
+//============================================================================
+
+/**
+ * Append-only binary log of every query, for replaying real workloads
+ * The file starts with an 8-byte magic and the wall-clock start time in
+ * microseconds. Each record is the query type byte, the microseconds since
+ * the previous record, the key and course as length-prefixed strings, and
+ * the offset and limit, all integers as LEB128 varints.
+ */
+class QueryLog final {
+    static constexpr char magic[9] = "ABCUQLG1";
+
+    mutex lock;
+    ofstream file;
+    chrono::steady_clock::time_point last;
+    string record;
+
+public:
+    bool Open(const string& filename);
+    void Append(const Query& query);
+    static bool Read(const string& filename, vector<pair<uint64_t, Query>>* records);
+};
+
+/**
+ * Create the log file and write its header
+ *
+ * @param filename Path of the log to create
+ * @return true if the file was created
+ */
+bool QueryLog::Open(const string& filename) {
+    file.open(filename, ios::binary | ios::trunc);
+    if (!file.is_open()) {
+        cout << "Error: Could not write file " << filename << endl;
+        return false;
+    }
+
+    string header(magic, 8);
+    const auto startMicros = chrono::duration_cast<chrono::microseconds>(
+        chrono::system_clock::now().time_since_epoch()).count();
+    appendVarint(header, static_cast<uint64_t>(startMicros));
+    file.write(header.data(), static_cast<streamsize>(header.size()));
+    last = chrono::steady_clock::now();
+    return true;
+}
+
+/**
+ * Record one query
+ * Safe to call from several threads; records are written in call order.
+ *
+ * @param query The query being answered
+ */
+void QueryLog::Append(const Query& query) {
+    lock_guard guard(lock);
+    const auto now = chrono::steady_clock::now();
+    const auto delta = chrono::duration_cast<chrono::microseconds>(now - last).count();
+    last = now;
+
+    record.clear();
+    record += static_cast<char>(query.type);
+    appendVarint(record, static_cast<uint64_t>(max<int64_t>(0, delta)));
+    appendField(record, query.key);
+    appendField(record, query.course);
+    appendVarint(record, query.offset);
+    appendVarint(record, query.limit);
+    file.write(record.data(), static_cast<streamsize>(record.size()));
+}
+
+/**
+ * Read a whole query log
+ *
+ * @param filename Path of the log
+ * @param records Receives each query with its time offset in microseconds
+ * @return true if the file is a valid query log
+ */
+bool QueryLog::Read(const string& filename, vector<pair<uint64_t, Query>>* records) {
+    ifstream in(filename, ios::binary);
+    ostringstream buffer;
+    buffer << in.rdbuf();
+    const string contents = std::move(buffer).str();
+    string_view data(contents);
+    uint64_t startMicros;
+    const bool hasMagic = data.starts_with(string_view(magic, 8));
+    data.remove_prefix(hasMagic ? 8 : 0);
+    if (!hasMagic || !readVarint(data, &startMicros)) {
+        cout << "Error: " << filename << " is not a query log" << endl;
+        return false;
+    }
+
+    uint64_t elapsed = 0;
+    while (!data.empty()) {
+        const auto type = static_cast<uint8_t>(data.front());
+        data.remove_prefix(1);
+        Query query;
+        uint64_t delta;
+        string_view key;
+        string_view course;
+        if (type > static_cast<int>(QueryType::Lookup) || !readVarint(data, &delta) ||
+            !readField(data, &key) || !readField(data, &course) ||
+            !readVarint(data, &query.offset) || !readVarint(data, &query.limit)) {
+            cout << "Error: Query log " << filename << " is truncated after "
+                 << records->size() << " records" << endl;
+            return false;
+        }
+        query.type = static_cast<QueryType>(type);
+        query.key = key;
+        query.course = course;
+        elapsed += delta;
+        records->emplace_back(elapsed, std::move(query));
+    }
+    return true;
+}
+
+/**
+ * Log of queries slower than a threshold, with their phase breakdown
+ * Query threads hand entries to a background writer through a bounded
+ * lock-free ring, so recording never blocks on the file. When the ring is
+ * full the entry is dropped and counted instead.
+ */
+class SlowQueryLog final {
+    static constexpr size_t capacity = 1024;
+    static constexpr size_t keyBytes = 96;
+    static constexpr size_t courseBytes = 24;
+
+    struct Entry {
+        uint64_t wallMicros = 0;
+        uint64_t version = 0;
+        uint64_t totalNanos = 0;
+        array<uint64_t, queryPhaseCount> nanos{};
+        QueryType type = QueryType::Course;
+        uint8_t keyLength = 0;
+        uint8_t courseLength = 0;
+        char key[keyBytes]{};
+        char course[courseBytes]{};
+    };
+
+    // A slot is free for the producer claiming position p when its sequence
+    // is p, and ready for the writer when it is p + 1
+    struct alignas(64) Slot {
+        atomic<size_t> sequence;
+        Entry entry;
+    };
+
+    unique_ptr<Slot[]> slots;
+    alignas(64) atomic<size_t> head{0};
+    alignas(64) size_t tail = 0;
+    atomic<uint64_t> dropped{0};
+    atomic<bool> stopping{false};
+    uint64_t thresholdNanos;
+    ofstream file;
+    string line;
+    thread writer;
+
+    bool pop(Entry& entry);
+    void writeEntry(const Entry& entry);
+    void run();
+
+public:
+    explicit SlowQueryLog(double thresholdMilliseconds);
+    ~SlowQueryLog();
+    SlowQueryLog(const SlowQueryLog&) = delete;
+    SlowQueryLog& operator=(const SlowQueryLog&) = delete;
+    bool Open(const string& filename);
+    void Record(const Query& query, uint64_t version, uint64_t totalNanos,
+                const array<uint64_t, queryPhaseCount>& nanos);
+};
+
+/**
+ * Constructor
+ *
+ * @param thresholdMilliseconds Queries taking at least this long are logged
+ */
+SlowQueryLog::SlowQueryLog(const double thresholdMilliseconds)
+    : slots(make_unique<Slot[]>(capacity)),
+      thresholdNanos(static_cast<uint64_t>(max(0.0, thresholdMilliseconds) * 1e6)) {
+    for (size_t i = 0; i < capacity; i++) {
+        slots[i].sequence.store(i, memory_order_relaxed);
+    }
+}
+
+/**
+ * Destructor
+ * Writes every entry still queued before closing the file.
+ */
+SlowQueryLog::~SlowQueryLog() {
+    if (!writer.joinable()) {
+        return;
+    }
+    stopping.store(true, memory_order_release);
+    writer.join();
+    if (dropped > 0) {
+        cerr << "Slow-query log dropped " << dropped << " entries" << endl;
+    }
+}
+
+/**
+ * Create the log file and start the writer thread
+ *
+ * @param filename Path of the log to create
+ * @return true if the file was created
+ */
+bool SlowQueryLog::Open(const string& filename) {
+    file.open(filename, ios::trunc);
+    if (!file.is_open()) {
+        cout << "Error: Could not write file " << filename << endl;
+        return false;
+    }
+    writer = thread(&SlowQueryLog::run, this);
+    return true;
+}
+
+/**
+ * Queue a finished query if it was slow enough
+ * Safe to call from any number of threads.
+ *
+ * @param query The query that was answered
+ * @param version Catalog version it ran against
+ * @param totalNanos Total time taken
+ * @param nanos Time taken in each phase
+ */
+void SlowQueryLog::Record(const Query& query, const uint64_t version, const uint64_t totalNanos,
+                          const array<uint64_t, queryPhaseCount>& nanos) {
+    if (totalNanos < thresholdNanos) {
+        return;
+    }
+
+    // Claim a position; a slot still holding an unwritten entry means the
+    // ring is full
+    size_t position = head.load(memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+        slot = &slots[position & (capacity - 1)];
+        const size_t sequence = slot->sequence.load(memory_order_acquire);
+        const auto difference = static_cast<ptrdiff_t>(sequence - position);
+        if (difference == 0) {
+            if (head.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            dropped.fetch_add(1, memory_order_relaxed);
+            return;
+        } else {
+            position = head.load(memory_order_relaxed);
+        }
+    }
+
+    Entry& entry = slot->entry;
+    entry.wallMicros = static_cast<uint64_t>(chrono::duration_cast<chrono::microseconds>(
+        chrono::system_clock::now().time_since_epoch()).count());
+    entry.version = version;
+    entry.totalNanos = totalNanos;
+    entry.nanos = nanos;
+    entry.type = query.type;
+    entry.keyLength = static_cast<uint8_t>(min(query.key.size(), keyBytes));
+    memcpy(entry.key, query.key.data(), entry.keyLength);
+    entry.courseLength = static_cast<uint8_t>(min(query.course.size(), courseBytes));
+    memcpy(entry.course, query.course.data(), entry.courseLength);
+    slot->sequence.store(position + 1, memory_order_release);
+}
+
+// Take the next ready entry, if any; only the writer thread calls this
+bool SlowQueryLog::pop(Entry& entry) {
+    Slot& slot = slots[tail & (capacity - 1)];
+    if (slot.sequence.load(memory_order_acquire) != tail + 1) {
+        return false;
+    }
+    entry = slot.entry;
+    slot.sequence.store(tail + capacity, memory_order_release);
+    tail++;
+    return true;
+}
+
+// Format one entry as a text line
+void SlowQueryLog::writeEntry(const Entry& entry) {
+    const auto seconds = static_cast<time_t>(entry.wallMicros / 1000000);
+    char timestamp[32];
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", gmtime(&seconds));
+
+    char fraction[32];
+    snprintf(fraction, sizeof(fraction), ".%06lluZ %.3f ms ",
+             static_cast<unsigned long long>(entry.wallMicros % 1000000),
+             static_cast<double>(entry.totalNanos) / 1e6);
+
+    line = timestamp;
+    line += fraction;
+    line += queryTypeNames[static_cast<size_t>(entry.type)];
+    line += " version=" + to_string(entry.version) + " key=";
+    appendJsonString(line, string_view(entry.key, entry.keyLength));
+    if (entry.courseLength > 0) {
+        line += " course=";
+        appendJsonString(line, string_view(entry.course, entry.courseLength));
+    }
+    for (size_t phase = 0; phase < queryPhaseCount; phase++) {
+        char milliseconds[32];
+        snprintf(milliseconds, sizeof(milliseconds), "=%.3f", static_cast<double>(entry.nanos[phase]) / 1e6);
+        line += ' ';
+        line += queryPhaseNames[phase];
+        line += milliseconds;
+    }
+    line += '\n';
+    file.write(line.data(), static_cast<streamsize>(line.size()));
+}
+
+// Writer thread: drain the ring, then sleep briefly when it is empty
+void SlowQueryLog::run() {
+    Entry entry;
+    while (true) {
+        const bool finishing = stopping.load(memory_order_acquire);
+        while (pop(entry)) {
+            writeEntry(entry);
+        }
+        file.flush();
+        if (finishing) {
+            return;
+        }
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+}
+
+/**
+ * Answers queries against the current catalog version
+ * Shared by the server and batch modes. Closure, eligibility and filter
+ * results go through the cache; a newly published catalog invalidates it.
+ */
+class QueryService final {
+    // One node's catalog copy, on its own cache line so loading it never
+    // touches another node's memory
+    struct alignas(64) ReplicaSlot {
+        atomic<shared_ptr<const Catalog>> catalog;
+    };
+
+    // Serializes publishing; query threads never take it
+    mutable mutex publishLock;
+    atomic<shared_ptr<const Catalog>> catalog;
+    unique_ptr<ReplicaSlot[]> replicas;
+    atomic<size_t> replicaCount{0};
+    vector<vector<int>> replicaNodes;
+    QueryCache cache;
+    QueryLog* log = nullptr;
+    SlowQueryLog* slowLog = nullptr;
+    bool timeQueries = false;
+
+    void install(shared_ptr<const Catalog> next);
+    void inheritScores(const Catalog& next) const;
+    static void recordLookup(const Catalog& current, const string& courseNumber);
+
+public:
+    QueryService(shared_ptr<Catalog> catalog, size_t cacheEntries, uint64_t version = 0);
+    [[nodiscard]] shared_ptr<const Catalog> Current() const;
+    [[nodiscard]] shared_ptr<const Catalog> Merged() const;
+    void Publish(shared_ptr<Catalog> next, uint64_t version = 0);
+    void ReplicatePerNode(vector<vector<int>> nodes);
+    size_t WarmUp(unsigned threadCount) const;
+    QueryResult Execute(const Query& query);
+    void SetLog(QueryLog* queryLog);
+    void SetSlowLog(SlowQueryLog* queryLog);
+    void EnableLatencyMetrics();
+    void FinishQuery() const;
+    [[nodiscard]] const QueryCache& Cache() const;
+};
+
+/**
+ * Constructor
+ *
+ * @param catalog The initial catalog
+ * @param cacheEntries Result cache capacity, 0 to disable caching
+ * @param version Version of the initial catalog, 0 for version 1
+ */
+QueryService::QueryService(shared_ptr<Catalog> catalog, const size_t cacheEntries, const uint64_t version)
+    : cache(cacheEntries) {
+    Publish(std::move(catalog), version);
+}
+
+/**
+ * Get the catalog new queries should run against
+ * With per-node replicas enabled this is the replica local to the
+ * calling thread's NUMA node, read from that node's slot without locking;
+ * each replica has its own reference count, so taking a reference only
+ * writes node-local memory.
+ */
+shared_ptr<const Catalog> QueryService::Current() const {
+    if (queryNode < replicaCount.load(memory_order_acquire)) {
+        return replicas[queryNode].catalog.load(memory_order_acquire);
+    }
+    return catalog.load(memory_order_acquire);
+}
+
+/**
+ * Get the current catalog with every lookup counted so far
+ * Without replicas this is the catalog itself; with them, a copy of it
+ * that adds up the lookups recorded on every node.
+ */
+shared_ptr<const Catalog> QueryService::Merged() const {
+    lock_guard guard(publishLock);
+    const shared_ptr<const Catalog> current = catalog.load(memory_order_acquire);
+    if (replicaCount.load(memory_order_acquire) == 0) {
+        return current;
+    }
+    shared_ptr<Catalog> merged = copyCatalog(*current);
+    inheritScores(*merged);
+    return merged;
+}
+
+/**
+ * Replace the catalog with a newly loaded one
+ * Queries already running keep their old catalog alive until they finish.
+ *
+ * @param next The new catalog
+ * @param version Version to publish it as, such as a primary's version on
+ *                a replica; 0 means one more than the current version
+ */
+void QueryService::Publish(shared_ptr<Catalog> next, const uint64_t version) {
+    lock_guard guard(publishLock);
+    const shared_ptr<const Catalog> previous = catalog.load(memory_order_acquire);
+    next->version = version != 0 ? version : previous ? previous->version + 1 : 1;
+    if (previous) {
+        inheritScores(*next);
+    }
+    install(std::move(next));
+    cache.Clear();
+}
+
+/**
+ * Keep one copy of the catalog per NUMA node
+ * Query threads must set queryNode to pick their local copy. Call at most
+ * once, before query threads start.
+ *
+ * @param nodes CPU numbers indexed by node
+ */
+void QueryService::ReplicatePerNode(vector<vector<int>> nodes) {
+    lock_guard guard(publishLock);
+    replicaNodes = std::move(nodes);
+    replicas = make_unique<ReplicaSlot[]>(replicaNodes.size());
+    install(catalog.load(memory_order_acquire));
+    replicaCount.store(replicaNodes.size(), memory_order_release);
+}
+
+/**
+ * Prefault the current catalog and every replica
+ * Replicas are walked by threads pinned to their own node.
+ *
+ * @param threadCount Threads to walk each catalog with
+ * @return Number of bytes read
+ */
+size_t QueryService::WarmUp(const unsigned threadCount) const {
+    const shared_ptr<const Catalog> primary = catalog.load(memory_order_acquire);
+    vector<shared_ptr<const Catalog>> local;
+    for (size_t node = 0; node < replicaCount.load(memory_order_acquire); node++) {
+        local.push_back(replicas[node].catalog.load(memory_order_acquire));
+    }
+
+    size_t bytes = primary->courses.Prefault(threadCount, [] {}) +
+                   primary->equivalencies.Prefault();
+    for (size_t node = 0; node < local.size(); node++) {
+        bytes += local[node]->courses.Prefault(threadCount, [&, node] {
+            pinCurrentThread(replicaNodes[node]);
+        });
+        bytes += local[node]->equivalencies.Prefault();
+    }
+    return bytes;
+}
+
+// Give a catalog the current lookup counts: the primary's, plus whatever
+// each node's replica recorded since it was copied. Callers hold publishLock.
+void QueryService::inheritScores(const Catalog& next) const {
+    const shared_ptr<const Catalog> previous = catalog.load(memory_order_acquire);
+    next.completions.InheritScores(previous->completions);
+    for (size_t node = 0; node < replicaCount.load(memory_order_acquire); node++) {
+        const shared_ptr<const Catalog> replica = replicas[node].catalog.load(memory_order_acquire);
+        next.completions.InheritScores(replica->completions, &previous->completions);
+    }
+}
+
+// Make a catalog current, building each replica on a thread pinned to its
+// node so the copy's memory is allocated there. Callers hold publishLock.
+void QueryService::install(shared_ptr<const Catalog> next) {
+    vector<shared_ptr<const Catalog>> nextReplicas(replicaNodes.size());
+    vector<thread> builders;
+    for (size_t node = 0; node < replicaNodes.size(); node++) {
+        builders.emplace_back([&, node] {
+            pinCurrentThread(replicaNodes[node]);
+            nextReplicas[node] = copyCatalog(*next);
+        });
+    }
+    for (auto& builder : builders) {
+        builder.join();
+    }
+
+    for (size_t node = 0; node < nextReplicas.size(); node++) {
+        replicas[node].catalog.store(std::move(nextReplicas[node]), memory_order_release);
+    }
+    catalog.store(std::move(next), memory_order_release);
+}
+
+// The query this thread is timing, kept until FinishQuery logs it
+thread_local Query timedQuery;
+thread_local uint64_t timedVersion = 0;
+
+/**
+ * Run one query
+ * With a slow-query log attached the query is timed until the caller
+ * reports it written with FinishQuery.
+ *
+ * @param query The query to answer
+ * @return Status code and JSON body
+ */
+QueryResult QueryService::Execute(const Query& query) {
+    plannerMetrics.queries[static_cast<size_t>(query.type)].Add();
+    if (timeQueries) {
+        queryTimer.Begin();
+        timedQuery = query;
+    }
+    if (log != nullptr) {
+        log->Append(query);
+    }
+
+    const shared_ptr<const Catalog> current = Current();
+    timedVersion = current->version;
+    QueryResult result;
+
+    switch (query.type) {
+        case QueryType::Course:
+            recordLookup(*current, query.key);
+            result.status = queryCourse(*current, query.key, result.body);
+            enterPhase(QueryPhase::Output);
+            return result;
+        case QueryType::List:
+            result.status = queryCourseList(*current, query.key, query.offset, query.limit, result.body);
+            enterPhase(QueryPhase::Output);
+            return result;
+        case QueryType::Complete:
+            result.status = queryCompletions(*current, query.key, query.limit, result.body);
+            enterPhase(QueryPhase::Output);
+            return result;
+        case QueryType::Lookup:
+            result.status = queryLookup(*current, query.key, result.body);
+            enterPhase(QueryPhase::Output);
+            return result;
+        case QueryType::Closure:
+            recordLookup(*current, query.key);
+            break;
+        case QueryType::Eligibility:
+            recordLookup(*current, query.course);
+            break;
+        case QueryType::Filter:
+            break;
+    }
+
+    // Graph queries and filters are cached per catalog version
+    string key = to_string(current->version);
+    if (query.type == QueryType::Filter) {
+        key += "|f|" + to_string(query.limit) + '|' + query.key;
+    } else {
+        key += query.type == QueryType::Closure ? "|c|" : "|e|";
+        key += toUpperCase(query.key);
+        key += '|';
+        key += toUpperCase(query.course);
+    }
+
+    enterPhase(QueryPhase::Cache);
+    const auto shared = cache.GetOrCompute(key, [&] {
+        enterPhase(QueryPhase::Lookup);
+        QueryResult computed;
+        if (query.type == QueryType::Closure) {
+            computed.status = queryClosure(*current, query.key, computed.body);
+        } else if (query.type == QueryType::Filter) {
+            computed.status = queryFilter(*current, query.key, query.limit, computed.body);
+        } else {
+            computed.status = queryEligibility(*current, query.key, query.course, computed.body);
+        }
+        enterPhase(QueryPhase::Cache);
+        return computed;
+    });
+    enterPhase(QueryPhase::Output);
+    return *shared;
+}
+
+// Count a lookup in the catalog the query ran against, which is the
+// calling thread's local replica when there are replicas. Each node's
+// counts reach the others when the next catalog is published.
+void QueryService::recordLookup(const Catalog& current, const string& courseNumber) {
+    if (!courseNumber.empty()) {
+        current.completions.Record(toUpperCase(courseNumber));
+    }
+}
+
+/**
+ * Record every query executed from now on
+ *
+ * @param queryLog Open log to append to, or nullptr to stop recording
+ */
+void QueryService::SetLog(QueryLog* queryLog) {
+    log = queryLog;
+}
+
+/**
+ * Time every query executed from now on, logging the slow ones
+ * Callers must call FinishQuery once each result has been written.
+ *
+ * @param queryLog Open slow-query log, or nullptr to stop timing
+ */
+void QueryService::SetSlowLog(SlowQueryLog* queryLog) {
+    slowLog = queryLog;
+    if (slowLog != nullptr) {
+        timeQueries = true;
+    }
+}
+
+/**
+ * Time every query executed from now on into the latency histograms
+ * Callers must call FinishQuery once each result has been written.
+ */
+void QueryService::EnableLatencyMetrics() {
+    timeQueries = true;
+}
+
+/**
+ * Stop timing the calling thread's query, recording its latency and
+ * logging it if it was slow
+ * Does nothing unless the thread's last Execute started a timer.
+ */
+void QueryService::FinishQuery() const {
+    if (!queryTimer.active) {
+        return;
+    }
+    const uint64_t total = queryTimer.End();
+    plannerMetrics.latency[static_cast<size_t>(timedQuery.type)].Observe(total);
+    if (slowLog != nullptr) {
+        slowLog->Record(timedQuery, timedVersion, total, queryTimer.nanos);
+    }
+}
+
+/**
+ * Get the result cache, for reporting
+ */
+const QueryCache& QueryService::Cache() const {
+    return cache;
+}
+
+/**
+ * Render every planner metric in Prometheus text exposition format
+ *
+ * @param service The query service to report on
+ * @return The metrics document
+ */
+string renderMetrics(const QueryService& service) {
+    const shared_ptr<const Catalog> current = service.Current();
+    string out;
+
+    out += "# HELP abcu_queries_total Queries answered, by type.\n"
+           "# TYPE abcu_queries_total counter\n";
+    for (size_t type = 0; type < queryTypeCount; type++) {
+        out += "abcu_queries_total{type=\"" + string(queryTypeNames[type]) + "\"} " +
+               to_string(plannerMetrics.queries[type].Value()) + '\n';
+    }
+    out += "# HELP abcu_query_duration_seconds Time to answer and write a query, by type.\n"
+           "# TYPE abcu_query_duration_seconds histogram\n";
+    for (size_t type = 0; type < queryTypeCount; type++) {
+        plannerMetrics.latency[type].Append(out, "abcu_query_duration_seconds",
+                                            "type=\"" + string(queryTypeNames[type]) + '"');
+    }
+    service.Cache().AppendMetrics(out);
+
+    out += "# HELP abcu_catalog_courses Courses in the current catalog.\n"
+           "# TYPE abcu_catalog_courses gauge\n"
+           "abcu_catalog_courses " + to_string(current->courses.Size()) + "\n"
+           "# HELP abcu_catalog_version Version of the current catalog.\n"
+           "# TYPE abcu_catalog_version gauge\n"
+           "abcu_catalog_version " + to_string(current->version) + "\n"
+           "# HELP abcu_tree_height Levels in the course search tree.\n"
+           "# TYPE abcu_tree_height gauge\n"
+           "abcu_tree_height " + to_string(current->courses.Height()) + "\n"
+           "# HELP abcu_prerequisite_graph_bytes Memory of the compressed prerequisite graph.\n"
+           "# TYPE abcu_prerequisite_graph_bytes gauge\n"
+           "abcu_prerequisite_graph_bytes " + to_string(current->graph.Bytes()) + "\n"
+           "# HELP abcu_title_dictionary_bytes Memory of the shared course title word dictionary.\n"
+           "# TYPE abcu_title_dictionary_bytes gauge\n"
+           "abcu_title_dictionary_bytes " + to_string(titleWords.Bytes()) + "\n"
+           "# HELP abcu_catalog_arena_bytes Memory of the course tree's arena.\n"
+           "# TYPE abcu_catalog_arena_bytes gauge\n"
+           "abcu_catalog_arena_bytes " + to_string(current->memory.InUse()) + "\n"
+           "# HELP abcu_catalog_loads_total Catalog files loaded.\n"
+           "# TYPE abcu_catalog_loads_total counter\n"
+           "abcu_catalog_loads_total " + to_string(plannerMetrics.loads.Value()) + "\n"
+           "# HELP abcu_catalog_load_duration_seconds Time to load a catalog file and build its indexes.\n"
+           "# TYPE abcu_catalog_load_duration_seconds histogram\n";
+    plannerMetrics.loadDuration.Append(out, "abcu_catalog_load_duration_seconds", "");
+
+#ifdef __linux__
+    // statm reports sizes in pages: total program size, then resident set
+    ifstream statm("/proc/self/statm");
+    uint64_t virtualPages = 0;
+    uint64_t residentPages = 0;
+    if (statm >> virtualPages >> residentPages) {
+        const auto pageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+        out += "# HELP process_resident_memory_bytes Resident memory size in bytes.\n"
+               "# TYPE process_resident_memory_bytes gauge\n"
+               "process_resident_memory_bytes " + to_string(residentPages * pageSize) + "\n"
+               "# HELP process_virtual_memory_bytes Virtual memory size in bytes.\n"
+               "# TYPE process_virtual_memory_bytes gauge\n"
+               "process_virtual_memory_bytes " + to_string(virtualPages * pageSize) + "\n";
+    }
+#endif
+    return out;
+}
+
+/**
+ * Rewrites a metrics file on an interval, for a textfile collector
+ * Each write goes to a temporary file that is renamed over the target,
+ * so a scraper never reads a half-written file. A final write happens on
+ * destruction.
+ */
+class MetricsFileWriter final {
+    const QueryService& service;
+    string filename;
+    chrono::milliseconds interval;
+    mutex lock;
+    condition_variable stopped;
+    bool stopping = false;
+    thread writer;
+
+    void write() const;
+
+public:
+    MetricsFileWriter(const QueryService& service, string filename, double intervalSeconds);
+    ~MetricsFileWriter();
+    MetricsFileWriter(const MetricsFileWriter&) = delete;
+    MetricsFileWriter& operator=(const MetricsFileWriter&) = delete;
+};
+
+/**
+ * Constructor
+ * Starts the writer thread.
+ *
+ * @param service The query service to report on
+ * @param filename Path of the metrics file
+ * @param intervalSeconds Seconds between writes
+ */
+MetricsFileWriter::MetricsFileWriter(const QueryService& service, string filename,
+                                     const double intervalSeconds)
+    : service(service), filename(std::move(filename)),
+      interval(max<int64_t>(1, static_cast<int64_t>(intervalSeconds * 1000))) {
+    writer = thread([this] {
+        unique_lock guard(lock);
+        while (!stopped.wait_for(guard, interval, [this] { return stopping; })) {
+            write();
+        }
+    });
+}
+
+/**
+ * Destructor
+ * Stops the writer and writes the final values.
+ */
+MetricsFileWriter::~MetricsFileWriter() {
+    {
+        lock_guard guard(lock);
+        stopping = true;
+    }
+    stopped.notify_one();
+    writer.join();
+    write();
+}
+
+// Write the metrics to a temporary file and rename it into place
+void MetricsFileWriter::write() const {
+    const string temporary = filename + ".tmp";
+    {
+        ofstream out(temporary, ios::trunc);
+        if (!out.is_open()) {
+            cerr << "Warning: Could not write metrics file " << temporary << endl;
+            return;
+        }
+        out << renderMetrics(service);
+    }
+    if (rename(temporary.c_str(), filename.c_str()) != 0) {
+        cerr << "Warning: Could not replace metrics file " << filename << endl;
+    }
+}
+
+/**
+ * Lock every mapped page of the process in memory
+ *
+ * @return true if the pages were locked
+ */
+bool lockMemory() {
+#ifdef __linux__
+    if (mlockall(MCL_CURRENT) == 0) {
+        return true;
+    }
+    cout << "Warning: Could not lock memory (" << strerror(errno)
+         << "); check the memlock limit" << endl;
+#else
+    cout << "Warning: Locking memory is only supported on Linux" << endl;
+#endif
+    return false;
+}
+
+/**
+ * Prefault the loaded catalogs and optionally lock them in memory
+ *
+ * @param service The query service holding the catalogs
+ * @param threadCount Threads to prefault with
+ * @param lock Whether to mlock the process afterwards
+ */
+void warmUpService(const QueryService& service, const unsigned threadCount, const bool lock) {
+    const auto start = chrono::steady_clock::now();
+    const size_t bytes = service.WarmUp(threadCount);
+    const auto elapsed = chrono::duration_cast<chrono::milliseconds>(
+        chrono::steady_clock::now() - start);
+
+    cout << "Warmed up " << bytes / 1024 << " KiB of catalog data in "
+         << elapsed.count() << " ms" << endl;
+    if (lock && lockMemory()) {
+        cout << "Locked catalog memory." << endl;
+    }
+}
+
+//============================================================================
+// Batch Query Mode
+//============================================================================
+
+/**
+ * Parse one batch line into a query
+ * Lines look like "course CSCI300", "list 0 50 [title]", "closure CSCI300",
+ * "eligible CSCI100,CSCI101 [CSCI300]", "complete 10 intro to",
+ * "filter 50 dept=CSCI level>=300" or "lookup CSCI100,CSCI300".
+ *
+ * @param line The input line
+ * @param query Receives the parsed query
+ * @return true if the line is a valid query
+ */
+bool parseBatchQuery(const string& line, Query& query) {
+    istringstream words(line);
+    string command;
+    words >> command;
+
+    if (command == "course" || command == "closure") {
+        query.type = command == "course" ? QueryType::Course : QueryType::Closure;
+        return static_cast<bool>(words >> query.key);
+    }
+    if (command == "list") {
+        query.type = QueryType::List;
+        words >> query.offset >> query.limit >> query.key;
+        return !words.bad();
+    }
+    if (command == "lookup") {
+        query.type = QueryType::Lookup;
+        return static_cast<bool>(words >> query.key);
+    }
+    if (command == "complete") {
+        query.type = QueryType::Complete;
+        if (!(words >> query.limit)) {
+            return false;
+        }
+        getline(words >> ws, query.key);
+        return true;
+    }
+    if (command == "filter") {
+        query.type = QueryType::Filter;
+        if (!(words >> query.limit)) {
+            return false;
+        }
+        getline(words >> ws, query.key);
+        return !query.key.empty();
+    }
+    if (command == "eligible") {
+        query.type = QueryType::Eligibility;
+        if (!(words >> query.key)) {
+            return false;
+        }
+        words >> query.course;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Run the batch query mode
+ * Queries are answered in parallel and written as one JSON line each, in
+ * input order. Identical queries in flight at the same time are computed
+ * once.
+ * Usage: --batch <file> [--input <file>] [--output <file>] [--threads <n>]
+ *        [--cache-entries <n>] [--warm-up] [--mlock] [--duplicates <policy>]
+ *        [--frequencies <file>] [--record <log>] [--slow-log <file>]
+ *        [--slow-threshold <ms>] [--metrics-file <file>]
+ *        [--metrics-interval <seconds>]
+ *
+ * @param args Command-line arguments
+ * @return Process exit code
+ */
+int runBatch(const vector<string>& args) {
+    constexpr size_t blockSize = 4096;
+
+    string catalogFile;
+    string inputFile;
+    string outputFile;
+    unsigned threadCount = max(1u, thread::hardware_concurrency());
+    size_t cacheEntries = 4096;
+    bool warmUp = false;
+    bool lock = false;
+    LoadOptions loadOptions;
+    string recordFile;
+    string slowLogFile;
+    double slowThreshold = 1.0;
+    string metricsFile;
+    double metricsInterval = 10.0;
+
+    for (size_t i = 0; i < args.size(); i++) {
+        const bool hasValue = i + 1 < args.size();
+        if (args[i] == "--batch" && hasValue) {
+            catalogFile = args[++i];
+        } else if (args[i] == "--input" && hasValue) {
+            inputFile = args[++i];
+        } else if (args[i] == "--output" && hasValue) {
+            outputFile = args[++i];
+        } else if (args[i] == "--threads" && hasValue) {
+            threadCount = max(1, atoi(args[++i].c_str()));
+        } else if (args[i] == "--cache-entries" && hasValue) {
+            cacheEntries = strtoul(args[++i].c_str(), nullptr, 10);
+        } else if (args[i] == "--warm-up") {
+            warmUp = true;
+        } else if (args[i] == "--mlock") {
+            warmUp = true;
+            lock = true;
+        } else if (args[i] == "--record" && hasValue) {
+            recordFile = args[++i];
+        } else if (args[i] == "--slow-log" && hasValue) {
+            slowLogFile = args[++i];
+        } else if (args[i] == "--slow-threshold" && hasValue) {
+            slowThreshold = strtod(args[++i].c_str(), nullptr);
+        } else if (args[i] == "--metrics-file" && hasValue) {
+            metricsFile = args[++i];
+        } else if (args[i] == "--metrics-interval" && hasValue) {
+            metricsInterval = strtod(args[++i].c_str(), nullptr);
+        } else if (parseLoadOption(args, i, loadOptions)) {
+            continue;
+        } else {
+            cout << "Error: Unknown batch option " << args[i] << endl;
+            return 1;
+        }
+    }
+
+    if (catalogFile.empty()) {
+        cout << "Usage: ABCUCoursePlanner --batch <file> [--input <file>] "
+                "[--output <file>] [--threads <n>] [--cache-entries <n>] "
+                "[--warm-up] [--mlock] [--duplicates <policy>] "
+                "[--frequencies <file>] [--snapshot-cache <dir|off>] [--record <log>] "
+                "[--slow-log <file>] "
+                "[--slow-threshold <ms>] [--metrics-file <file>] "
+                "[--metrics-interval <seconds>]" << endl;
+        return 1;
+    }
+
+    ifstream inputStream;
+    if (!inputFile.empty()) {
+        inputStream.open(inputFile);
+        if (!inputStream.is_open()) {
+            cout << "Error: Could not open file " << inputFile << endl;
+            return 1;
+        }
+    }
+    ofstream outputStream;
+    if (!outputFile.empty()) {
+        outputStream.open(outputFile);
+        if (!outputStream.is_open()) {
+            cout << "Error: Could not open file " << outputFile << endl;
+            return 1;
+        }
+    }
+    istream& in = inputFile.empty() ? cin : inputStream;
+    ostream& out = outputFile.empty() ? cout : outputStream;
+
+    auto catalog = make_shared<Catalog>();
+    if (!loadCatalog(catalogFile, catalog.get(), loadOptions)) {
+        return 1;
+    }
+    QueryService service(std::move(catalog), cacheEntries);
+    QueryLog queryLog;
+    if (!recordFile.empty()) {
+        if (!queryLog.Open(recordFile)) {
+            return 1;
+        }
+        service.SetLog(&queryLog);
+    }
+    SlowQueryLog slowLog(slowThreshold);
+    if (!slowLogFile.empty()) {
+        if (!slowLog.Open(slowLogFile)) {
+            return 1;
+        }
+        service.SetSlowLog(&slowLog);
+    }
+    unique_ptr<MetricsFileWriter> metrics;
+    if (!metricsFile.empty()) {
+        service.EnableLatencyMetrics();
+        metrics = make_unique<MetricsFileWriter>(service, metricsFile, metricsInterval);
+    }
+    if (warmUp) {
+        warmUpService(service, threadCount, lock);
+    }
+
+    vector<string> lines;
+    vector<string> results;
+    size_t total = 0;
+    string line;
+
+    while (true) {
+        // Read the next block, skipping blanks and comments
+        lines.clear();
+        while (lines.size() < blockSize && getline(in, line)) {
+            if (!line.empty() && line[0] != '#') {
+                lines.push_back(line);
+            }
+        }
+        if (lines.empty()) {
+            break;
+        }
+
+        // Answer the block in parallel, each thread claiming the next line
+        results.assign(lines.size(), string());
+        atomic<size_t> next{0};
+        auto worker = [&] {
+            for (size_t i = next++; i < lines.size(); i = next++) {
+                Query query;
+                if (!parseBatchQuery(lines[i], query)) {
+                    appendJsonError(results[i], "invalid query: " + lines[i]);
+                    continue;
+                }
+                results[i] = service.Execute(query).body;
+                service.FinishQuery();
+            }
+        };
+        vector<thread> workers;
+        for (unsigned t = 1; t < threadCount; t++) {
+            workers.emplace_back(worker);
+        }
+        worker();
+        for (auto& thread : workers) {
+            thread.join();
+        }
+
+        for (const auto& result : results) {
+            out << result << '\n';
+        }
+        total += lines.size();
+    }
+    out.flush();
+
+    cerr << "Processed " << total << " queries." << endl;
+    service.Cache().PrintStats(cerr);
+    if (!loadOptions.frequencyFile.empty()) {
+        saveFrequencies(loadOptions.frequencyFile, *service.Merged());
+    }
+    return 0;
+}
+
+//============================================================================
+// Query Replay
+//============================================================================
+
+/**
+ * Get a percentile from sorted latencies
+ *
+ * @param sorted Latencies in ascending order
+ * @param percentile Percentile between 0 and 100
+ * @return The latency at that percentile
+ */
+double percentileOf(const vector<double>& sorted, const double percentile) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    const auto index = static_cast<size_t>(percentile / 100.0 * static_cast<double>(sorted.size() - 1) + 0.5);
+    return sorted[min(index, sorted.size() - 1)];
+}
+
+/**
+ * Run the query replay benchmark
+ * Drives a recorded workload against a catalog, either at the recorded
+ * pace or as fast as possible. At the recorded pace, latency is measured
+ * from each query's scheduled time, so queueing delay is included.
+ * Usage: --replay <log> <catalog file> [--max-speed] [--threads <n>]
+ *        [--cache-entries <n>] [--duplicates <policy>]
+ *
+ * @param args Command-line arguments
+ * @return Process exit code
+ */
+int runReplay(const vector<string>& args) {
+    vector<string> files;
+    bool maxSpeed = false;
+    unsigned threadCount = max(1u, thread::hardware_concurrency());
+    size_t cacheEntries = 4096;
+    LoadOptions loadOptions;
+
+    for (size_t i = 1; i < args.size(); i++) {
+        const bool hasValue = i + 1 < args.size();
+        if (args[i] == "--max-speed") {
+            maxSpeed = true;
+        } else if (args[i] == "--threads" && hasValue) {
+            threadCount = max(1, atoi(args[++i].c_str()));
+        } else if (args[i] == "--cache-entries" && hasValue) {
+            cacheEntries = strtoul(args[++i].c_str(), nullptr, 10);
+        } else if (parseLoadOption(args, i, loadOptions)) {
+            continue;
+        } else if (args[i].starts_with("--")) {
+            cout << "Error: Unknown replay option " << args[i] << endl;
+            return 1;
+        } else {
+            files.push_back(args[i]);
+        }
+    }
+
+    if (files.size() != 2) {
+        cout << "Usage: ABCUCoursePlanner --replay <log> <catalog file> [--max-speed] "
+                "[--threads <n>] [--cache-entries <n>] [--duplicates <policy>]" << endl;
+        return 1;
+    }
+
+    vector<pair<uint64_t, Query>> records;
+    if (!QueryLog::Read(files[0], &records)) {
+        return 1;
+    }
+    auto catalog = make_shared<Catalog>();
+    if (!loadCatalog(files[1], catalog.get(), loadOptions)) {
+        return 1;
+    }
+    QueryService service(std::move(catalog), cacheEntries);
+
+    cout << "Replaying " << records.size() << " queries "
+         << (maxSpeed ? "at maximum speed" : "at recorded speed") << " with "
+         << threadCount << " threads..." << endl;
+
+    vector<double> latencies(records.size());
+    atomic<size_t> next{0};
+    const auto start = chrono::steady_clock::now();
+
+    auto worker = [&] {
+        for (size_t i = next++; i < records.size(); i = next++) {
+            auto begin = chrono::steady_clock::now();
+            if (!maxSpeed) {
+                // Sleep most of the gap, then spin so timer slack does not
+                // show up as latency
+                const auto scheduled = start + chrono::microseconds(records[i].first);
+                this_thread::sleep_until(scheduled - chrono::microseconds(200));
+                while (chrono::steady_clock::now() < scheduled) {
+                }
+                begin = scheduled;
+            }
+            service.Execute(records[i].second);
+            latencies[i] = chrono::duration<double, micro>(chrono::steady_clock::now() - begin).count();
+        }
+    };
+    vector<thread> workers;
+    for (unsigned t = 1; t < threadCount; t++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : workers) {
+        thread.join();
+    }
+
+    const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    ranges::sort(latencies);
+
+    cout << fixed << setprecision(1);
+    cout << "Replayed " << records.size() << " queries in " << seconds << " s ("
+         << (seconds > 0 ? static_cast<double>(records.size()) / seconds : 0) << " queries/s)" << endl;
+    cout << "Latency (us): p50 " << percentileOf(latencies, 50)
+         << ", p90 " << percentileOf(latencies, 90)
+         << ", p99 " << percentileOf(latencies, 99)
+         << ", p99.9 " << percentileOf(latencies, 99.9)
+         << ", max " << (latencies.empty() ? 0 : latencies.back()) << endl;
+    cout.unsetf(ios::floatfield);
+    service.Cache().PrintStats(cout);
+    return 0;
+}
+
+//============================================================================
+// Catalog Diff
+//============================================================================
+
+/**
+ * Print a list of course numbers after a label
+ *
+ * @param out Stream to print to
+ * @param label Text before the list
+ * @param numbers Course numbers to print
+ */
+void printNumberList(ostream& out, const char* label, const vector<string>& numbers) {
+    if (numbers.empty()) {
+        return;
+    }
+    out << "    " << label;
+    for (size_t i = 0; i < numbers.size(); i++) {
+        out << (i == 0 ? " " : ", ") << numbers[i];
+    }
+    out << '\n';
+}
+
+/**
+ * Print the differences between two versions of one course
+ *
+ * @param out Stream to print to
+ * @param before The course in the old catalog
+ * @param after The course in the new catalog
+ * @return true if the course changed
+ */
+bool diffCourse(ostream& out, const Course& before, const Course& after) {
+    vector<string> oldPrereqs(before.prerequisites.begin(), before.prerequisites.end());
+    vector<string> newPrereqs(after.prerequisites.begin(), after.prerequisites.end());
+    ranges::sort(oldPrereqs);
+    ranges::sort(newPrereqs);
+
+    const bool titleChanged = before.courseTitle != after.courseTitle;
+    const bool creditsChanged = before.credits != after.credits;
+    if (!titleChanged && !creditsChanged && oldPrereqs == newPrereqs) {
+        return false;
+    }
+
+    out << "~ " << after.courseNumber << '\n';
+    if (titleChanged) {
+        out << "    title: " << before.courseTitle << " -> " << after.courseTitle << '\n';
+    }
+    if (creditsChanged) {
+        out << "    credits: " << (before.credits < 0 ? "none" : to_string(before.credits)) << " -> "
+            << (after.credits < 0 ? "none" : to_string(after.credits)) << '\n';
+    }
+
+    vector<string> added;
+    vector<string> removed;
+    ranges::set_difference(newPrereqs, oldPrereqs, back_inserter(added));
+    ranges::set_difference(oldPrereqs, newPrereqs, back_inserter(removed));
+    printNumberList(out, "prerequisites added:", added);
+    printNumberList(out, "prerequisites removed:", removed);
+    return true;
+}
+
+/**
+ * Print how two catalog files differ
+ * Both files are read and sorted by course number in parallel, then merged
+ * in one pass that streams each difference as soon as it is found.
+ *
+ * @param oldFile Path to the earlier catalog
+ * @param newFile Path to the later catalog
+ * @param options Duplicate handling and other load settings
+ * @param out Stream receiving the report
+ * @return true if both files were read
+ */
+bool diffCatalogs(const string& oldFile, const string& newFile,
+                  const LoadOptions& options, ostream& out) {
+    pmr::vector<Course> sides[2];
+    bool loaded[2] = {false, false};
+
+    auto readSorted = [&](const int side, const string& filename) {
+        EquivalencyTable equivalencies;
+        loaded[side] = readCourseFile(filename, &sides[side], &equivalencies, options);
+        ranges::sort(sides[side], {}, &Course::courseNumber);
+    };
+    thread reader(readSorted, 0, cref(oldFile));
+    readSorted(1, newFile);
+    reader.join();
+
+    if (!loaded[0] || !loaded[1]) {
+        return false;
+    }
+
+    const pmr::vector<Course>& before = sides[0];
+    const pmr::vector<Course>& after = sides[1];
+    size_t added = 0;
+    size_t removed = 0;
+    size_t changed = 0;
+    size_t unchanged = 0;
+    size_t i = 0;
+    size_t j = 0;
+
+    while (i < before.size() || j < after.size()) {
+        if (j == after.size() ||
+            (i < before.size() && before[i].courseNumber < after[j].courseNumber)) {
+            out << "- " << before[i].courseNumber << ", " << before[i].courseTitle << '\n';
+            removed++;
+            i++;
+        } else if (i == before.size() || after[j].courseNumber < before[i].courseNumber) {
+            out << "+ " << after[j].courseNumber << ", " << after[j].courseTitle << '\n';
+            added++;
+            j++;
+        } else {
+            diffCourse(out, before[i], after[j]) ? changed++ : unchanged++;
+            i++;
+            j++;
+        }
+    }
+
+    out << added << " added, " << removed << " removed, " << changed << " changed, "
+        << unchanged << " unchanged" << endl;
+    return true;
+}
+
+/**
+ * Run the catalog diff mode
+ * Usage: --diff <old file> <new file> [--duplicates <policy>]
+ *
+ * @param args Command-line arguments
+ * @return Process exit code
+ */
+int runDiff(const vector<string>& args) {
+    vector<string> files;
+    LoadOptions loadOptions;
+
+    for (size_t i = 1; i < args.size(); i++) {
+        if (parseLoadOption(args, i, loadOptions)) {
+            continue;
+        }
+        if (args[i].starts_with("--")) {
+            cout << "Error: Unknown diff option " << args[i] << endl;
+            return 1;
+        }
+        files.push_back(args[i]);
+    }
+
+    if (files.size() != 2) {
+        cout << "Usage: ABCUCoursePlanner --diff <old file> <new file> "
+                "[--duplicates <policy>]" << endl;
+        return 1;
+    }
+
+    return diffCatalogs(files[0], files[1], loadOptions, cout) ? 0 : 1;
+}
+
+//============================================================================
+// Course Archive
+//============================================================================
+
+/**
+ * Run the course archive mode over a disk-resident B+tree index
+ * "add" loads one catalog file and inserts its courses, optionally under
+ * a label such as a year ("2005/CSCI300"), so every version of every
+ * catalog can share one index. "find" prints one course and "list"
+ * prints courses in order, optionally only those starting with a prefix.
+ * Memory use is bounded by --pool-pages (4 KiB each), apart from the one
+ * catalog being added.
+ * Usage: --archive <index> add <catalog file> [--label <label>]
+ *        --archive <index> find <course number>
+ *        --archive <index> list [<prefix>]
+ *        [--pool-pages <n>] [--duplicates <policy>]
+ *
+ * @param args Command-line arguments
+ * @return Process exit code
+ */
+int runArchive(const vector<string>& args) {
+    vector<string> words;
+    string label;
+    size_t poolPages = 1024;
+    LoadOptions loadOptions;
+
+    for (size_t i = 1; i < args.size(); i++) {
+        const bool hasValue = i + 1 < args.size();
+        if (args[i] == "--label" && hasValue) {
+            label = toUpperCase(args[++i]);
+        } else if (args[i] == "--pool-pages" && hasValue) {
+            poolPages = strtoul(args[++i].c_str(), nullptr, 10);
+        } else if (parseLoadOption(args, i, loadOptions)) {
+            continue;
+        } else if (args[i].starts_with("--")) {
+            cout << "Error: Unknown archive option " << args[i] << endl;
+            return 1;
+        } else {
+            words.push_back(args[i]);
+        }
+    }
+
+    const bool valid = words.size() >= 2 &&
+                       ((words[1] == "add" && words.size() == 3) ||
+                        (words[1] == "find" && words.size() == 3) ||
+                        (words[1] == "list" && words.size() <= 3));
+    if (!valid) {
+        cout << "Usage: ABCUCoursePlanner --archive <index> add <catalog file> [--label <label>] | "
+                "find <course number> | list [<prefix>] [--pool-pages <n>]" << endl;
+        return 1;
+    }
+
+    DiskBPlusTree index;
+    if (!index.Open(words[0], poolPages)) {
+        return 1;
+    }
+
+    if (words[1] == "add") {
+        BinarySearchTree courses;
+        EquivalencyTable equivalencies;
+        if (!loadCourses(words[2], &courses, &equivalencies, loadOptions)) {
+            return 1;
+        }
+
+        bool inserted = true;
+        courses.ForEach([&](const Course& course) {
+            if (!inserted) {
+                return;
+            }
+            Course archived = course;
+            if (!label.empty()) {
+                archived.courseNumber = label + "/";
+                archived.courseNumber += course.courseNumber;
+            }
+            inserted = index.Insert(archived);
+        });
+        if (!inserted || !index.Flush()) {
+            return 1;
+        }
+        cout << "Archive holds " << index.Size() << " courses." << endl;
+    } else if (words[1] == "find") {
+        const Course course = index.Search(toUpperCase(words[2]));
+        if (course.courseNumber.empty()) {
+            cout << "Course " << words[2] << " not found." << endl;
+            return 1;
+        }
+        printCourseDetails(course);
+    } else if (words.size() == 2) {
+        index.InOrder();
+    } else {
+        const string prefix = toUpperCase(words[2]);
+        index.Scan(prefix, [&](const Course& course) {
+            if (!course.courseNumber.starts_with(prefix)) {
+                return false;
+            }
+            cout << course.courseNumber << ", " << course.courseTitle << endl;
+            return true;
+        });
+    }
+
+    index.Pool().PrintStats(cerr);
+    return 0;
+}
+
+//============================================================================
+// Succinct Index Mode
+//============================================================================
+
+/**
+ * Estimate the memory a course tree holds: its nodes, and every string
+ * and list its courses own
+ *
+ * @param tree The tree to measure
+ * @return Bytes held by nodes and their heap allocations
+ */
+size_t treeBytes(const BinarySearchTree& tree) {
+    // Short strings live inside the string object and cost nothing extra
+    auto heapBytes = [](const pmr::string& text) -> size_t {
+        const auto* inside = reinterpret_cast<const char*>(&text);
+        const bool isInline = text.data() >= inside && text.data() < inside + sizeof(text);
+        return isInline ? 0 : text.capacity() + 1;
+    };
+
+    size_t bytes = 0;
+    tree.ForEach([&](const Course& course) {
+        bytes += BinarySearchTree::nodeBytes + heapBytes(course.courseNumber) + course.courseTitle.HeapBytes() +
+                 course.prerequisites.capacity() * sizeof(pmr::string) +
+                 course.prerequisiteClasses.capacity() * sizeof(int);
+        for (const auto& prereq : course.prerequisites) {
+            bytes += heapBytes(prereq);
+        }
+    });
+    return bytes;
+}
+
+/**
+ * Run the succinct index mode
+ * Loads a catalog, encodes its tree with SuccinctCourseIndex, releases
+ * the catalog and answers from the encoding alone, then reports both
+ * sizes. "find" prints one course and "list" prints courses in order,
+ * optionally only those starting with a prefix. --frequencies shapes the
+ * encoded tree around lookup counts as in the other modes.
+ * Usage: --succinct <catalog file> find <course number>
+ *        --succinct <catalog file> list [<prefix>]
+ *        [--duplicates <policy>] [--frequencies <file>]
+ *
+ * @param args Command-line arguments
+ * @return Process exit code
+ */
+int runSuccinct(const vector<string>& args) {
+    vector<string> words;
+    LoadOptions loadOptions;
+    for (size_t i = 1; i < args.size(); i++) {
+        if (parseLoadOption(args, i, loadOptions)) {
+            continue;
+        }
+        if (args[i].starts_with("--")) {
+            cout << "Error: Unknown succinct option " << args[i] << endl;
+            return 1;
+        }
+        words.push_back(args[i]);
+    }
+
+    const bool valid = words.size() >= 2 &&
+                       ((words[1] == "find" && words.size() == 3) ||
+                        (words[1] == "list" && words.size() <= 3));
+    if (!valid) {
+        cout << "Usage: ABCUCoursePlanner --succinct <catalog file> find <course number> | "
+                "list [<prefix>] [--duplicates <policy>] [--frequencies <file>]" << endl;
+        return 1;
+    }
+
+    SuccinctCourseIndex index;
+    size_t unencoded;
+    {
+        Catalog catalog;
+        if (!loadCatalog(words[0], &catalog, loadOptions)) {
+            return 1;
+        }
+        index.Build(catalog.courses);
+        unencoded = treeBytes(catalog.courses);
+    }
+
+    int status = 0;
+    if (words[1] == "find") {
+        Course course;
+        if (!index.Find(toUpperCase(words[2]), &course)) {
+            cout << "Course " << words[2] << " not found." << endl;
+            status = 1;
+        } else {
+            printCourseDetails(course);
+        }
+    } else {
+        const string prefix = words.size() == 3 ? toUpperCase(words[2]) : string();
+        index.ForEach([&](const Course& course) {
+            if (course.courseNumber.starts_with(prefix)) {
+                cout << course << endl;
+            }
+        });
+    }
+
+    cerr << "Succinct index: " << index.Size() << " courses in " << index.Bytes() << " bytes; tree: "
+         << unencoded << " bytes (" << fixed << setprecision(1)
+         << static_cast<double>(unencoded) / static_cast<double>(max<size_t>(1, index.Bytes()))
+         << "x)" << endl;
+    return status;
+}
+
+//============================================================================
+// Catalog Replication
+//============================================================================
+
+#ifdef __linux__
+
+/**
+ * Write a whole buffer to a blocking socket
+ *
+ * @param fd Connected socket
+ * @param data Bytes to send
+ * @return true if everything was sent
+ */
+bool sendAll(const int fd, string_view data) {
+    while (!data.empty()) {
+        const ssize_t sent = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        data.remove_prefix(static_cast<size_t>(sent));
+    }
+    return true;
+}
+
+/**
+ * Check whether the peer of a socket that it never writes to has gone
+ *
+ * @param fd Connected socket
+ * @return true if the peer closed or reset the connection
+ */
+bool peerClosed(const int fd) {
+    char byte;
+    const ssize_t received = recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+}
+
+/**
+ * Buffered reader of newline-terminated headers and fixed-size payloads
+ * from a blocking socket
+ */
+class SocketReader final {
+    int fd;
+    string buffer;
+    size_t position = 0;
+
+    bool fill();
+
+public:
+    explicit SocketReader(int fd);
+    bool ReadLine(string& line);
+    bool ReadExact(size_t length, string& data);
+};
+
+/**
+ * Constructor
+ *
+ * @param fd Connected socket to read from
+ */
+SocketReader::SocketReader(const int fd) : fd(fd) {
+}
+
+// Read more bytes into the buffer, dropping what has been consumed
+bool SocketReader::fill() {
+    buffer.erase(0, position);
+    position = 0;
+
+    char chunk[64 * 1024];
+    while (true) {
+        const ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        buffer.append(chunk, static_cast<size_t>(received));
+        return true;
+    }
+}
+
+/**
+ * Read up to the next newline
+ *
+ * @param line Receives the line without its newline
+ * @return false if the connection closed first
+ */
+bool SocketReader::ReadLine(string& line) {
+    size_t end;
+    while ((end = buffer.find('\n', position)) == string::npos) {
+        if (buffer.size() - position > 4096 || !fill()) {
+            return false;
+        }
+    }
+    line.assign(buffer, position, end - position);
+    position = end + 1;
+    return true;
+}
+
+/**
+ * Read an exact number of bytes
+ *
+ * @param length Number of bytes to read
+ * @param data Receives the bytes
+ * @return false if the connection closed first
+ */
+bool SocketReader::ReadExact(const size_t length, string& data) {
+    while (buffer.size() - position < length) {
+        if (!fill()) {
+            return false;
+        }
+    }
+    data.assign(buffer, position, length);
+    position += length;
+    return true;
+}
+
+/**
+ * Open a TCP connection
+ *
+ * @param address IPv4 address and port, such as 127.0.0.1:9090
+ * @return The connected socket, or -1 on failure
+ */
+int connectTo(const string& address) {
+    const size_t colon = address.rfind(':');
+    sockaddr_in target{};
+    target.sin_family = AF_INET;
+    if (colon == string::npos ||
+        inet_pton(AF_INET, address.substr(0, colon).c_str(), &target.sin_addr) != 1) {
+        return -1;
+    }
+    target.sin_port = htons(static_cast<uint16_t>(atoi(address.c_str() + colon + 1)));
+
+    const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, reinterpret_cast<sockaddr*>(&target), sizeof(target)) != 0) {
+        close(fd);
+        return -1;
+    }
+    constexpr int enable = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    return fd;
+}
+
+/**
+ * Primary side of catalog replication
+ * Keeps a bounded log of the edits that produced each recent catalog
+ * version and streams them to every connected replica. A replica sends
+ * "SUBSCRIBE <version>" and receives frames of the form
+ * "EDITS <version> <bytes>\n<edit lines>" for each later version, or a
+ * single "SNAPSHOT <version> <bytes>\n<catalog text>" when the log no
+ * longer covers its version. The latest version is also kept in a file,
+ * so a restarted primary carries on numbering above what its replicas hold.
+ */
+class ReplicationPrimary final {
+    static constexpr size_t retainedVersions = 4096;
+    static constexpr int handshakeSeconds = 10;
+
+    // The edits that turned the previous version into this one; snapshot
+    // marks versions that edits cannot describe
+    struct LoggedEdits {
+        uint64_t version;
+        string edits;
+        bool snapshot;
+    };
+
+    mutable mutex lock;
+    condition_variable changed;
+    shared_ptr<const Catalog> latest;
+    deque<LoggedEdits> log;
+    // One connected replica; done is set once its thread has closed the socket
+    struct Subscriber {
+        int fd;
+        bool done = false;
+        thread worker;
+    };
+
+    bool stopping = false;
+    int listener = -1;
+    thread acceptor;
+    list<Subscriber> subscribers;
+    string versionFile;
+
+    void acceptReplicas();
+    void serve(Subscriber& subscriber);
+    void saveVersion(uint64_t version) const;
+
+public:
+    ReplicationPrimary() = default;
+    ~ReplicationPrimary();
+    ReplicationPrimary(const ReplicationPrimary&) = delete;
+    ReplicationPrimary& operator=(const ReplicationPrimary&) = delete;
+    static uint64_t SavedVersion(const string& filename);
+    bool Start(const string& bindAddress, int port, shared_ptr<const Catalog> current,
+               const string& versionFile);
+    void Append(shared_ptr<const Catalog> current, string edits, bool snapshot);
+};
+
+/**
+ * Destructor
+ * Disconnects every replica and stops accepting new ones.
+ */
+ReplicationPrimary::~ReplicationPrimary() {
+    {
+        lock_guard guard(lock);
+        stopping = true;
+        for (const Subscriber& subscriber : subscribers) {
+            if (!subscriber.done) {
+                shutdown(subscriber.fd, SHUT_RDWR);
+            }
+        }
+    }
+    changed.notify_all();
+    if (listener >= 0) {
+        shutdown(listener, SHUT_RDWR);
+    }
+    if (acceptor.joinable()) {
+        acceptor.join();
+    }
+    for (Subscriber& subscriber : subscribers) {
+        subscriber.worker.join();
+    }
+    if (listener >= 0) {
+        close(listener);
+    }
+}
+
+/**
+ * Read the version a primary last published
+ *
+ * @param filename Version file written by an earlier run
+ * @return The version, or 0 if there is no readable file
+ */
+uint64_t ReplicationPrimary::SavedVersion(const string& filename) {
+    ifstream file(filename);
+    uint64_t version = 0;
+    if (!(file >> version)) {
+        return 0;
+    }
+    return version;
+}
+
+// Write the latest version to a temporary file and rename it into place
+void ReplicationPrimary::saveVersion(const uint64_t version) const {
+    const string temporary = versionFile + ".tmp";
+    {
+        ofstream out(temporary, ios::trunc);
+        if (!(out << version << '\n')) {
+            cerr << "Warning: Could not write version file " << temporary << endl;
+            return;
+        }
+    }
+    if (rename(temporary.c_str(), versionFile.c_str()) != 0) {
+        cerr << "Warning: Could not replace version file " << versionFile << endl;
+    }
+}
+
+/**
+ * Listen for replicas
+ *
+ * @param bindAddress IPv4 address to listen on
+ * @param port Replication port
+ * @param current The catalog replicas start from
+ * @param versionFile File keeping the latest version across restarts
+ * @return true if the listener was opened
+ */
+bool ReplicationPrimary::Start(const string& bindAddress, const int port,
+                               shared_ptr<const Catalog> current, const string& versionFile) {
+    this->versionFile = versionFile;
+    saveVersion(current->version);
+    latest = std::move(current);
+
+    listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    constexpr int enable = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    if (listener < 0 || inet_pton(AF_INET, bindAddress.c_str(), &address.sin_addr) != 1 ||
+        bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(listener, SOMAXCONN) != 0) {
+        cout << "Error: Could not listen for replicas on " << bindAddress << ":" << port << endl;
+        return false;
+    }
+
+    acceptor = thread(&ReplicationPrimary::acceptReplicas, this);
+    cout << "Accepting replicas on " << bindAddress << ":" << port << endl;
+    return true;
+}
+
+/**
+ * Record a newly published version and wake every replica
+ * Callers must append versions in the order they were published.
+ *
+ * @param current The catalog just published
+ * @param edits Edit lines that turn the previous version into this one
+ * @param snapshot true if the edits cannot describe the change
+ */
+void ReplicationPrimary::Append(shared_ptr<const Catalog> current, string edits, const bool snapshot) {
+    // Saved before any replica can see the version
+    saveVersion(current->version);
+    {
+        lock_guard guard(lock);
+        log.push_back({current->version, std::move(edits), snapshot});
+        if (log.size() > retainedVersions) {
+            log.pop_front();
+        }
+        latest = std::move(current);
+    }
+    changed.notify_all();
+}
+
+// Accept replicas until shut down, one streaming thread each, joining
+// the threads of replicas that have disconnected since the last accept
+void ReplicationPrimary::acceptReplicas() {
+    while (true) {
+        const int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        list<Subscriber> finished;
+        {
+            lock_guard guard(lock);
+            if (stopping) {
+                if (fd >= 0) {
+                    close(fd);
+                }
+                return;
+            }
+            for (auto it = subscribers.begin(); it != subscribers.end();) {
+                const auto next = std::next(it);
+                if (it->done) {
+                    finished.splice(finished.end(), subscribers, it);
+                }
+                it = next;
+            }
+            if (fd >= 0) {
+                constexpr int enable = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+                // A client that never sends SUBSCRIBE must not hold its thread forever
+                const timeval timeout{handshakeSeconds, 0};
+                setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                Subscriber& subscriber = subscribers.emplace_back(fd);
+                subscriber.worker = thread(&ReplicationPrimary::serve, this, ref(subscriber));
+            }
+        }
+        for (Subscriber& subscriber : finished) {
+            subscriber.worker.join();
+        }
+    }
+}
+
+// Stream one replica: catch it up, then send each version as it appears
+void ReplicationPrimary::serve(Subscriber& subscriber) {
+    const int fd = subscriber.fd;
+    SocketReader reader(fd);
+    string request;
+    uint64_t known = 0;
+    if (reader.ReadLine(request) && request.starts_with("SUBSCRIBE ")) {
+        known = strtoull(request.c_str() + 10, nullptr, 10);
+
+        bool gone = false;
+        while (true) {
+            string frames;
+            shared_ptr<const Catalog> snapshot;
+            {
+                // Replicas send nothing after subscribing, so a replica that
+                // disconnects while idle is noticed by polling its socket
+                unique_lock guard(lock);
+                while (!changed.wait_for(guard, chrono::seconds(1),
+                                         [&] { return stopping || latest->version != known; })) {
+                    if (peerClosed(fd)) {
+                        gone = true;
+                        break;
+                    }
+                }
+                if (stopping || gone) {
+                    break;
+                }
+
+                // The log can catch the replica up if it holds every later version
+                bool fromLog = known != 0 && known < latest->version &&
+                               !log.empty() && log.front().version <= known + 1;
+                for (const LoggedEdits& entry : log) {
+                    if (fromLog && entry.version > known) {
+                        if (entry.snapshot) {
+                            fromLog = false;
+                            break;
+                        }
+                        frames += "EDITS " + to_string(entry.version) + ' ' +
+                                  to_string(entry.edits.size()) + '\n' + entry.edits;
+                    }
+                }
+                if (!fromLog) {
+                    snapshot = latest;
+                }
+                known = latest->version;
+            }
+
+            // Snapshots are written outside the lock so publishing never waits
+            if (snapshot != nullptr) {
+                const string text = serializeCatalog(*snapshot);
+                frames = "SNAPSHOT " + to_string(snapshot->version) + ' ' +
+                         to_string(text.size()) + '\n' + text;
+            }
+            if (!sendAll(fd, frames)) {
+                break;
+            }
+        }
+    }
+
+    lock_guard guard(lock);
+    close(fd);
+    subscriber.done = true;
+}
+
+/**
+ * Replica side of catalog replication
+ * Follows a primary, applying each version to a local catalog and
+ * publishing it with the primary's version number. Readers keep using
+ * the previous version until the new one is published. On a lost
+ * connection it reconnects and resubscribes from its current version.
+ */
+class ReplicaClient final {
+    string primary;
+    mutex socketLock;
+    int fd = -1;
+    unique_ptr<SocketReader> reader;
+    atomic<bool> stopping{false};
+    thread follower;
+
+    bool subscribe(uint64_t version);
+    void disconnect();
+    bool readFrame(string& kind, uint64_t& version, string& payload);
+    void follow(QueryService& service);
+
+public:
+    explicit ReplicaClient(string primary);
+    ~ReplicaClient();
+    ReplicaClient(const ReplicaClient&) = delete;
+    ReplicaClient& operator=(const ReplicaClient&) = delete;
+    shared_ptr<Catalog> Bootstrap(uint64_t* version);
+    void Follow(QueryService& service);
+    void Stop();
+};
+
+/**
+ * Constructor
+ *
+ * @param primary Primary's replication address, such as 127.0.0.1:9090
+ */
+ReplicaClient::ReplicaClient(string primary) : primary(std::move(primary)) {
+}
+
+/**
+ * Destructor
+ */
+ReplicaClient::~ReplicaClient() {
+    Stop();
+}
+
+/**
+ * Stop following the primary
+ * Must be called before the query service being updated is destroyed.
+ */
+void ReplicaClient::Stop() {
+    stopping = true;
+    {
+        lock_guard guard(socketLock);
+        if (fd >= 0) {
+            shutdown(fd, SHUT_RDWR);
+        }
+    }
+    if (follower.joinable()) {
+        follower.join();
+    }
+    disconnect();
+}
+
+// Connect and ask for every version after the given one
+bool ReplicaClient::subscribe(const uint64_t version) {
+    const int connection = connectTo(primary);
+    if (connection < 0) {
+        return false;
+    }
+    if (!sendAll(connection, "SUBSCRIBE " + to_string(version) + '\n')) {
+        close(connection);
+        return false;
+    }
+
+    lock_guard guard(socketLock);
+    fd = connection;
+    reader = make_unique<SocketReader>(fd);
+    return true;
+}
+
+// Close the connection to the primary, if open
+void ReplicaClient::disconnect() {
+    lock_guard guard(socketLock);
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+    reader.reset();
+}
+
+// Read one EDITS or SNAPSHOT frame
+bool ReplicaClient::readFrame(string& kind, uint64_t& version, string& payload) {
+    string header;
+    size_t length = 0;
+    if (!reader->ReadLine(header)) {
+        return false;
+    }
+    istringstream words(header);
+    return static_cast<bool>(words >> kind >> version >> length) &&
+           (kind == "EDITS" || kind == "SNAPSHOT") && reader->ReadExact(length, payload);
+}
+
+/**
+ * Connect to the primary and load its current catalog
+ * Retries until the primary answers.
+ *
+ * @param version Receives the primary's version of the catalog
+ * @return The catalog, or nullptr if the primary sent an invalid snapshot
+ */
+shared_ptr<Catalog> ReplicaClient::Bootstrap(uint64_t* version) {
+    bool waiting = false;
+    while (!subscribe(0)) {
+        if (!waiting) {
+            cout << "Waiting for primary " << primary << "..." << endl;
+            waiting = true;
+        }
+        this_thread::sleep_for(chrono::milliseconds(500));
+    }
+
+    string kind;
+    string payload;
+    if (!readFrame(kind, *version, payload) || kind != "SNAPSHOT") {
+        cout << "Error: Could not read a snapshot from primary " << primary << endl;
+        return nullptr;
+    }
+    auto catalog = make_shared<Catalog>();
+    istringstream text(payload);
+    if (!loadCatalog(text, "primary " + primary, catalog.get(), LoadOptions())) {
+        return nullptr;
+    }
+    cout << "Following primary " << primary << " from version " << *version << endl;
+    return catalog;
+}
+
+/**
+ * Start applying the primary's versions in the background
+ *
+ * @param service The service to publish each version to
+ */
+void ReplicaClient::Follow(QueryService& service) {
+    follower = thread(&ReplicaClient::follow, this, ref(service));
+}
+
+// Apply frames until stopped, reconnecting whenever the stream breaks
+void ReplicaClient::follow(QueryService& service) {
+    string kind;
+    string payload;
+    uint64_t version;
+    bool connected = true;
+
+    while (!stopping) {
+        if (reader == nullptr && !subscribe(service.Current()->version)) {
+            this_thread::sleep_for(chrono::milliseconds(500));
+            continue;
+        }
+        if (!readFrame(kind, version, payload)) {
+            if (connected && !stopping) {
+                cout << "Lost connection to primary " << primary << "; reconnecting" << endl;
+            }
+            connected = false;
+            disconnect();
+            this_thread::sleep_for(chrono::milliseconds(100));
+            continue;
+        }
+        connected = true;
+
+        const shared_ptr<const Catalog> current = service.Current();
+        auto next = make_shared<Catalog>();
+        string error;
+        bool applied;
+        if (kind == "SNAPSHOT") {
+            istringstream text(payload);
+            applied = loadCatalog(text, "primary " + primary, next.get(), LoadOptions());
+        } else if (current->version + 1 != version) {
+            error = "edits for version " + to_string(version) + " do not follow version " +
+                    to_string(current->version);
+            applied = false;
+        } else {
+            applied = applyCatalogEdits(*current, payload, next.get(), &error);
+        }
+
+        // Resubscribing from the current version brings a snapshot or the
+        // missing edits
+        if (!applied) {
+            cout << "Error: Could not apply version " << version << " from primary"
+                 << (error.empty() ? "" : ": " + error) << endl;
+            disconnect();
+            continue;
+        }
+        service.Publish(std::move(next), version);
+    }
+}
+
+#endif
+
+//============================================================================
+// Catalog Sharding
+//============================================================================
+
+/**
+ * Consistent-hash ring assigning course numbers to shards
+ * Every shard owns many points on the ring and a course belongs to the
+ * first point at or after its hash, so shards get even shares and the
+ * router and every shard agree on ownership without coordinating.
+ */
+class ShardRing final {
+    static constexpr size_t pointsPerShard = 128;
+
+    vector<pair<uint64_t, uint32_t>> points;
+
+    static uint64_t hash(string_view text);
+
+public:
+    explicit ShardRing(size_t shardCount);
+    [[nodiscard]] size_t Owner(string_view courseNumber) const;
+};
+
+/**
+ * Constructor
+ *
+ * @param shardCount Number of shards, at least 1
+ */
+ShardRing::ShardRing(const size_t shardCount) {
+    for (uint32_t shard = 0; shard < shardCount; shard++) {
+        for (size_t point = 0; point < pointsPerShard; point++) {
+            points.emplace_back(hash("shard-" + to_string(shard) + '-' + to_string(point)), shard);
+        }
+    }
+    ranges::sort(points);
+}
+
+// 64-bit FNV-1a with a final avalanche, so similar course numbers spread out
+uint64_t ShardRing::hash(const string_view text) {
+    uint64_t value = 0xcbf29ce484222325ULL;
+    for (const char c : text) {
+        value = (value ^ static_cast<unsigned char>(c)) * 0x100000001b3ULL;
+    }
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    return value;
+}
+
+/**
+ * Get the shard owning a course number
+ *
+ * @param courseNumber Catalog course number, upper case
+ * @return The shard index
+ */
+size_t ShardRing::Owner(const string_view courseNumber) const {
+    const uint64_t key = hash(courseNumber);
+    const auto point = ranges::lower_bound(points, key, {}, &pair<uint64_t, uint32_t>::first);
+    return point == points.end() ? points.front().second : point->second;
+}
+
+/**
+ * Build one shard of a catalog
+ * The shard keeps only the courses it owns but the whole equivalency
+ * table, so it can resolve any transcript and check eligibility of its
+ * own courses without asking other shards.
+ *
+ * @param full The whole catalog
+ * @param ring Ownership of course numbers
+ * @param shard Index of the shard to build
+ * @return The shard's catalog
+ */
+shared_ptr<Catalog> shardCatalog(const Catalog& full, const ShardRing& ring, const size_t shard) {
+    vector<const Course*> owned;
+    full.courses.ForEach([&](const Course& course) {
+        if (ring.Owner(course.courseNumber) == shard) {
+            owned.push_back(&course);
+        }
+    });
+
+    // Insert in midpoint order so the sorted courses build a balanced tree
+    auto part = make_shared<Catalog>();
+    forEachMidpoint(owned.size(), [&](const size_t i) { part->courses.Insert(*owned[i]); });
+    part->equivalencies = full.equivalencies;
+    part->version = full.version;
+    buildCatalogIndexes(part.get());
+    part->completions.InheritScores(full.completions);
+    return part;
+}
+
+#ifdef __linux__
+
+/**
+ * Percent-encode a URL query parameter value
+ *
+ * @param value Text to encode
+ * @return Encoded text
+ */
+string urlEncode(const string_view value) {
+    static constexpr char hexDigits[] = "0123456789ABCDEF";
+    string encoded;
+    for (const char c : value) {
+        if (isalnum(static_cast<unsigned char>(c)) || c == '-' || c == '_' || c == '.' || c == '~') {
+            encoded += c;
+        } else {
+            encoded += '%';
+            encoded += hexDigits[(static_cast<unsigned char>(c) >> 4) & 0xF];
+            encoded += hexDigits[c & 0xF];
+        }
+    }
+    return encoded;
+}
+
+/**
+ * Split the array stored under a top-level field of a JSON document
+ *
+ * @param json A JSON object produced by the query functions
+ * @param field Name of the array field
+ * @return Each element's raw JSON text
+ */
+vector<string_view> jsonArrayElements(const string_view json, const string_view field) {
+    vector<string_view> elements;
+    const string pattern = '"' + string(field) + "\":[";
+    const size_t found = json.find(pattern);
+    if (found == string_view::npos) {
+        return elements;
+    }
+
+    int depth = 0;
+    bool inString = false;
+    size_t start = found + pattern.size();
+    for (size_t i = start; i < json.size(); i++) {
+        const char c = json[i];
+        if (inString) {
+            if (c == '\\') {
+                i++;
+            } else if (c == '"') {
+                inString = false;
+            }
+        } else if (c == '"') {
+            inString = true;
+        } else if (c == '{' || c == '[') {
+            depth++;
+        } else if ((c == ',' && depth == 0) || ((c == ']' || c == '}') && depth-- == 0)) {
+            if (i > start) {
+                elements.push_back(json.substr(start, i - start));
+            }
+            if (c != ',') {
+                break;
+            }
+            start = i + 1;
+        }
+    }
+    return elements;
+}
+
+/**
+ * Read a string field of a JSON object, undoing the escapes
+ * appendJsonString produces
+ *
+ * @param json A JSON object
+ * @param field Field name
+ * @return The value, empty if absent
+ */
+string jsonStringField(const string_view json, const string_view field) {
+    const string pattern = '"' + string(field) + "\":\"";
+    const size_t found = json.find(pattern);
+    string value;
+    if (found == string_view::npos) {
+        return value;
+    }
+    for (size_t i = found + pattern.size(); i < json.size() && json[i] != '"'; i++) {
+        if (json[i] != '\\' || i + 1 == json.size()) {
+            value += json[i];
+            continue;
+        }
+        switch (json[++i]) {
+            case 'n': value += '\n'; break;
+            case 'r': value += '\r'; break;
+            case 't': value += '\t'; break;
+            case 'u':
+                value += static_cast<char>(strtol(string(json.substr(i + 1, 4)).c_str(), nullptr, 16));
+                i += 4;
+                break;
+            default: value += json[i]; break;
+        }
+    }
+    return value;
+}
+
+/**
+ * Read a non-negative integer field of a JSON object
+ *
+ * @param json A JSON object
+ * @param field Field name
+ * @return The value, 0 if absent
+ */
+uint64_t jsonNumberField(const string_view json, const string_view field) {
+    const string pattern = '"' + string(field) + "\":";
+    const size_t found = json.find(pattern);
+    return found == string_view::npos ? 0 : strtoull(json.data() + found + pattern.size(), nullptr, 10);
+}
+
+/**
+ * Append raw JSON elements as an array
+ *
+ * @param out Output buffer
+ * @param elements Elements' JSON text
+ * @param begin First element to append
+ * @param end One past the last element to append
+ */
+void appendJsonElements(string& out, const vector<string_view>& elements, const size_t begin, const size_t end) {
+    out += '[';
+    for (size_t i = begin; i < end && i < elements.size(); i++) {
+        if (i > begin) {
+            out += ',';
+        }
+        out += elements[i];
+    }
+    out += ']';
+}
+
+/**
+ * Routes queries across planner processes that each hold one shard
+ * Single-course queries go to the owning shard. Lists, filters,
+ * completions and eligibility are scattered to every shard and the
+ * results merged in order. Prerequisite closures are walked level by
+ * level, with one batched lookup per shard per level.
+ */
+class ShardRouter final {
+    // One keep-alive connection per shard for each router thread
+    struct Connection {
+        int fd = -1;
+        unique_ptr<SocketReader> reader;
+    };
+
+    struct Response {
+        int status = 0;
+        string body;
+    };
+
+    vector<string> shards;
+    ShardRing ring;
+
+    static thread_local vector<Connection> connections;
+
+    bool send(size_t shard, const string& target) const;
+    bool receive(size_t shard, Response& response) const;
+    void disconnect(size_t shard) const;
+    bool scatter(const vector<pair<size_t, string>>& requests, vector<Response>& responses,
+                 QueryResult& failure) const;
+    bool lookup(const vector<string>& numbers, unordered_map<string, string>& courses,
+                QueryResult& failure) const;
+    QueryResult list(const Query& query) const;
+    QueryResult closure(const Query& query) const;
+    QueryResult gather(const Query& query) const;
 
 public:
-    BinarySearchTree();
+    explicit ShardRouter(vector<string> shards);
+    [[nodiscard]] size_t ShardCount() const;
+    [[nodiscard]] QueryResult Execute(const Query& query) const;
+};
 
-    ~BinarySearchTree();
-    void InOrder() const;
-    void Insert(const Course& course);
-    [[nodiscard]] Course Search(const string& courseNumber) const;
+thread_local vector<ShardRouter::Connection> ShardRouter::connections;
+
+/**
+ * Constructor
+ *
+ * @param shards Shard addresses such as 127.0.0.1:8081, in shard order
+ */
+ShardRouter::ShardRouter(vector<string> shards) : shards(std::move(shards)), ring(this->shards.size()) {
+}
+
+/**
+ * Number of shards behind the router
+ */
+size_t ShardRouter::ShardCount() const {
+    return shards.size();
+}
+
+// Send a GET request to a shard, connecting first if needed
+bool ShardRouter::send(const size_t shard, const string& target) const {
+    connections.resize(shards.size());
+    Connection& connection = connections[shard];
+    if (connection.fd < 0) {
+        connection.fd = connectTo(shards[shard]);
+        if (connection.fd < 0) {
+            return false;
+        }
+        connection.reader = make_unique<SocketReader>(connection.fd);
+    }
+    return sendAll(connection.fd, "GET " + target + " HTTP/1.1\r\nHost: " + shards[shard] + "\r\n\r\n");
+}
+
+// Read one response from a shard
+bool ShardRouter::receive(const size_t shard, Response& response) const {
+    Connection& connection = connections[shard];
+    string line;
+    if (connection.fd < 0 || !connection.reader->ReadLine(line) || !line.starts_with("HTTP/1.1 ")) {
+        return false;
+    }
+    response.status = atoi(line.c_str() + 9);
+
+    size_t length = 0;
+    bool close = false;
+    while (connection.reader->ReadLine(line) && line != "\r" && !line.empty()) {
+        ranges::transform(line, line.begin(), ::tolower);
+        if (line.starts_with("content-length:")) {
+            length = strtoul(line.c_str() + 15, nullptr, 10);
+        } else if (line.starts_with("connection:") && line.find("close") != string::npos) {
+            close = true;
+        }
+    }
+    if (!connection.reader->ReadExact(length, response.body)) {
+        return false;
+    }
+    if (close) {
+        disconnect(shard);
+    }
+    return true;
+}
+
+// Drop the calling thread's connection to a shard
+void ShardRouter::disconnect(const size_t shard) const {
+    Connection& connection = connections[shard];
+    if (connection.fd >= 0) {
+        close(connection.fd);
+        connection.fd = -1;
+    }
+    connection.reader.reset();
+}
+
+// Send every request before reading any response, so shards work in
+// parallel; a request that fails on a stale connection is retried once
+bool ShardRouter::scatter(const vector<pair<size_t, string>>& requests, vector<Response>& responses,
+                          QueryResult& failure) const {
+    responses.assign(requests.size(), Response());
+    vector<char> sent(requests.size());
+    for (size_t i = 0; i < requests.size(); i++) {
+        sent[i] = send(requests[i].first, requests[i].second);
+    }
+    for (size_t i = 0; i < requests.size(); i++) {
+        const size_t shard = requests[i].first;
+        if (sent[i] && receive(shard, responses[i])) {
+            continue;
+        }
+        disconnect(shard);
+        if (!send(shard, requests[i].second) || !receive(shard, responses[i])) {
+            // Other shards may still have answers in flight; drop them all
+            for (size_t other = 0; other < shards.size(); other++) {
+                disconnect(other);
+            }
+            failure.status = 502;
+            appendJsonError(failure.body, "shard " + shards[shard] + " is unavailable");
+            return false;
+        }
+    }
+
+    // Pass on the first error a shard reported
+    for (const Response& response : responses) {
+        if (response.status != 200) {
+            failure.status = response.status;
+            failure.body = response.body;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Fetch several courses with one lookup per owning shard, keyed by number
+bool ShardRouter::lookup(const vector<string>& numbers, unordered_map<string, string>& courses,
+                         QueryResult& failure) const {
+    vector<string> batches(shards.size());
+    for (const string& number : numbers) {
+        string& batch = batches[ring.Owner(number)];
+        batch += (batch.empty() ? "" : ",") + number;
+    }
+    vector<pair<size_t, string>> requests;
+    for (size_t shard = 0; shard < shards.size(); shard++) {
+        if (!batches[shard].empty()) {
+            requests.emplace_back(shard, "/lookup?numbers=" + urlEncode(batches[shard]));
+        }
+    }
+
+    vector<Response> responses;
+    if (!scatter(requests, responses, failure)) {
+        return false;
+    }
+    courses.clear();
+    for (const Response& response : responses) {
+        for (const string_view course : jsonArrayElements(response.body, "courses")) {
+            courses.emplace(jsonStringField(course, "courseNumber"), course);
+        }
+    }
+    return true;
+}
+
+/**
+ * Answer a query from the shards
+ *
+ * @param query The query to answer
+ * @return Status code and JSON body
+ */
+QueryResult ShardRouter::Execute(const Query& query) const {
+    // Time spent waiting on shards is charged to the lookup phase
+    plannerMetrics.queries[static_cast<size_t>(query.type)].Add();
+    queryTimer.Begin();
+    timedQuery = query;
+    timedVersion = 0;
+
+    QueryResult result;
+    vector<Response> responses;
+    switch (query.type) {
+        case QueryType::Course:
+        case QueryType::Eligibility:
+            if (query.type == QueryType::Course || !query.course.empty()) {
+                // Only the owner can answer for one course
+                const string number = toUpperCase(query.type == QueryType::Course ? query.key : query.course);
+                string target = query.type == QueryType::Course
+                                    ? "/courses/" + urlEncode(number)
+                                    : "/eligibility?completed=" + urlEncode(query.key) + "&course=" + urlEncode(number);
+                if (scatter({{ring.Owner(number), target}}, responses, result)) {
+                    result.body = std::move(responses[0].body);
+                }
+                return result;
+            }
+            return gather(query);
+        case QueryType::Lookup: {
+            vector<string> numbers;
+            for (const string_view number : tokenize(query.key, ',')) {
+                if (!number.empty()) {
+                    numbers.push_back(toUpperCase(number));
+                }
+            }
+            unordered_map<string, string> courses;
+            if (lookup(numbers, courses, result)) {
+                // Answer in the order asked, like a single server
+                vector<string_view> elements;
+                for (const string& number : numbers) {
+                    if (const auto found = courses.find(number); found != courses.end()) {
+                        elements.push_back(found->second);
+                    }
+                }
+                result.body = "{\"courses\":";
+                appendJsonElements(result.body, elements, 0, elements.size());
+                result.body += '}';
+            }
+            return result;
+        }
+        case QueryType::List:
+            return list(query);
+        case QueryType::Closure:
+            return closure(query);
+        case QueryType::Complete:
+        case QueryType::Filter:
+            return gather(query);
+    }
+    return result;
+}
+
+// Merge one page of a sorted listing from every shard's first pages
+QueryResult ShardRouter::list(const Query& query) const {
+    QueryResult result;
+    SortOrder order = SortOrder::Number;
+    if (!query.key.empty() && !parseSortOrder(query.key, &order)) {
+        result.status = 400;
+        appendJsonError(result.body, "order must be number, title, level or depth");
+        return result;
+    }
+    if (order == SortOrder::Depth) {
+        result.status = 400;
+        appendJsonError(result.body, "order depth needs the whole catalog and is not available across shards");
+        return result;
+    }
+
+    // Every course on the page is within the first offset + limit of its shard
+    const string target = "/courses?offset=0&limit=" + to_string(query.offset + query.limit) +
+                          "&order=" + (query.key.empty() ? "number" : query.key);
+    vector<pair<size_t, string>> requests;
+    for (size_t shard = 0; shard < shards.size(); shard++) {
+        requests.emplace_back(shard, target);
+    }
+    vector<Response> responses;
+    if (!scatter(requests, responses, result)) {
+        return result;
+    }
+
+    // Sort keys match CourseOrders: departments and titles compare as
+    // text and ties fall back to the course number
+    uint64_t total = 0;
+    vector<tuple<string, int, string, string_view>> keyed;
+    for (const Response& response : responses) {
+        total += jsonNumberField(response.body, "total");
+        for (const string_view course : jsonArrayElements(response.body, "courses")) {
+            string number = jsonStringField(course, "courseNumber");
+            int level = 0;
+            string first;
+            if (order == SortOrder::Title) {
+                first = jsonStringField(course, "courseTitle");
+            } else if (order == SortOrder::Level) {
+                first = string(splitCourseNumber(number, &level));
+            }
+            keyed.emplace_back(std::move(first), level, std::move(number), course);
+        }
+    }
+    ranges::sort(keyed);
+
+    vector<string_view> courses;
+    for (const auto& entry : keyed) {
+        courses.push_back(get<3>(entry));
+    }
+    result.body = "{\"total\":" + to_string(total) + ",\"offset\":" + to_string(query.offset) +
+                  ",\"limit\":" + to_string(query.limit) + ",\"courses\":";
+    appendJsonElements(result.body, courses, query.offset, query.offset + query.limit);
+    result.body += '}';
+    return result;
+}
+
+// Walk the prerequisite graph one level at a time, fetching each level
+// with batched lookups, then order it the way prerequisiteClosure does
+QueryResult ShardRouter::closure(const Query& query) const {
+    QueryResult result;
+    const string root = toUpperCase(query.key);
+    unordered_map<string, vector<string>> prerequisitesOf;
+    vector<string> level{root};
+    unordered_map<string, string> courses;
+
+    while (!level.empty()) {
+        if (!lookup(level, courses, result)) {
+            return result;
+        }
+        vector<string> next;
+        for (const auto& [number, course] : courses) {
+            vector<string> prerequisites;
+            for (const string_view prerequisite : jsonArrayElements(course, "requires")) {
+                prerequisites.push_back(jsonStringField("{\"x\":" + string(prerequisite) + '}', "x"));
+                if (!prerequisitesOf.contains(prerequisites.back())) {
+                    next.push_back(prerequisites.back());
+                }
+            }
+            prerequisitesOf[number] = std::move(prerequisites);
+        }
+        ranges::sort(next);
+        next.erase(ranges::unique(next).begin(), next.end());
+        erase_if(next, [&](const string& number) { return prerequisitesOf.contains(number); });
+        level = std::move(next);
+    }
+
+    if (!prerequisitesOf.contains(root)) {
+        result.status = 404;
+        appendJsonError(result.body, "course not found");
+        return result;
+    }
+
+    // Depth-first, each course after its own prerequisites, with an
+    // explicit stack of courses and their next prerequisite so long chains
+    // cannot overflow the call stack
+    vector<string> order;
+    unordered_set<string> visited{root};
+    vector<pair<const string*, size_t>> stack{{&root, 0}};
+    while (!stack.empty()) {
+        auto& [number, next] = stack.back();
+        const vector<string>& prerequisites = prerequisitesOf[*number];
+        if (next < prerequisites.size()) {
+            const string& prerequisite = prerequisites[next++];
+            if (prerequisitesOf.contains(prerequisite) && visited.insert(prerequisite).second) {
+                stack.emplace_back(&prerequisite, 0);
+            }
+            continue;
+        }
+        if (stack.size() > 1) {
+            order.push_back(*number);
+        }
+        stack.pop_back();
+    }
+
+    result.body = "{\"courseNumber\":";
+    appendJsonString(result.body, root);
+    result.body += ",\"closure\":[";
+    for (size_t i = 0; i < order.size(); i++) {
+        if (i > 0) {
+            result.body += ',';
+        }
+        appendJsonString(result.body, order[i]);
+    }
+    result.body += "]}";
+    return result;
+}
+
+// Scatter a completion, filter or transcript query to every shard and
+// merge the results
+QueryResult ShardRouter::gather(const Query& query) const {
+    QueryResult result;
+    string target;
+    if (query.type == QueryType::Complete) {
+        target = "/complete?q=" + urlEncode(query.key) + "&k=" + to_string(query.limit);
+    } else if (query.type == QueryType::Filter) {
+        target = "/filter?q=" + urlEncode(query.key) + "&limit=" + to_string(query.limit);
+    } else {
+        target = "/eligibility?completed=" + urlEncode(query.key);
+    }
+    vector<pair<size_t, string>> requests;
+    for (size_t shard = 0; shard < shards.size(); shard++) {
+        requests.emplace_back(shard, target);
+    }
+    vector<Response> responses;
+    if (!scatter(requests, responses, result)) {
+        return result;
+    }
+
+    const string_view field = query.type == QueryType::Complete ? "completions"
+                              : query.type == QueryType::Filter ? "courses" : "eligible";
+    uint64_t count = 0;
+    vector<tuple<int64_t, string, string_view>> keyed;
+    for (const Response& response : responses) {
+        count += jsonNumberField(response.body, "count");
+        for (const string_view course : jsonArrayElements(response.body, field)) {
+            // Completions rank by popularity first, everything else by number
+            const int64_t rank = query.type == QueryType::Complete
+                                     ? -static_cast<int64_t>(jsonNumberField(course, "popularity")) : 0;
+            keyed.emplace_back(rank, jsonStringField(course, "courseNumber"), course);
+        }
+    }
+    ranges::sort(keyed);
+    vector<string_view> courses;
+    for (const auto& entry : keyed) {
+        courses.push_back(get<2>(entry));
+    }
+
+    if (query.type == QueryType::Complete) {
+        result.body = "{\"prefix\":";
+        appendJsonString(result.body, query.key);
+        result.body += ",\"completions\":";
+        appendJsonElements(result.body, courses, 0, query.limit);
+    } else if (query.type == QueryType::Filter) {
+        result.body = "{\"filter\":";
+        appendJsonString(result.body, query.key);
+        result.body += ",\"plan\":";
+        appendJsonString(result.body, "scatter over " + to_string(shards.size()) + " shards");
+        result.body += ",\"count\":" + to_string(count) + ",\"courses\":";
+        appendJsonElements(result.body, courses, 0, query.limit);
+    } else {
+        // Every shard resolves the transcript the same way
+        result.body = "{\"transfer\":";
+        const vector<string_view> transfer = jsonArrayElements(responses[0].body, "transfer");
+        appendJsonElements(result.body, transfer, 0, transfer.size());
+        result.body += ",\"eligible\":";
+        appendJsonElements(result.body, courses, 0, courses.size());
+    }
+    result.body += '}';
+    return result;
+}
+
+#endif
+
+//============================================================================
+// HTTP Query Server
+//============================================================================
+
+#ifdef __linux__
+
+/**
+ * Options for the embedded HTTP server
+ */
+struct ServerOptions {
+    string catalogFile;
+    string bindAddress = "127.0.0.1";
+    int port = 8080;
+    unsigned threads = 0;
+    size_t cacheEntries = 4096;
+    LoadOptions load;
+    string recordFile;
+    string slowLogFile;
+    double slowThreshold = 1.0;
+    string metricsFile;
+    double metricsInterval = 10.0;
+    int replicationPort = 0;
+    string versionFile;
+    string primary;
+    string shardRouter;
+    size_t shardIndex = 0;
+    size_t shardCount = 1;
+    bool numa = false;
+    bool warmUp = false;
+    bool lockMemory = false;
 };
 
 /**
- * Default constructor
- * Initializes root to nullptr creating an empty tree
+ * Per-connection buffers, kept across keep-alive requests
+ */
+struct HttpConnection {
+    string input;
+    string output;
+    size_t outputSent = 0;
+    bool closeAfterWrite = false;
+};
+
+// Set by SIGINT/SIGTERM to shut the workers down
+atomic<bool> serverStopping{false};
+
+void handleStopSignal(int) {
+    serverStopping = true;
+}
+
+/**
+ * Decode %XX escapes and '+' in a URL component
+ *
+ * @param value Encoded text
+ * @return Decoded text
+ */
+string urlDecode(const string_view value) {
+    string decoded;
+    decoded.reserve(value.size());
+    for (size_t i = 0; i < value.size(); i++) {
+        if (value[i] == '+') {
+            decoded += ' ';
+        } else if (value[i] == '%' && i + 2 < value.size() &&
+                   isxdigit(static_cast<unsigned char>(value[i + 1])) &&
+                   isxdigit(static_cast<unsigned char>(value[i + 2]))) {
+            decoded += static_cast<char>(stoi(string(value.substr(i + 1, 2)), nullptr, 16));
+            i += 2;
+        } else {
+            decoded += value[i];
+        }
+    }
+    return decoded;
+}
+
+/**
+ * Find a parameter in a URL query string
+ *
+ * @param query Query string without the leading '?'
+ * @param name Parameter name
+ * @return The decoded value, empty if absent
+ */
+string queryParameter(const string_view query, const string_view name) {
+    size_t start = 0;
+    while (start <= query.size()) {
+        size_t end = query.find('&', start);
+        if (end == string_view::npos) {
+            end = query.size();
+        }
+        const string_view pair = query.substr(start, end - start);
+        const size_t equals = pair.find('=');
+        if (pair.substr(0, equals) == name) {
+            return equals == string_view::npos ? string() : urlDecode(pair.substr(equals + 1));
+        }
+        start = end + 1;
+    }
+    return {};
+}
+
+/**
+ * Parse a non-negative integer parameter
+ *
+ * @param text Parameter value
+ * @param fallback Value used when the parameter is empty
+ * @param value Receives the parsed value
+ * @return true if the text was empty or a valid number
+ */
+bool parseCount(const string& text, const size_t fallback, size_t& value) {
+    if (text.empty()) {
+        value = fallback;
+        return true;
+    }
+    if (!ranges::all_of(text, ::isdigit) || text.size() > 9) {
+        return false;
+    }
+    value = stoul(text);
+    return true;
+}
+
+/**
+ * Get the reason phrase for a status code
+ */
+const char* statusText(const int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 403: return "Forbidden";
+        case 405: return "Method Not Allowed";
+        case 413: return "Payload Too Large";
+        case 431: return "Request Header Fields Too Large";
+        case 502: return "Bad Gateway";
+        default: return "Internal Server Error";
+    }
+}
+
+/**
+ * Embedded HTTP/1.1 server answering catalog queries as JSON
+ * Runs one worker per core. Each worker owns a SO_REUSEPORT listener and
+ * an epoll set, so accepted connections stay on the thread that accepted
+ * them and workers never share mutable state.
+ */
+class HttpServer final {
+    static constexpr size_t maxHeaderBytes = 16 * 1024;
+    static constexpr size_t maxBodyBytes = 1024 * 1024;
+    static constexpr size_t responseReserve = 64 * 1024;
+
+    QueryService& service;
+    ServerOptions options;
+    ReplicationPrimary* replication;
+    const ShardRouter* router;
+
+    // Serializes publishing so versions reach replicas in order
+    mutable mutex publishLock;
+
+    [[nodiscard]] int openListener() const;
+    void runWorker(int listener) const;
+    void processInput(HttpConnection& connection, string& body) const;
+    int route(string_view method, string_view target, string_view content, string& body,
+              string_view& contentType) const;
+    int reload(string& body) const;
+    int rebuild(string& body) const;
+    int edit(string_view edits, string& body) const;
+
+public:
+    HttpServer(QueryService& service, ServerOptions options, ReplicationPrimary* replication = nullptr,
+               const ShardRouter* router = nullptr);
+    bool Run() const;
+};
+
+/**
+ * Constructor
+ *
+ * @param service Answers queries against the current catalog
+ * @param options Listener and thread settings
+ * @param replication Receives every published version, or nullptr
+ * @param router Answers queries from shard servers instead of the service, or nullptr
+ */
+HttpServer::HttpServer(QueryService& service, ServerOptions options, ReplicationPrimary* replication,
+                       const ShardRouter* router)
+    : service(service), options(std::move(options)), replication(replication), router(router) {
+}
+
+/**
+ * Open a non-blocking listening socket sharing the port with other workers
+ *
+ * @return The socket, or -1 on failure
+ */
+int HttpServer::openListener() const {
+    const int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    constexpr int enable = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable));
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(options.port));
+    if (inet_pton(AF_INET, options.bindAddress.c_str(), &address.sin_addr) != 1 ||
+        bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Start the workers and block until a stop signal arrives
+ *
+ * @return true if the server started
  */
-BinarySearchTree::BinarySearchTree() {
-    root = nullptr;
+bool HttpServer::Run() const {
+    unsigned threadCount = options.threads;
+    if (threadCount == 0) {
+        threadCount = max(1u, thread::hardware_concurrency());
+    }
+
+    // Open every listener up front so a bad address fails fast
+    vector<int> listeners;
+    for (unsigned i = 0; i < threadCount; i++) {
+        const int fd = openListener();
+        if (fd < 0) {
+            cout << "Error: Could not listen on " << options.bindAddress << ":"
+                 << options.port << endl;
+            for (const int open : listeners) {
+                close(open);
+            }
+            return false;
+        }
+        listeners.push_back(fd);
+    }
+
+    signal(SIGINT, handleStopSignal);
+    signal(SIGTERM, handleStopSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (router != nullptr) {
+        cout << "Routing " << router->ShardCount() << " shards";
+    } else {
+        cout << "Serving " << service.Current()->courses.Size() << " courses";
+    }
+    cout << " on http://"
+         << options.bindAddress << ":" << options.port << " with "
+         << threadCount << " threads" << endl;
+
+    const vector<vector<int>> nodes = options.numa ? detectNumaNodes() : vector<vector<int>>();
+    vector<thread> workers;
+    for (size_t i = 0; i < listeners.size(); i++) {
+        workers.emplace_back([this, &nodes, i, fd = listeners[i]] {
+            if (!nodes.empty()) {
+                // Spread workers across nodes, one core each
+                const size_t node = i % nodes.size();
+                const vector<int>& cpus = nodes[node];
+                pinCurrentThread({cpus[(i / nodes.size()) % cpus.size()]});
+                queryNode = node;
+            }
+            runWorker(fd);
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    cout << "Server stopped." << endl;
+    service.Cache().PrintStats(cout);
+    if (!options.load.frequencyFile.empty()) {
+        saveFrequencies(options.load.frequencyFile, *service.Merged());
+    }
+    return true;
 }
 
-/**
- * Destructor
- * Recursively deletes all nodes to prevent memory leaks
- */
-BinarySearchTree::~BinarySearchTree() {
-    deleteRecursive(root);
-}
+/**
+ * Event loop for one worker thread
+ *
+ * @param listener This worker's listening socket
+ */
+void HttpServer::runWorker(const int listener) const {
+    const int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = listener;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, listener, &event);
+
+    unordered_map<int, HttpConnection> connections;
+    array<epoll_event, 256> events{};
+    array<char, 16 * 1024> readBuffer{};
+
+    // Reused for every response so the hot path rarely allocates
+    string body;
+    body.reserve(responseReserve);
+
+    auto closeConnection = [&](const int fd) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        connections.erase(fd);
+    };
+
+    while (!serverStopping) {
+        const int ready = epoll_wait(epollFd, events.data(), static_cast<int>(events.size()), 250);
+
+        for (int i = 0; i < ready; i++) {
+            const int fd = events[i].data.fd;
+
+            // Accept every pending connection
+            if (fd == listener) {
+                int client;
+                while ((client = accept4(listener, nullptr, nullptr,
+                                         SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    constexpr int enable = 1;
+                    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+                    epoll_event clientEvent{};
+                    clientEvent.events = EPOLLIN | EPOLLRDHUP;
+                    clientEvent.data.fd = client;
+                    epoll_ctl(epollFd, EPOLL_CTL_ADD, client, &clientEvent);
+                    connections[client].output.reserve(responseReserve);
+                }
+                continue;
+            }
+
+            auto found = connections.find(fd);
+            if (found == connections.end()) {
+                continue;
+            }
+            HttpConnection& connection = found->second;
+
+            if (events[i].events & EPOLLERR) {
+                closeConnection(fd);
+                continue;
+            }
+
+            // Read everything available, then answer complete requests
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+                bool peerClosed = false;
+                while (true) {
+                    const ssize_t count = read(fd, readBuffer.data(), readBuffer.size());
+                    if (count > 0) {
+                        // Input after a closing response is never answered
+                        if (!connection.closeAfterWrite) {
+                            connection.input.append(readBuffer.data(), static_cast<size_t>(count));
+                        }
+                    } else {
+                        peerClosed = count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+                        break;
+                    }
+                }
+                processInput(connection, body);
+                if (peerClosed) {
+                    connection.closeAfterWrite = true;
+                }
+            }
+
+            // Write as much of the pending output as the socket accepts
+            while (connection.outputSent < connection.output.size()) {
+                const ssize_t count = write(fd, connection.output.data() + connection.outputSent,
+                                            connection.output.size() - connection.outputSent);
+                if (count <= 0) {
+                    break;
+                }
+                connection.outputSent += static_cast<size_t>(count);
+            }
+
+            if (connection.outputSent == connection.output.size()) {
+                connection.output.clear();
+                connection.outputSent = 0;
+                if (connection.closeAfterWrite) {
+                    closeConnection(fd);
+                    continue;
+                }
+            }
 
-// Helper function to delete all nodes
-// Deletes children first, then parent
-void BinarySearchTree::deleteRecursive(const Node* node) {
-    if (node != nullptr) {
-        deleteRecursive(node->left);
-        deleteRecursive(node->right);
-        delete node;
+            epoll_event update{};
+            update.events = EPOLLIN | EPOLLRDHUP |
+                            (connection.output.empty() ? 0u : static_cast<uint32_t>(EPOLLOUT));
+            update.data.fd = fd;
+            epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &update);
+        }
     }
-}
 
-/**
- * Insert a course into the tree
- *
- * @param course The course to insert
- */
-void BinarySearchTree::Insert(const Course& course) {
-    if (root == nullptr) {
-        root = new Node(course);
-    } else {
-        addNode(root, course);
+    for (const auto& [fd, connection] : connections) {
+        close(fd);
     }
+    close(listener);
+    close(epollFd);
 }
 
 /**
- * Recursive helper to add a course to the correct position in tree
+ * Answer every complete request in a connection's input buffer
+ * Pipelined requests are answered in order.
  *
- * @param node Current node in traversal
- * @param course Course to add
+ * @param connection The connection to process
+ * @param body Scratch buffer for response bodies
  */
-void BinarySearchTree::addNode(Node* node, const Course& course) {
-    // Compare course numbers to determine placement
-    if (course.courseNumber < node->course.courseNumber) {
-        // Add to left subtree
-        if (node->left == nullptr) {
-            node->left = new Node(course);
-        } else {
-            addNode(node->left, course);
+void HttpServer::processInput(HttpConnection& connection, string& body) const {
+    size_t consumed = 0;
+
+    while (!connection.closeAfterWrite) {
+        const size_t headerEnd = connection.input.find("\r\n\r\n", consumed);
+        if (headerEnd == string::npos) {
+            if (connection.input.size() - consumed > maxHeaderBytes) {
+                body.clear();
+                appendJsonError(body, "request header too large");
+                connection.output += "HTTP/1.1 431 Request Header Fields Too Large\r\n"
+                                     "Content-Type: application/json\r\nContent-Length: " +
+                                     to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+                connection.closeAfterWrite = true;
+                consumed = connection.input.size();
+            }
+            break;
         }
-    } else {
-        // Add to right subtree
-        if (node->right == nullptr) {
-            node->right = new Node(course);
+
+        const string_view request(connection.input.data() + consumed, headerEnd - consumed);
+        const size_t lineEnd = request.find("\r\n");
+        const string_view requestLine = request.substr(0, lineEnd);
+
+        // Scan headers for the few this server cares about
+        size_t contentLength = 0;
+        bool keepAlive = requestLine.ends_with("HTTP/1.1");
+        size_t position = lineEnd;
+        while (position != string_view::npos && position < request.size()) {
+            const size_t next = request.find("\r\n", position + 2);
+            string header(request.substr(position + 2, next == string_view::npos
+                                                          ? string_view::npos
+                                                          : next - position - 2));
+            ranges::transform(header, header.begin(), ::tolower);
+            if (header.starts_with("content-length:")) {
+                contentLength = strtoul(header.c_str() + 15, nullptr, 10);
+            } else if (header.starts_with("connection:")) {
+                if (header.find("close") != string::npos) {
+                    keepAlive = false;
+                } else if (header.find("keep-alive") != string::npos) {
+                    keepAlive = true;
+                }
+            }
+            position = next;
+        }
+
+        // Refuse oversized bodies before buffering them
+        if (contentLength > maxBodyBytes) {
+            body.clear();
+            appendJsonError(body, "request body too large");
+            connection.output += "HTTP/1.1 413 Payload Too Large\r\n"
+                                 "Content-Type: application/json\r\nContent-Length: " +
+                                 to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+            connection.closeAfterWrite = true;
+            consumed = connection.input.size();
+            break;
+        }
+
+        const size_t requestEnd = headerEnd + 4 + contentLength;
+        if (connection.input.size() < requestEnd) {
+            break;
+        }
+
+        const size_t methodEnd = requestLine.find(' ');
+        const size_t targetEnd = requestLine.find(' ', methodEnd + 1);
+        body.clear();
+        int status;
+        string_view contentType = "application/json";
+        if (methodEnd == string_view::npos || targetEnd == string_view::npos) {
+            appendJsonError(body, "malformed request line");
+            status = 400;
+            keepAlive = false;
         } else {
-            addNode(node->right, course);
+            status = route(requestLine.substr(0, methodEnd),
+                           requestLine.substr(methodEnd + 1, targetEnd - methodEnd - 1),
+                           string_view(connection.input).substr(headerEnd + 4, contentLength),
+                           body, contentType);
+        }
+
+        string& output = connection.output;
+        output += "HTTP/1.1 ";
+        output += to_string(status);
+        output += ' ';
+        output += statusText(status);
+        output += "\r\nContent-Type: ";
+        output += contentType;
+        output += "\r\nContent-Length: ";
+        output += to_string(body.size());
+        output += keepAlive ? "\r\nConnection: keep-alive\r\n\r\n" : "\r\nConnection: close\r\n\r\n";
+        output += body;
+        service.FinishQuery();
+
+        consumed = requestEnd;
+        if (!keepAlive) {
+            connection.closeAfterWrite = true;
         }
     }
-}
 
-/**
- * Public method to traverse tree in order
- */
-void BinarySearchTree::InOrder() const {
-    inOrder(root);
+    connection.input.erase(0, consumed);
 }
 
 /**
- * Recursive in-order traversal
- * Visits nodes in sorted order: left -> root -> right
+ * Dispatch a request to the matching query
  *
- * @param node Current node being visited
+ * @param method HTTP method
+ * @param target Request target (path and query string)
+ * @param content Request body
+ * @param body Receives the response body
+ * @param contentType Set when the body is not JSON
+ * @return HTTP status code
  */
-void BinarySearchTree::inOrder(const Node* node) {
-    if (node != nullptr) {
-        // Traverse left subtree
-        inOrder(node->left);
+int HttpServer::route(const string_view method, const string_view target, const string_view content,
+                      string& body, string_view& contentType) const {
+    const size_t queryStart = target.find('?');
+    const string_view path = target.substr(0, queryStart);
+    const string_view parameters = queryStart == string_view::npos ? string_view() : target.substr(queryStart + 1);
 
-        // Print current node
-        cout << node->course.courseNumber << ", "
-             << node->course.courseTitle << endl;
+    if (path == "/reload" || path == "/rebuild" || path == "/edit") {
+        if (method != "POST") {
+            appendJsonError(body, "this endpoint requires POST");
+            return 405;
+        }
+        if (!options.primary.empty()) {
+            appendJsonError(body, "this server is a read-only replica");
+            return 403;
+        }
+        if (router != nullptr || (options.shardCount > 1 && path == "/edit")) {
+            // A shard cannot check prerequisites owned by other shards
+            appendJsonError(body, "edit the catalog file and reload each shard");
+            return 403;
+        }
+        if (path == "/edit") {
+            return edit(content, body);
+        }
+        return path == "/reload" ? reload(body) : rebuild(body);
+    }
 
-        // Traverse right subtree
-        inOrder(node->right);
+    if (method != "GET") {
+        appendJsonError(body, "only GET is supported");
+        return 405;
     }
-}
 
-/**
- * Search for a course by course number
- * Iteratively traverses tree based on comparisons
- *
- * @param courseNumber The course number to search for
- * @return The course if found, empty course otherwise
- */
-Course BinarySearchTree::Search(const string& courseNumber) const {
-    Node* current = root;
+    if (path == "/metrics") {
+        body = renderMetrics(service);
+        contentType = "text/plain; version=0.0.4";
+        return 200;
+    }
 
-    // Traverse tree until found or reach end
-    while (current != nullptr) {
-        // Found matching course
-        if (current->course.courseNumber == courseNumber) {
-            return current->course;
+    Query query;
+    if (path == "/courses") {
+        query.type = QueryType::List;
+        query.key = queryParameter(parameters, "order");
+        if (!parseCount(queryParameter(parameters, "offset"), 0, query.offset) ||
+            !parseCount(queryParameter(parameters, "limit"), 100, query.limit)) {
+            appendJsonError(body, "offset and limit must be non-negative integers");
+            return 400;
         }
-
-        // Search left subtree if target is smaller
-        if (courseNumber < current->course.courseNumber) {
-            current = current->left;
+    } else if (path.starts_with("/courses/")) {
+        string_view courseNumber = path.substr(9);
+        query.type = QueryType::Course;
+        if (courseNumber.ends_with("/closure")) {
+            courseNumber.remove_suffix(8);
+            query.type = QueryType::Closure;
         }
-        // Search right subtree if target is larger
-        else {
-            current = current->right;
+        query.key = urlDecode(courseNumber);
+    } else if (path == "/complete") {
+        query.type = QueryType::Complete;
+        query.key = queryParameter(parameters, "q");
+        if (!parseCount(queryParameter(parameters, "k"), 10, query.limit)) {
+            appendJsonError(body, "k must be a non-negative integer");
+            return 400;
         }
+    } else if (path == "/filter") {
+        query.type = QueryType::Filter;
+        query.key = queryParameter(parameters, "q");
+        if (!parseCount(queryParameter(parameters, "limit"), 100, query.limit)) {
+            appendJsonError(body, "limit must be a non-negative integer");
+            return 400;
+        }
+    } else if (path == "/eligibility") {
+        query.type = QueryType::Eligibility;
+        query.key = queryParameter(parameters, "completed");
+        query.course = queryParameter(parameters, "course");
+    } else if (path == "/lookup") {
+        query.type = QueryType::Lookup;
+        query.key = queryParameter(parameters, "numbers");
+    } else {
+        appendJsonError(body, "not found");
+        return 404;
     }
 
-    // Course not found, return empty course
-    Course course;
-    return course;
+    const QueryResult result = router != nullptr ? router->Execute(query) : service.Execute(query);
+    body = result.body;
+    return result.status;
 }
 
-//============================================================================
-// Utility Functions
-//============================================================================
-
 /**
- * Split a string by a delimiter
+ * Reload the catalog file and publish it as a new version
+ * The old catalog keeps serving until the new one has loaded.
  *
- * @param str The string to split
- * @param delimiter The character to split on
- * @return Vector of string tokens
+ * @param body Receives the JSON response body
+ * @return HTTP status code
  */
-vector<string> tokenize(const string& str, char delimiter) {
-    vector<string> tokens;
-    stringstream ss(str);
-    string token;
-
-    while (getline(ss, token, delimiter)) {
-        // Trim whitespace from token
-        token.erase(0, token.find_first_not_of(" \t\r\n"));
-        token.erase(token.find_last_not_of(" \t\r\n") + 1);
-        tokens.push_back(token);
+int HttpServer::reload(string& body) const {
+    auto next = make_shared<Catalog>();
+    if (!loadCatalog(options.catalogFile, next.get(), options.load)) {
+        appendJsonError(body, "reload failed");
+        return 500;
+    }
+    if (options.shardCount > 1) {
+        next = shardCatalog(*next, ShardRing(options.shardCount), options.shardIndex);
     }
 
-    return tokens;
+    lock_guard guard(publishLock);
+    const shared_ptr<const Catalog> previous = service.Current();
+    service.Publish(next);
+    if (replication != nullptr) {
+        string edits;
+        const bool described = diffCatalogs(*previous, *next, &edits);
+        replication->Append(next, std::move(edits), !described);
+    }
+    body = "{\"version\":" + to_string(next->version) +
+           ",\"courses\":" + to_string(next->courses.Size()) + "}";
+    return 200;
 }
 
 /**
- * Load courses from a file into the BST
- * Performs two-pass validation to ensure data integrity
+ * Apply edit lines to the current catalog and publish the result
+ * The body holds "+line" to add or replace a course, "-number" to remove
+ * one and "=course,course..." to add an equivalency group.
  *
- * @param filename Path to the course data file
- * @param bst Pointer to the binary search tree
- * @return true if load successful, false otherwise
+ * @param edits Edit lines from the request body
+ * @param body Receives the JSON response body
+ * @return HTTP status code
  */
-bool loadCourses(const string& filename, BinarySearchTree* bst) {
-    ifstream file(filename);
+int HttpServer::edit(const string_view edits, string& body) const {
+    lock_guard guard(publishLock);
+    auto next = make_shared<Catalog>();
+    string error;
+    if (!applyCatalogEdits(*service.Current(), string(edits), next.get(), &error)) {
+        appendJsonError(body, error);
+        return 400;
+    }
 
-    // Check if file opened successfully
-    if (!file.is_open()) {
-        cout << "Error: Could not open file " << filename << endl;
-        return false;
+    service.Publish(next);
+    if (replication != nullptr) {
+        replication->Append(next, string(edits), false);
     }
+    body = "{\"version\":" + to_string(next->version) +
+           ",\"courses\":" + to_string(next->courses.Size()) + "}";
+    return 200;
+}
 
-    cout << "Loading course data from " << filename << "..." << endl;
+/**
+ * Publish a copy of the catalog reshaped around current lookup counts
+ * Readers keep using the old tree until the new one is published.
+ *
+ * @param body Receives the JSON response body
+ * @return HTTP status code
+ */
+int HttpServer::rebuild(string& body) const {
+    lock_guard guard(publishLock);
+    const shared_ptr<Catalog> next = copyCatalog(*service.Merged());
+    rebuildByPopularity(next.get());
+    const double depth = next->courses.AverageDepth(next->completions.Popularity());
 
-    vector<Course> courses;
-    vector<string> validCourseNumbers;
-    string line;
-    int lineNumber = 0;
+    // Replicas keep their own tree shape; the version still has to advance
+    service.Publish(next);
+    if (replication != nullptr) {
+        replication->Append(next, string(), false);
+    }
+    body = "{\"version\":" + to_string(next->version) +
+           ",\"averageDepth\":" + to_string(depth) + "}";
+    return 200;
+}
 
-    // First pass: Read and validate basic structure
-    while (getline(file, line)) {
-        lineNumber++;
+#endif
 
-        // Skip empty lines
-        if (line.empty()) {
+/**
+ * Run the HTTP server mode
+ * Usage: --serve <file> [--bind <address>] [--port <n>] [--threads <n>]
+ *        [--cache-entries <n>] [--numa] [--warm-up] [--mlock]
+ *        [--duplicates <policy>] [--frequencies <file>] [--record <log>]
+ *        [--slow-log <file>] [--slow-threshold <ms>] [--metrics-file <file>]
+ *        [--metrics-interval <seconds>] [--replicate-port <n>] [--version-file <file>]
+ *        [--shard <i>/<n>]
+ *        --replica <primary address:port> [server options]
+ *        --router <address:port>,<address:port>... [server options]
+ * A replica loads the primary's catalog instead of a file and follows
+ * every version the primary publishes. A shard keeps only the courses it
+ * owns; a router holds no catalog and answers from the shards, listed in
+ * shard order.
+ *
+ * @param args Command-line arguments
+ * @return Process exit code
+ */
+int runServer(const vector<string>& args) {
+#ifdef __linux__
+    ServerOptions options;
+    for (size_t i = 0; i < args.size(); i++) {
+        const bool hasValue = i + 1 < args.size();
+        if (args[i] == "--serve" && hasValue) {
+            options.catalogFile = args[++i];
+        } else if (args[i] == "--replica" && hasValue) {
+            options.primary = args[++i];
+        } else if (args[i] == "--router" && hasValue) {
+            options.shardRouter = args[++i];
+        } else if (args[i] == "--shard" && hasValue) {
+            const string& shard = args[++i];
+            const size_t slash = shard.find('/');
+            options.shardIndex = strtoul(shard.c_str(), nullptr, 10);
+            options.shardCount = slash == string::npos ? 0 : strtoul(shard.c_str() + slash + 1, nullptr, 10);
+        } else if (args[i] == "--replicate-port" && hasValue) {
+            options.replicationPort = atoi(args[++i].c_str());
+        } else if (args[i] == "--version-file" && hasValue) {
+            options.versionFile = args[++i];
+        } else if (args[i] == "--bind" && hasValue) {
+            options.bindAddress = args[++i];
+        } else if (args[i] == "--port" && hasValue) {
+            options.port = atoi(args[++i].c_str());
+        } else if (args[i] == "--threads" && hasValue) {
+            options.threads = static_cast<unsigned>(atoi(args[++i].c_str()));
+        } else if (args[i] == "--cache-entries" && hasValue) {
+            options.cacheEntries = strtoul(args[++i].c_str(), nullptr, 10);
+        } else if (args[i] == "--record" && hasValue) {
+            options.recordFile = args[++i];
+        } else if (args[i] == "--slow-log" && hasValue) {
+            options.slowLogFile = args[++i];
+        } else if (args[i] == "--slow-threshold" && hasValue) {
+            options.slowThreshold = strtod(args[++i].c_str(), nullptr);
+        } else if (args[i] == "--metrics-file" && hasValue) {
+            options.metricsFile = args[++i];
+        } else if (args[i] == "--metrics-interval" && hasValue) {
+            options.metricsInterval = strtod(args[++i].c_str(), nullptr);
+        } else if (args[i] == "--numa") {
+            options.numa = true;
+        } else if (args[i] == "--warm-up") {
+            options.warmUp = true;
+        } else if (args[i] == "--mlock") {
+            options.warmUp = true;
+            options.lockMemory = true;
+        } else if (parseLoadOption(args, i, options.load)) {
             continue;
+        } else {
+            cout << "Error: Unknown server option " << args[i] << endl;
+            return 1;
         }
+    }
 
-        // Parse line into tokens
-        vector<string> tokens = tokenize(line, ',');
+    const int sources = !options.catalogFile.empty() + !options.primary.empty() + !options.shardRouter.empty();
+    if (sources != 1 || options.port <= 0 || options.port > 65535 || options.replicationPort < 0 ||
+        options.replicationPort > 65535 || options.shardIndex >= options.shardCount) {
+        cout << "Usage: ABCUCoursePlanner --serve <file> [--bind <address>] "
+                "[--port <n>] [--threads <n>] [--cache-entries <n>] [--numa] "
+                "[--warm-up] [--mlock] [--duplicates <policy>] "
+                "[--frequencies <file>] [--snapshot-cache <dir|off>] [--record <log>] "
+                "[--slow-log <file>] "
+                "[--slow-threshold <ms>] [--metrics-file <file>] "
+                "[--metrics-interval <seconds>] [--replicate-port <n>] [--version-file <file>] "
+                "[--shard <i>/<n>]" << endl;
+        cout << "       ABCUCoursePlanner --replica <primary address:port> [server options]" << endl;
+        cout << "       ABCUCoursePlanner --router <address:port>,<address:port>... [server options]" << endl;
+        return 1;
+    }
+    if (options.shardCount > 1 && options.catalogFile.empty()) {
+        cout << "Error: Only a server loading a catalog file can be a shard" << endl;
+        return 1;
+    }
+    if (!options.shardRouter.empty() && options.replicationPort != 0) {
+        cout << "Error: A router has no catalog to replicate" << endl;
+        return 1;
+    }
+    if (!options.primary.empty() && options.replicationPort != 0) {
+        cout << "Error: A replica cannot accept replicas of its own" << endl;
+        return 1;
+    }
 
-        // Validate minimum number of fields
-        if (tokens.size() < 2) {
-            cout << "Error: Line " << lineNumber << " has insufficient data" << endl;
-            cout << "Each line must have at least course number and title" << endl;
-            file.close();
-            return false;
+    shared_ptr<Catalog> catalog = make_shared<Catalog>();
+    uint64_t version = 0;
+    ReplicaClient replica(options.primary);
+    if (!options.primary.empty()) {
+        catalog = replica.Bootstrap(&version);
+        if (catalog == nullptr) {
+            return 1;
         }
-
-        // Create course object
-        Course course;
-        course.courseNumber = tokens[0];
-        course.courseTitle = tokens[1];
-
-        // Add prerequisites (if any) - skip empty strings
-        for (size_t i = 2; i < tokens.size(); i++) {
-            // Only add non-empty prerequisites
-            if (!tokens[i].empty()) {
-                course.prerequisites.push_back(tokens[i]);
-            }
+    } else if (!options.catalogFile.empty()) {
+        if (!loadCatalog(options.catalogFile, catalog.get(), options.load)) {
+            return 1;
+        }
+        if (options.shardCount > 1) {
+            catalog = shardCatalog(*catalog, ShardRing(options.shardCount), options.shardIndex);
+            cout << "Kept shard " << options.shardIndex << " of " << options.shardCount << ": "
+                 << catalog->courses.Size() << " courses" << endl;
         }
-
-        // Store course and track valid course numbers
-        courses.push_back(course);
-        validCourseNumbers.push_back(course.courseNumber);
+    }
+    unique_ptr<ShardRouter> router;
+    if (!options.shardRouter.empty()) {
+        const pmr::vector<string_view> shards = tokenize(options.shardRouter, ',');
+        router = make_unique<ShardRouter>(vector<string>(shards.begin(), shards.end()));
     }
 
-    file.close();
-
-    // Second pass: Validate prerequisites exist
-    for (const auto& course : courses) {
-        for (const auto& prereq : course.prerequisites) {
-            // Skip empty prerequisites
-            if (prereq.empty()) {
-                continue;
-            }
-
-            // Check if prerequisite exists in course list
-            if (ranges::find(validCourseNumbers, prereq)
-                == validCourseNumbers.end()) {
-                cout << "Error: Prerequisite " << prereq << " for course "
-                     << course.courseNumber << " does not exist" << endl;
-                return false;
-            }
+    if (options.replicationPort != 0) {
+        if (options.versionFile.empty()) {
+            options.versionFile = options.catalogFile + ".version";
+        }
+        // Continue above the last version replicas may already hold
+        version = ReplicationPrimary::SavedVersion(options.versionFile) + 1;
+    }
+    QueryService service(std::move(catalog), options.cacheEntries, version);
+    QueryLog queryLog;
+    if (!options.recordFile.empty()) {
+        if (!queryLog.Open(options.recordFile)) {
+            return 1;
+        }
+        service.SetLog(&queryLog);
+    }
+    SlowQueryLog slowLog(options.slowThreshold);
+    if (!options.slowLogFile.empty()) {
+        if (!slowLog.Open(options.slowLogFile)) {
+            return 1;
         }
+        service.SetSlowLog(&slowLog);
+    }
+    service.EnableLatencyMetrics();
+    unique_ptr<MetricsFileWriter> metrics;
+    if (!options.metricsFile.empty()) {
+        metrics = make_unique<MetricsFileWriter>(service, options.metricsFile, options.metricsInterval);
+    }
+    if (options.numa) {
+        const vector<vector<int>> nodes = detectNumaNodes();
+        service.ReplicatePerNode(nodes);
+        cout << "Replicated catalog across " << nodes.size() << " NUMA node(s)" << endl;
+    }
+    if (options.warmUp) {
+        warmUpService(service, max(1u, thread::hardware_concurrency()), options.lockMemory);
     }
 
-    // All validation passed - load into BST
-    for (const auto& course : courses) {
-        bst->Insert(course);
+    ReplicationPrimary replication;
+    if (options.replicationPort != 0 &&
+        !replication.Start(options.bindAddress, options.replicationPort, service.Current(),
+                           options.versionFile)) {
+        return 1;
+    }
+    const bool isPrimary = options.replicationPort != 0;
+    if (!options.primary.empty()) {
+        replica.Follow(service);
     }
 
-    cout << "Successfully loaded " << courses.size() << " courses." << endl;
-    return true;
+    const HttpServer server(service, std::move(options), isPrimary ? &replication : nullptr, router.get());
+    const bool served = server.Run();
+    replica.Stop();
+    return served ? 0 : 1;
+#else
+    (void)args;
+    cout << "Error: Server mode is only supported on Linux" << endl;
+    return 1;
+#endif
 }
 
 /**
- * Display the main menu
+ * Print the most popular courses matching a partial number or title
+ *
+ * @param catalog Pointer to the loaded catalog
+ * @param prefix Partial course number or title
  */
-void displayMenu() {
-    cout << "\n========================================" << endl;
-    cout << "Welcome to the course planner." << endl;
-    cout << "========================================" << endl;
-    cout << "  1. Load Data Structure" << endl;
-    cout << "  2. Print Course List" << endl;
-    cout << "  3. Print Course" << endl;
-    cout << "\n  9. Exit" << endl;
-    cout << "========================================" << endl;
-    cout << "What would you like to do? ";
+void printCompletions(const Catalog* catalog, const string& prefix) {
+    constexpr size_t suggestionCount = 10;
+    const auto completions = catalog->completions.Complete(prefix, suggestionCount);
+
+    if (completions.empty()) {
+        cout << "No courses match " << prefix << "." << endl;
+        return;
+    }
+    for (const auto& [course, popularity] : completions) {
+        cout << course->courseNumber << ", " << course->courseTitle
+             << " (viewed " << popularity << " times)" << endl;
+    }
 }
 
 /**
- * Print information for a specific course including prerequisites
+ * Print every course in a precomputed order
  *
- * @param bst Pointer to the binary search tree
- * @param courseNumber Course number to search for
+ * @param catalog Pointer to the loaded catalog
+ * @param orderName number, title, level or depth
  */
-void printCourse(const BinarySearchTree* bst, string courseNumber) {
-    // Extract only the course number (first token before comma or space)
-    const size_t commaPos = courseNumber.find(',');
-    const size_t spacePos = courseNumber.find(' ');
-
-    if (const size_t endPos = min(commaPos, spacePos); endPos != string::npos) {
-        courseNumber = courseNumber.substr(0, endPos);
+void printCourseList(const Catalog* catalog, const string& orderName) {
+    SortOrder order;
+    if (!parseSortOrder(orderName, &order)) {
+        cout << "Error: Unknown order " << orderName << ". Use number, title, level or depth." << endl;
+        return;
     }
 
-    // Trim whitespace
-    courseNumber.erase(0, courseNumber.find_first_not_of(" \t\r\n"));
-    courseNumber.erase(courseNumber.find_last_not_of(" \t\r\n") + 1);
-
-    // Convert to uppercase for case-insensitive search
-    ranges::transform(courseNumber,
-                      courseNumber.begin(), ::toupper);
-
-    const Course course = bst->Search(courseNumber);
+    const vector<const Course*>& courses = catalog->completions.Courses();
+    for (size_t position = 0; position < courses.size(); position++) {
+        const uint32_t row = catalog->orders.RowAt(order, position);
+        cout << courses[row]->courseNumber << ", " << courses[row]->courseTitle;
+        if (order == SortOrder::Depth) {
+            cout << " (depth " << catalog->orders.Depth(row) << ")";
+        }
+        cout << endl;
+    }
+}
 
-    // Check if course was found
-    if (course.courseNumber.empty()) {
-        cout << "Course " << courseNumber << " not found." << endl;
+/**
+ * Print every course matching a filter expression
+ *
+ * @param catalog Pointer to the loaded catalog
+ * @param expression Filter such as dept=CSCI level>=300
+ */
+void printFilter(const Catalog* catalog, const string& expression) {
+    CourseFilter filter;
+    string error;
+    if (!filter.Compile(expression, &error)) {
+        cout << "Error: " << error << endl;
         return;
     }
 
-    // Print course information
-    cout << course.courseNumber << "," << course.courseTitle << endl;
-
-    // Print prerequisites
-    if (course.prerequisites.empty()) {
-        cout << "Prerequisites: None" << endl;
-    } else {
-        cout << "Prerequisites: ";
-        for (size_t i = 0; i < course.prerequisites.size(); i++) {
-            cout << course.prerequisites[i];
-            if (i < course.prerequisites.size() - 1) {
-                cout << ", ";
-            }
-        }
-        cout << endl;
+    string plan;
+    const vector<const Course*> matches = filter.Run(*catalog, &plan);
+    for (const Course* course : matches) {
+        cout << course->courseNumber << ", " << course->courseTitle << endl;
     }
+    cout << matches.size() << " matching courses (" << plan << ")" << endl;
 }
 
 //============================================================================
 // Main Function
 //============================================================================
 
+/**
+ * Check whether an argument selects a command-line mode
+ *
+ * @param arg A command-line argument
+ * @return true for --serve, --batch, --diff and the other mode flags
+ */
+bool isModeFlag(const string& arg) {
+    static const array<string_view, 8> modes = {"--serve", "--replica", "--router", "--batch",
+                                                "--diff", "--replay", "--archive", "--succinct"};
+    return ranges::find(modes, arg) != modes.end();
+}
+
+/**
+ * Run a command-line mode instead of the interactive menu
+ *
+ * @param args Command-line arguments, excluding the program name, with
+ *             the mode flag first
+ * @return Process exit code
+ */
+int runCommandLine(const vector<string>& args) {
+    if (args[0] == "--serve" || args[0] == "--replica" || args[0] == "--router") {
+        return runServer(args);
+    }
+    if (args[0] == "--batch") {
+        return runBatch(args);
+    }
+    if (args[0] == "--diff") {
+        return runDiff(args);
+    }
+    if (args[0] == "--replay") {
+        return runReplay(args);
+    }
+    if (args[0] == "--archive") {
+        return runArchive(args);
+    }
+    if (args[0] == "--succinct") {
+        return runSuccinct(args);
+    }
+
+    cout << "Usage: ABCUCoursePlanner [--duplicates <policy>] [--frequencies <file>] "
+            "[--snapshot-cache <dir|off>] [--memory-report] [--record <log>] | [--serve <file> | --replica <address:port> | "
+            "--router <addresses> | --batch <file> | "
+            "--diff <old> <new> | "
+            "--replay <log> <file> | --archive <index> <command> | "
+            "--succinct <file> <command>] [options]" << endl;
+    return 1;
+}
+
 /**
  * Main program entry point
  * Provides menu-driven interface for course management
  */
-int main() {
-    auto* bst = new BinarySearchTree();
+int main(int argc, char* argv[]) {
+    const vector<string> args(argv + 1, argv + argc);
+    LoadOptions loadOptions;
+
+    // Command-line modes skip the menu entirely. The mode flag may follow
+    // options meant for it, so move it to the front before dispatching
+    if (const auto mode = ranges::find_if(args, isModeFlag); mode != args.end()) {
+        vector<string> modeArgs{*mode};
+        modeArgs.insert(modeArgs.end(), args.begin(), mode);
+        modeArgs.insert(modeArgs.end(), mode + 1, args.end());
+        return runCommandLine(modeArgs);
+    }
+
+    // The menu itself only takes load options and a query log
+    string recordFile;
+    for (size_t i = 0; i < args.size(); i++) {
+        if (args[i] == "--record" && i + 1 < args.size()) {
+            recordFile = args[++i];
+        } else if (!parseLoadOption(args, i, loadOptions)) {
+            return runCommandLine(args);
+        }
+    }
+
+    // Opened only once every option is known to be valid, so a bad
+    // command line never truncates an existing log
+    QueryLog queryLog;
+    const bool recording = !recordFile.empty();
+    if (recording && !queryLog.Open(recordFile)) {
+        return 1;
+    }
+
+    auto* catalog = new Catalog();
     string filename;
     string courseNumber;
+    string transcript;
+    string prefix;
+    string expression;
+    string orderName;
     int choice = 0;
     bool dataLoaded = false;
 
@@ -433,8 +10706,16 @@ int main() {
                 cout << "Enter the file name: ";
                 getline(cin, filename);
 
-                if (loadCourses(filename, bst)) {
+                // Load into a fresh catalog so a reload never duplicates courses
+                if (auto* loaded = new Catalog(); loadCatalog(filename, loaded, loadOptions)) {
+                    if (dataLoaded) {
+                        loaded->completions.InheritScores(catalog->completions);
+                    }
+                    delete catalog;
+                    catalog = loaded;
                     dataLoaded = true;
+                } else {
+                    delete loaded;
                 }
                 break;
 
@@ -444,7 +10725,7 @@ int main() {
                     cout << "\nError: No data loaded. Please load data first (Option 1)." << endl;
                 } else {
                     cout << "\nHere is a sample schedule:\n" << endl;
-                    bst->InOrder();
+                    catalog->courses.InOrder();
                 }
                 break;
 
@@ -456,7 +10737,76 @@ int main() {
                     cout << "What course do you want to know about? (Enter course number): ";
                     getline(cin, courseNumber);
                     cout << endl;
-                    printCourse(bst, courseNumber);
+                    if (recording) {
+                        queryLog.Append({QueryType::Course, normalizeCourseNumber(courseNumber), "", 0, 0});
+                    }
+                    printCourse(catalog, courseNumber);
+                }
+                break;
+
+            case 4:
+                // Resolve a transfer transcript
+                if (!dataLoaded) {
+                    cout << "\nError: No data loaded. Please load data first (Option 1)." << endl;
+                } else {
+                    cout << "Enter completed courses (comma separated): ";
+                    getline(cin, transcript);
+                    cout << endl;
+                    if (recording) {
+                        queryLog.Append({QueryType::Eligibility, transcript, "", 0, 0});
+                    }
+                    printTransferEligibility(catalog, transcript);
+                }
+                break;
+
+            case 5:
+                // Suggest courses for a partial number or title
+                if (!dataLoaded) {
+                    cout << "\nError: No data loaded. Please load data first (Option 1)." << endl;
+                } else {
+                    cout << "Start typing a course number or title: ";
+                    getline(cin, prefix);
+                    cout << endl;
+                    if (recording) {
+                        queryLog.Append({QueryType::Complete, prefix, "", 0, 10});
+                    }
+                    printCompletions(catalog, prefix);
+                }
+                break;
+
+            case 6:
+                // Move frequently viewed courses towards the root
+                if (!dataLoaded) {
+                    cout << "\nError: No data loaded. Please load data first (Option 1)." << endl;
+                } else {
+                    rebuildByPopularity(catalog);
+                }
+                break;
+
+            case 7:
+                // Filter courses by department, level, prerequisites or title
+                if (!dataLoaded) {
+                    cout << "\nError: No data loaded. Please load data first (Option 1)." << endl;
+                } else {
+                    cout << "Enter a filter (e.g. dept=CSCI level>=300 title~\"data\"): ";
+                    getline(cin, expression);
+                    cout << endl;
+                    if (recording) {
+                        queryLog.Append({QueryType::Filter, expression, "", 0, 100});
+                    }
+                    printFilter(catalog, expression);
+                }
+                break;
+
+            case 8:
+                // Print the course list by title, department and level, or depth
+                if (!dataLoaded) {
+                    cout << "\nError: No data loaded. Please load data first (Option 1)." << endl;
+                } else {
+                    cout << "Sort by (number, title, level or depth): ";
+                    getline(cin, orderName);
+                    cout << endl;
+                    printCourseList(catalog, orderName);
                 }
                 break;
 
@@ -472,8 +10822,13 @@ int main() {
         }
     }
 
+    // Keep lookup counts for the next run
+    if (dataLoaded && !loadOptions.frequencyFile.empty()) {
+        saveFrequencies(loadOptions.frequencyFile, *catalog);
+    }
+
     // Clean up memory
-    delete bst;
+    delete catalog;
 
     return 0;
 }
\ No newline at end of file